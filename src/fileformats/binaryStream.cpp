@@ -0,0 +1,39 @@
+#include "binaryStream.h"
+
+void
+writeVolumeDimensions(BinaryWriter& writer, const VolumeDimensions& dims)
+{
+  writer.put(dims.sizeX);
+  writer.put(dims.sizeY);
+  writer.put(dims.sizeZ);
+  writer.put(dims.sizeC);
+  writer.put(dims.sizeT);
+  writer.put(dims.physicalSizeX);
+  writer.put(dims.physicalSizeY);
+  writer.put(dims.physicalSizeZ);
+  writer.put(dims.bitsPerPixel);
+  writer.putString(dims.dimensionOrder);
+  writer.put(uint32_t(dims.channelNames.size()));
+  for (const std::string& name : dims.channelNames) {
+    writer.putString(name);
+  }
+}
+
+bool
+readVolumeDimensions(BinaryReader& reader, VolumeDimensions& dims)
+{
+  uint32_t channelNameCount;
+  if (!(reader.get(dims.sizeX) && reader.get(dims.sizeY) && reader.get(dims.sizeZ) && reader.get(dims.sizeC) &&
+        reader.get(dims.sizeT) && reader.get(dims.physicalSizeX) && reader.get(dims.physicalSizeY) &&
+        reader.get(dims.physicalSizeZ) && reader.get(dims.bitsPerPixel) && reader.getString(dims.dimensionOrder) &&
+        reader.get(channelNameCount))) {
+    return false;
+  }
+  dims.channelNames.resize(channelNameCount);
+  for (std::string& name : dims.channelNames) {
+    if (!reader.getString(name)) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "graphics/volumeDimensions.h"
+
+#include <cstring>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+// Appends values to a buffer, in native byte order, for files that record their byte order to check it on reading.
+class BinaryWriter
+{
+public:
+  template<class T>
+  void put(const T& value)
+  {
+    m_bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+  void putString(const std::string& value)
+  {
+    put(uint32_t(value.size()));
+    m_bytes.append(value);
+  }
+  template<class T>
+  void putArray(const T* values, uint32_t count)
+  {
+    put(count);
+    m_bytes.append(reinterpret_cast<const char*>(values), sizeof(T) * count);
+  }
+
+  const std::string& bytes() const { return m_bytes; }
+
+private:
+  std::string m_bytes;
+};
+
+// Reads values back out of a buffer written by BinaryWriter, failing rather than reading past its end.
+class BinaryReader
+{
+public:
+  BinaryReader(const uint8_t* data, uint64_t size)
+    : m_pos(data)
+    , m_end(data + size)
+  {
+  }
+
+  template<class T>
+  bool get(T& value)
+  {
+    if (uint64_t(m_end - m_pos) < sizeof(T)) {
+      return false;
+    }
+    memcpy(&value, m_pos, sizeof(T));
+    m_pos += sizeof(T);
+    return true;
+  }
+  bool getString(std::string& value)
+  {
+    uint32_t length;
+    if (!get(length) || uint64_t(m_end - m_pos) < length) {
+      return false;
+    }
+    value.assign(reinterpret_cast<const char*>(m_pos), length);
+    m_pos += length;
+    return true;
+  }
+  template<class T>
+  bool getArray(std::vector<T>& values)
+  {
+    uint32_t count;
+    if (!get(count) || uint64_t(m_end - m_pos) / sizeof(T) < count) {
+      return false;
+    }
+    values.resize(count);
+    memcpy(values.data(), m_pos, sizeof(T) * count);
+    m_pos += sizeof(T) * count;
+    return true;
+  }
+
+private:
+  const uint8_t* m_pos;
+  const uint8_t* m_end;
+};
+
+void
+writeVolumeDimensions(BinaryWriter& writer, const VolumeDimensions& dims);
+bool
+readVolumeDimensions(BinaryReader& reader, VolumeDimensions& dims);
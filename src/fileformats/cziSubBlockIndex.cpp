@@ -0,0 +1,110 @@
+#include "cziSubBlockIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+void
+CziSubBlockIndex::build(const std::shared_ptr<libCZI::ICZIReader>& reader, const libCZI::SubBlockStatistics& statistics)
+{
+  int start[5] = { 0, 0, 0, 0, 0 };
+  int size = 0;
+  const libCZI::DimensionIndex dimensions[4] = {
+    libCZI::DimensionIndex::Z, libCZI::DimensionIndex::C, libCZI::DimensionIndex::T, libCZI::DimensionIndex::S
+  };
+  for (int i = 0; i < 4; ++i) {
+    statistics.dimBounds.TryGetInterval(dimensions[i], &start[i], &size);
+  }
+  start[4] = statistics.minMindex;
+
+  // each pyramid layer is scaled down by the same factor from the one below it
+  m_minificationFactor = 2;
+  for (const auto& scenePyramid : reader->GetPyramidStatistics().scenePyramidStatistics) {
+    for (const auto& layer : scenePyramid.second) {
+      if (!layer.layerInfo.IsLayer0() && !layer.layerInfo.IsNotIdentifiedAsPyramidLayer() &&
+          layer.layerInfo.minificationFactor > 1) {
+        m_minificationFactor = layer.layerInfo.minificationFactor;
+      }
+    }
+  }
+
+  m_planes.clear();
+  m_tileKeys.clear();
+  m_layers.clear();
+  m_maxTiles = 1;
+  reader->EnumerateSubBlocks([&](int idx, const libCZI::SubBlockInfo& info) -> bool {
+    // pyramid layers are stored with fewer pixels than they cover.
+    // Use the longer side to measure by how much; it's the less affected by rounding at the edges of the image.
+    int layer = 0;
+    bool wide = info.logicalRect.w >= info.logicalRect.h;
+    double logical = wide ? info.logicalRect.w : info.logicalRect.h;
+    double physical = wide ? info.physicalSize.w : info.physicalSize.h;
+    if (physical <= 0) {
+      return true;
+    }
+    if (physical < logical) {
+      layer = (int)std::lround(std::log(logical / physical) / std::log((double)m_minificationFactor));
+    }
+
+    int position[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 4; ++i) {
+      if (info.coordinate.TryGetPosition(dimensions[i], &position[i])) {
+        position[i] -= start[i];
+      }
+    }
+    // subblocks of non-mosaic files, and often those of pyramid layers, have an invalid M index
+    bool hasM = info.mIndex != std::numeric_limits<int>::min() && info.mIndex != std::numeric_limits<int>::max();
+
+    add(PlaneKey{ position[0], position[1], position[2], position[3], layer },
+        CziSubBlock{ idx, hasM ? info.mIndex - start[4] : -1, info.logicalRect, info.physicalSize });
+    return true;
+  });
+}
+
+void
+CziSubBlockIndex::add(const PlaneKey& plane, const CziSubBlock& subblock)
+{
+  TileKey tile{ plane, subblock.m, 0, 0 };
+  if (subblock.m < 0) {
+    tile.x = subblock.rect.x;
+    tile.y = subblock.rect.y;
+  }
+  if (!m_tileKeys.insert(tile).second) {
+    return;
+  }
+  m_layers.insert(plane.layer);
+
+  // directory order mostly follows M, so this is nearly always an append
+  std::vector<CziSubBlock>& tiles = m_planes[plane];
+  auto at = std::upper_bound(
+    tiles.begin(), tiles.end(), subblock, [](const CziSubBlock& a, const CziSubBlock& b) { return a.m < b.m; });
+  tiles.insert(at, subblock);
+  m_maxTiles = std::max(m_maxTiles, tiles.size());
+}
+
+const std::vector<CziSubBlock>*
+CziSubBlockIndex::tiles(const PlaneKey& plane) const
+{
+  auto it = m_planes.find(plane);
+  return it == m_planes.end() ? nullptr : &it->second;
+}
+
+size_t
+CziSubBlockIndex::KeyHash::operator()(const PlaneKey& key) const
+{
+  size_t h = std::hash<int>()(key.z);
+  for (int v : { key.c, key.t, key.s, key.layer }) {
+    h = h * 31 + std::hash<int>()(v);
+  }
+  return h;
+}
+
+size_t
+CziSubBlockIndex::KeyHash::operator()(const TileKey& key) const
+{
+  size_t h = (*this)(key.plane);
+  for (int v : { key.m, key.x, key.y }) {
+    h = h * 31 + std::hash<int>()(v);
+  }
+  return h;
+}
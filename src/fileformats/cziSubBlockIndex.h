@@ -0,0 +1,80 @@
+#pragma once
+
+#include <libCZI/Src/libCZI/libCZI.h>
+
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// A subblock: a whole plane, or one tile of a mosaic plane, at full resolution or in a pyramid layer
+struct CziSubBlock
+{
+  int index;
+  // M index relative to the first in the file, or -1 for subblocks without one
+  int m;
+  // where its pixels go, in layer 0 pixel coordinates
+  libCZI::IntRect rect;
+  // size of its pixels, smaller than rect in pyramid layers
+  libCZI::IntSize size;
+};
+
+// Every subblock of a CZI file, grouped by the plane, (Z, C, T, S) coordinate and pyramid layer, they belong to.
+// EnumSubset scans the whole subblock directory on every call, so looking up each plane with it costs
+// O(planes x subblocks) per load. Instead the directory is enumerated once, and every later plane lookup,
+// for this timepoint or any other, is a hash lookup.
+class CziSubBlockIndex
+{
+public:
+  // coordinates are relative to the start of each dimension's bounds; dimensions the file doesn't have are 0.
+  // layer is the pyramid layer number, 0 for full resolution.
+  struct PlaneKey
+  {
+    int z, c, t, s, layer;
+    bool operator==(const PlaneKey& other) const
+    {
+      return z == other.z && c == other.c && t == other.t && s == other.s && layer == other.layer;
+    }
+  };
+
+  void build(const std::shared_ptr<libCZI::ICZIReader>& reader, const libCZI::SubBlockStatistics& statistics);
+
+  // Add a subblock of a plane, as build does for each subblock in the file's directory order.
+  // A tile is identified by its M index, or, for subblocks without one such as those of pyramid layers, by where it
+  // goes; only the first subblock found for each tile is kept.
+  void add(const PlaneKey& plane, const CziSubBlock& subblock);
+
+  // the subblocks of a plane in increasing M order, then in directory order; nullptr if the file has none
+  const std::vector<CziSubBlock>* tiles(const PlaneKey& plane) const;
+
+  // the most subblocks any plane has; 1 for files that are not mosaics
+  size_t maxTilesPerPlane() const { return m_maxTiles; }
+
+  // pyramid layers present in the file, in increasing order and always including layer 0
+  const std::set<int>& layers() const { return m_layers; }
+
+  // how much smaller each pyramid layer is than the one below it
+  int minificationFactor() const { return m_minificationFactor; }
+
+private:
+  struct TileKey
+  {
+    PlaneKey plane;
+    int m, x, y;
+    bool operator==(const TileKey& other) const
+    {
+      return plane == other.plane && m == other.m && x == other.x && y == other.y;
+    }
+  };
+  struct KeyHash
+  {
+    size_t operator()(const PlaneKey& key) const;
+    size_t operator()(const TileKey& key) const;
+  };
+  std::unordered_map<PlaneKey, std::vector<CziSubBlock>, KeyHash> m_planes;
+  std::unordered_set<TileKey, KeyHash> m_tileKeys;
+  std::set<int> m_layers;
+  int m_minificationFactor = 2;
+  size_t m_maxTiles = 1;
+};
@@ -1,15 +1,25 @@
 #include "fileReader.h"
 
+#include "fileReaderBricks.h"
 #include "fileReaderCzi.h"
 #include "fileReaderTIFF.h"
+#include "fileReaderZarr.h"
+#include "volumeDiskCache.h"
 #include "graphics/imageXYZC.h"
+#include "graphics/pagedVolume.h"
+#include "graphics/parallel.h"
 
 #include "spdlog/spdlog.h"
 
+#include <algorithm>
 #include <chrono>
-#include <map>
 
-std::map<std::string, std::shared_ptr<ImageXYZC>> FileReader::sPreloadedImageCache;
+#include <sys/stat.h>
+
+ImageCache FileReader::sImageCache;
+std::shared_ptr<VolumeDiskCache> FileReader::sDiskCache;
+std::mutex FileReader::sDiskCacheMutex;
+std::atomic<uint32_t> FileReader::sLoaderThreadCount(0);
 
 std::string
 extension(const std::string& filepath)
@@ -29,29 +39,143 @@ FileReader::loadFromFile(const std::string& filepath,
                          int32_t scene,
                          bool addToCache)
 {
-  // check cache first of all.
-  auto cached = sPreloadedImageCache.find(filepath);
-  if (cached != sPreloadedImageCache.end()) {
-    return cached->second;
-  }
+  return FileReader::loadFromFile(LoadSpec(filepath, time, scene), dims, addToCache);
+}
+
+std::shared_ptr<ImageXYZC>
+FileReader::loadFromFile(const LoadSpec& spec, VolumeDimensions* dims, bool addToCache, LoadControl* control)
+{
+  // check cache first of all. Concurrent requests for the same volume share one load.
+  ImageCache::Key key(spec);
+  auto load = [&spec, &key, control](VolumeDimensions* loadedDims) {
+    std::shared_ptr<VolumeDiskCache> diskCache = FileReader::diskCache();
+    std::shared_ptr<ImageXYZC> image;
+    if (diskCache) {
+      image = diskCache->load(key, loadedDims);
+      if (image) {
+        if (control) {
+          control->setTotal(1);
+          control->stepDone();
+        }
+        return image;
+      }
+    }
+
+    std::string extstr = extension(spec.filepath);
+    for (std::string::size_type i = 0; i < extstr.length(); ++i) {
+      extstr[i] = std::tolower(extstr[i]);
+    }
 
-  std::shared_ptr<ImageXYZC> image;
+    if (FileReaderZarr::isZarr(spec.filepath)) {
+      image = FileReaderZarr::loadOMEZarr(spec, loadedDims, control);
+    } else if (extstr == ".tif" || extstr == ".tiff") {
+      image = FileReaderTIFF::loadOMETiff(spec, loadedDims, control);
+    } else if (extstr == ".czi") {
+      image = FileReaderCzi::loadCzi(spec, loadedDims, control);
+    } else if (extstr == FileReaderBricks::EXTENSION) {
+      image = FileReaderBricks::loadBricks(spec, loadedDims, control);
+    }
 
-  std::string extstr = extension(filepath);
+    // Written after this load returns. Bricks files and volumes used in place from a mapped file are already as quick
+    // to open as an entry would be.
+    if (diskCache && image && image->ownsData() && extstr != FileReaderBricks::EXTENSION) {
+      diskCache->storeLater(key, image, *loadedDims);
+    }
+    return image;
+  };
+  return sImageCache.findOrLoad(key, dims, load, addToCache, control);
+}
+
+std::shared_ptr<PagedVolume>
+FileReader::openPagedVolume(const LoadSpec& spec, size_t budget)
+{
+  std::string extstr = extension(spec.filepath);
   for (std::string::size_type i = 0; i < extstr.length(); ++i) {
     extstr[i] = std::tolower(extstr[i]);
   }
 
-  if (extstr == ".tif" || extstr == ".tiff") {
-    image = FileReaderTIFF::loadOMETiff(filepath, dims, time, scene);
-  } else if (extstr == ".czi") {
-    image = FileReaderCzi::loadCzi(filepath, dims, time, scene);
+  std::shared_ptr<BrickSource> source;
+  if (FileReaderZarr::isZarr(spec.filepath)) {
+    source = FileReaderZarr::openBrickSource(spec);
+  } else if (extstr == FileReaderBricks::EXTENSION) {
+    source = FileReaderBricks::openBrickSource(spec.filepath);
+  } else {
+    spdlog::error("{} can't be read brick by brick; convert it to a {} file first",
+                  spec.filepath,
+                  FileReaderBricks::EXTENSION);
+    return nullptr;
+  }
+  if (!source) {
+    return nullptr;
   }
+  return std::make_shared<PagedVolume>(source, budget);
+}
 
-  if (addToCache && image) {
-    sPreloadedImageCache[filepath] = image;
+std::future<FileReader::LoadResult>
+FileReader::loadFromFileAsync(const LoadSpec& spec, std::shared_ptr<LoadControl> control, bool addToCache)
+{
+  return std::async(std::launch::async, [spec, control, addToCache]() {
+    LoadResult result;
+    result.image = FileReader::loadFromFile(spec, &result.dims, addToCache, control.get());
+    return result;
+  });
+}
+
+// describes the channels of extra following those of dims
+static void
+appendChannels(VolumeDimensions& dims, const VolumeDimensions& extra)
+{
+  dims.sizeC += extra.sizeC;
+  dims.channelNames.insert(dims.channelNames.end(), extra.channelNames.begin(), extra.channelNames.end());
+  dims.valueOffsets.insert(dims.valueOffsets.end(), extra.valueOffsets.begin(), extra.valueOffsets.end());
+  dims.valueScales.insert(dims.valueScales.end(), extra.valueScales.begin(), extra.valueScales.end());
+}
+
+std::shared_ptr<ImageXYZC>
+FileReader::addChannels(LoadSpec& spec,
+                        const std::shared_ptr<ImageXYZC>& image,
+                        const std::vector<uint32_t>& channels,
+                        VolumeDimensions* dims,
+                        LoadControl* control)
+{
+  if (spec.channels.empty()) {
+    // every channel is loaded already
+    return image;
+  }
+  std::vector<uint32_t> missing;
+  for (uint32_t channel : channels) {
+    if (std::find(spec.channels.begin(), spec.channels.end(), channel) == spec.channels.end() &&
+        std::find(missing.begin(), missing.end(), channel) == missing.end()) {
+      missing.push_back(channel);
+    }
+  }
+  if (missing.empty()) {
+    return image;
+  }
+
+  LoadSpec extraSpec = spec;
+  extraSpec.channels = missing;
+  VolumeDimensions extraDims;
+  std::shared_ptr<ImageXYZC> extra = loadFromFile(extraSpec, &extraDims, false, control);
+  if (!extra) {
+    return nullptr;
+  }
+  std::shared_ptr<ImageXYZC> combined = image->addChannels(*extra);
+  if (!combined) {
+    return nullptr;
+  }
+
+  VolumeDimensions cachedDims;
+  std::shared_ptr<ImageXYZC> cached = sImageCache.find(ImageCache::Key(spec), &cachedDims);
+  spec.channels.insert(spec.channels.end(), missing.begin(), missing.end());
+  if (cached == image) {
+    appendChannels(cachedDims, extraDims);
+    sImageCache.insert(ImageCache::Key(spec), combined, cachedDims);
+  }
+  if (dims) {
+    appendChannels(*dims, extraDims);
   }
-  return image;
+  return combined;
 }
 
 std::shared_ptr<ImageXYZC>
@@ -70,9 +194,10 @@ FileReader::loadFromArray_4D(uint8_t* dataArray,
                              bool addToCache)
 {
   // check cache first of all.
-  auto cached = sPreloadedImageCache.find(name);
-  if (cached != sPreloadedImageCache.end()) {
-    return cached->second;
+  ImageCache::Key key{ LoadSpec(name) };
+  std::shared_ptr<ImageXYZC> cached = sImageCache.find(key);
+  if (cached) {
+    return cached;
   }
 
   // assume data is in CZYX order:
@@ -109,7 +234,84 @@ FileReader::loadFromArray_4D(uint8_t* dataArray,
 
   std::shared_ptr<ImageXYZC> sharedImage(im);
   if (addToCache) {
-    sPreloadedImageCache[name] = sharedImage;
+    VolumeDimensions volumeDims;
+    volumeDims.sizeX = sizeX;
+    volumeDims.sizeY = sizeY;
+    volumeDims.sizeZ = sizeZ;
+    volumeDims.sizeC = sizeC;
+    volumeDims.sizeT = sizeT;
+    volumeDims.physicalSizeX = physicalSizeX;
+    volumeDims.physicalSizeY = physicalSizeY;
+    volumeDims.physicalSizeZ = physicalSizeZ;
+    volumeDims.bitsPerPixel = bpp;
+    volumeDims.channelNames = channelNames;
+    sImageCache.insert(key, sharedImage, volumeDims);
   }
   return sharedImage;
 }
+
+void
+FileReader::setLoaderThreadCount(uint32_t numThreads)
+{
+  sLoaderThreadCount = numThreads;
+}
+
+uint32_t
+FileReader::loaderThreadCount()
+{
+  uint32_t numThreads = sLoaderThreadCount;
+  return numThreads > 0 ? numThreads : hardwareThreadCount();
+}
+
+ImageCache&
+FileReader::imageCache()
+{
+  return sImageCache;
+}
+
+void
+FileReader::setDiskCacheDirectory(const std::string& directory, uint64_t budget)
+{
+  std::lock_guard<std::mutex> lock(sDiskCacheMutex);
+  sDiskCache = directory.empty() ? nullptr : std::make_shared<VolumeDiskCache>(directory, budget);
+}
+
+std::string
+FileReader::diskCacheDirectory()
+{
+  std::lock_guard<std::mutex> lock(sDiskCacheMutex);
+  return sDiskCache ? sDiskCache->directory() : std::string();
+}
+
+void
+FileReader::flushDiskCache()
+{
+  std::shared_ptr<VolumeDiskCache> cache = diskCache();
+  if (cache) {
+    cache->flush();
+  }
+}
+
+std::shared_ptr<VolumeDiskCache>
+FileReader::diskCache()
+{
+  std::lock_guard<std::mutex> lock(sDiskCacheMutex);
+  return sDiskCache;
+}
+
+int64_t
+FileReader::fileModificationTime(const std::string& filepath)
+{
+#ifdef _WIN32
+  struct _stat64 st;
+  if (_stat64(filepath.c_str(), &st) != 0) {
+    return 0;
+  }
+#else
+  struct stat st;
+  if (stat(filepath.c_str(), &st) != 0) {
+    return 0;
+  }
+#endif
+  return (int64_t)st.st_mtime;
+}
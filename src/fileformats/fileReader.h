@@ -1,12 +1,20 @@
 #pragma once
 
-#include <map>
+#include "graphics/volumeDimensions.h"
+#include "imageCache.h"
+#include "loadControl.h"
+#include "loadSpec.h"
+#include "volumeDiskCache.h"
+
+#include <atomic>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 class ImageXYZC;
-struct VolumeDimensions;
+class PagedVolume;
 
 class FileReader
 {
@@ -20,6 +28,36 @@ public:
                                                  int32_t scene = 0,
                                                  bool addToCache = false);
 
+  static std::shared_ptr<ImageXYZC> loadFromFile(const LoadSpec& spec,
+                                                 VolumeDimensions* dims = nullptr,
+                                                 bool addToCache = false,
+                                                 LoadControl* control = nullptr);
+
+  struct LoadResult
+  {
+    // empty if the load failed or was cancelled
+    std::shared_ptr<ImageXYZC> image;
+    VolumeDimensions dims;
+  };
+
+  // Load on a thread of its own, so that the caller can carry on (e.g. keep rendering) meanwhile.
+  // control, if given, reports progress and can cancel the load; it is kept alive until the load ends.
+  // As with any std::async future, destroying the future waits for the load to end, so cancel a stale load first.
+  static std::future<LoadResult> loadFromFileAsync(const LoadSpec& spec,
+                                                   std::shared_ptr<LoadControl> control = nullptr,
+                                                   bool addToCache = false);
+
+  // Reads more channels of the file of an image that was loaded with spec, e.g. as the user enables them for display,
+  // and returns a new image with the image's channels followed by the new ones, in the order given. Channels the
+  // image already holds are skipped; if all are, the image itself is returned. spec.channels (and dims, which
+  // describes the image) are extended to match the new image. The image is left as it is, for anyone else holding
+  // it; if the image cache holds it, the new image is cached under the new spec as well. Null on failure.
+  static std::shared_ptr<ImageXYZC> addChannels(LoadSpec& spec,
+                                                const std::shared_ptr<ImageXYZC>& image,
+                                                const std::vector<uint32_t>& channels,
+                                                VolumeDimensions* dims = nullptr,
+                                                LoadControl* control = nullptr);
+
   static std::shared_ptr<ImageXYZC> loadFromFile_4D(const std::string& filepath,
                                                     VolumeDimensions* dims = nullptr,
                                                     bool addToCache = false);
@@ -32,6 +70,37 @@ public:
                                                      std::vector<float> physicalSizes = { 1.0f, 1.0f, 1.0f },
                                                      bool addToCache = false);
 
+  // Opens a volume to be read brick by brick, keeping at most budget bytes of it in memory, for volumes too large to
+  // load whole. Only formats that can read any brick cheaply qualify: bricked files and OME-Zarr stores. Convert other
+  // files with FileReaderBricks::convertToBricks first. Null on failure.
+  static std::shared_ptr<PagedVolume> openPagedVolume(const LoadSpec& spec, size_t budget);
+
+  // Number of threads that file loaders spread reading and decoding across.
+  // 0 (the default) means one per hardware thread.
+  static void setLoaderThreadCount(uint32_t numThreads);
+  static uint32_t loaderThreadCount();
+
+  // last modification time of a file in seconds since the epoch, or 0 if the file can't be found.
+  // Lets cached data derived from a file notice that the file has been rewritten.
+  static int64_t fileModificationTime(const std::string& filepath);
+
+  // Volumes loaded with addToCache, looked up again before any load. Use it to adjust the budget or read the stats.
+  static ImageCache& imageCache();
+
+  // Keep every volume decoded from a file under directory, and open it from there the next time it is loaded,
+  // as long as the file is unchanged. An empty directory (the default) turns this off.
+  // Volumes are written in the background; once the directory holds more than budget bytes, the least recently used
+  // are deleted.
+  static void setDiskCacheDirectory(const std::string& directory, uint64_t budget = VolumeDiskCache::DEFAULT_BUDGET);
+  static std::string diskCacheDirectory();
+  // waits until the volumes loaded so far are written to the disk cache
+  static void flushDiskCache();
+
 private:
-  static std::map<std::string, std::shared_ptr<ImageXYZC>> sPreloadedImageCache;
+  static std::shared_ptr<VolumeDiskCache> diskCache();
+
+  static ImageCache sImageCache;
+  static std::shared_ptr<VolumeDiskCache> sDiskCache;
+  static std::mutex sDiskCacheMutex;
+  static std::atomic<uint32_t> sLoaderThreadCount;
 };
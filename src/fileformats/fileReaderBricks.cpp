@@ -0,0 +1,630 @@
+#include "fileReaderBricks.h"
+
+#include "binaryStream.h"
+#include "fileReader.h"
+#include "loadControl.h"
+#include "memoryMappedFile.h"
+
+#include "graphics/histogramAccumulator.h"
+#include "graphics/imageXYZC.h"
+#include "graphics/pagedVolume.h"
+#include "graphics/parallel.h"
+#include "graphics/pixelConversion.h"
+
+#include "spdlog/spdlog.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+const char* FileReaderBricks::EXTENSION = ".agvb";
+
+static const char BRICKS_MAGIC[8] = { 'A', 'G', 'A', 'V', 'E', 'B', 'R', 'K' };
+static const uint32_t BRICKS_VERSION = 1;
+// reads back differently on a machine of the other byte order
+static const uint32_t BRICKS_BYTE_ORDER = 0x01020304;
+// where the index offset sits in the header: after the magic, version and byte order
+static const size_t BRICKS_INDEX_OFFSET_POSITION = 8 + 4 + 4;
+
+// how a brick is stored
+enum BrickCodec : uint32_t
+{
+  BRICK_RAW = 0,
+  // the first bytes of all voxels, then their second bytes if they have two, deflated
+  BRICK_DEFLATE_SHUFFLED = 1
+};
+
+struct BrickIndexEntry
+{
+  uint64_t offset;
+  uint32_t size;
+  uint32_t codec;
+};
+
+// what the header of a bricked file says about it
+struct BrickLayout
+{
+  VolumeDimensions dims;
+  uint32_t brickSize = 0;
+  uint32_t bricksX = 0, bricksY = 0, bricksZ = 0;
+  uint64_t indexOffset = 0;
+
+  void setBrickSize(uint32_t size)
+  {
+    brickSize = size;
+    bricksX = (dims.sizeX + brickSize - 1) / brickSize;
+    bricksY = (dims.sizeY + brickSize - 1) / brickSize;
+    bricksZ = (dims.sizeZ + brickSize - 1) / brickSize;
+  }
+  // voxels are stored at the bits per pixel of the volume dimensions, 8 or 16, in memory and in the file
+  size_t bytesPerVoxel() const { return dims.bitsPerPixel / 8; }
+  size_t bricksPerChannel() const { return size_t(bricksX) * bricksY * bricksZ; }
+  size_t indexSize() const { return bricksPerChannel() * dims.sizeC * dims.sizeT; }
+  // bricks are stored by time, then channel, then in z, y, x order
+  size_t brickNumber(uint32_t t, uint32_t c, uint32_t bx, uint32_t by, uint32_t bz) const
+  {
+    return ((size_t(t) * dims.sizeC + c) * bricksZ + bz) * bricksY * bricksX + size_t(by) * bricksX + bx;
+  }
+  // the voxels covered by a brick
+  VoxelRegion brickRegion(uint32_t bx, uint32_t by, uint32_t bz) const
+  {
+    VoxelRegion region;
+    region.minX = bx * brickSize;
+    region.minY = by * brickSize;
+    region.minZ = bz * brickSize;
+    region.maxX = std::min(region.minX + brickSize, dims.sizeX);
+    region.maxY = std::min(region.minY + brickSize, dims.sizeY);
+    region.maxZ = std::min(region.minZ + brickSize, dims.sizeZ);
+    return region;
+  }
+};
+
+static bool
+readBrickLayout(const MemoryMappedFile& file, BrickLayout& layout)
+{
+  BinaryReader reader(file.data(), file.size());
+  char magic[8];
+  uint32_t version, byteOrder, brickSize;
+  if (!(reader.get(magic) && reader.get(version) && reader.get(byteOrder) && reader.get(layout.indexOffset) &&
+        readVolumeDimensions(reader, layout.dims) && reader.get(brickSize))) {
+    return false;
+  }
+  if (memcmp(magic, BRICKS_MAGIC, sizeof(magic)) != 0 || byteOrder != BRICKS_BYTE_ORDER) {
+    return false;
+  }
+  if (version != BRICKS_VERSION) {
+    spdlog::error("Bricked volume format version {} is not supported", version);
+    return false;
+  }
+  if (brickSize == 0 || !layout.dims.validate() || (layout.dims.bitsPerPixel != 8 && layout.dims.bitsPerPixel != 16)) {
+    return false;
+  }
+  layout.setBrickSize(brickSize);
+
+  // the index: its size, then one entry per brick
+  uint64_t indexEntries;
+  if (layout.indexOffset > file.size() - sizeof(indexEntries)) {
+    return false;
+  }
+  memcpy(&indexEntries, file.data() + layout.indexOffset, sizeof(indexEntries));
+  return indexEntries == layout.indexSize() &&
+         (file.size() - layout.indexOffset - sizeof(indexEntries)) / sizeof(BrickIndexEntry) >= indexEntries;
+}
+
+static BrickIndexEntry
+readBrickIndexEntry(const MemoryMappedFile& file, const BrickLayout& layout, size_t brickNumber)
+{
+  BrickIndexEntry entry;
+  memcpy(&entry,
+         file.data() + layout.indexOffset + sizeof(uint64_t) + brickNumber * sizeof(BrickIndexEntry),
+         sizeof(BrickIndexEntry));
+  return entry;
+}
+
+// Compresses a brick of count voxels of bytesPerVoxel bytes each, or leaves it raw when compression doesn't make it
+// smaller. Splitting the low and high bytes of 16-bit voxels apart first puts the slowly varying high bytes in long
+// runs for deflate.
+static void
+encodeBrick(const uint8_t* voxels,
+            size_t count,
+            size_t bytesPerVoxel,
+            std::vector<uint8_t>& shuffled,
+            std::string& encoded,
+            uint32_t& codec)
+{
+  const size_t size = count * bytesPerVoxel;
+  shuffled.resize(size);
+  for (size_t b = 0; b < bytesPerVoxel; ++b) {
+    for (size_t i = 0; i < count; ++i) {
+      shuffled[b * count + i] = voxels[i * bytesPerVoxel + b];
+    }
+  }
+  uLongf compressedSize = compressBound(uLong(size));
+  encoded.resize(compressedSize);
+  int status =
+    compress2(reinterpret_cast<Bytef*>(&encoded[0]), &compressedSize, shuffled.data(), uLong(size), Z_BEST_SPEED);
+  if (status == Z_OK && compressedSize < size) {
+    encoded.resize(compressedSize);
+    codec = BRICK_DEFLATE_SHUFFLED;
+  } else {
+    encoded.assign(reinterpret_cast<const char*>(voxels), size);
+    codec = BRICK_RAW;
+  }
+}
+
+// Returns the brick's count voxels: either straight out of the file, or decoded into voxels.
+// Null if the brick is damaged.
+static const uint8_t*
+decodeBrick(const uint8_t* stored,
+            const BrickIndexEntry& entry,
+            size_t count,
+            size_t bytesPerVoxel,
+            std::vector<uint8_t>& shuffled,
+            std::vector<uint8_t>& voxels)
+{
+  const size_t size = count * bytesPerVoxel;
+  if (entry.codec == BRICK_RAW) {
+    return entry.size == size ? stored : nullptr;
+  }
+  if (entry.codec != BRICK_DEFLATE_SHUFFLED) {
+    return nullptr;
+  }
+  shuffled.resize(size);
+  uLongf decodedSize = uLongf(size);
+  if (uncompress(shuffled.data(), &decodedSize, stored, entry.size) != Z_OK || decodedSize != size) {
+    return nullptr;
+  }
+  voxels.resize(size);
+  for (size_t b = 0; b < bytesPerVoxel; ++b) {
+    for (size_t i = 0; i < count; ++i) {
+      voxels[i * bytesPerVoxel + b] = shuffled[b * count + i];
+    }
+  }
+  return voxels.data();
+}
+
+// Reads the voxels in box (which must lie inside the volume) of the given channels at one timepoint into voxels,
+// one channel after another, decoding the bricks that overlap it on up to maxThreads threads. T is the type of the
+// file's voxels, or uint16_t to widen 8-bit voxels.
+// If counts is not null, the voxels of each brick are counted into it as soon as they are copied.
+// False if a brick is damaged or control cancels the read.
+template<typename T>
+static bool
+readBricksRegion(const MemoryMappedFile& mapping,
+                 const BrickLayout& layout,
+                 int32_t time,
+                 const VoxelRegion& box,
+                 const std::vector<uint32_t>& readChannels,
+                 T* voxels,
+                 HistogramAccumulator* counts,
+                 uint32_t maxThreads,
+                 LoadControl* control,
+                 size_t* bricksRead = nullptr)
+{
+  // the bricks that overlap the region, in each channel to read
+  struct BrickRead
+  {
+    size_t brickNumber;
+    uint32_t outputChannel;
+    VoxelRegion brick;
+  };
+  std::vector<BrickRead> reads;
+  for (uint32_t i = 0; i < readChannels.size(); ++i) {
+    for (uint32_t bz = box.minZ / layout.brickSize; bz <= (box.maxZ - 1) / layout.brickSize; ++bz) {
+      for (uint32_t by = box.minY / layout.brickSize; by <= (box.maxY - 1) / layout.brickSize; ++by) {
+        for (uint32_t bx = box.minX / layout.brickSize; bx <= (box.maxX - 1) / layout.brickSize; ++bx) {
+          BrickRead read;
+          read.brickNumber = layout.brickNumber(time, readChannels[i], bx, by, bz);
+          read.outputChannel = i;
+          read.brick = layout.brickRegion(bx, by, bz);
+          reads.push_back(read);
+        }
+      }
+    }
+  }
+  // in file order
+  std::sort(reads.begin(), reads.end(), [](const BrickRead& a, const BrickRead& b) {
+    return a.brickNumber < b.brickNumber;
+  });
+
+  const size_t planeVoxels = size_t(box.sizeX()) * box.sizeY();
+  const size_t channelVoxels = planeVoxels * box.sizeZ();
+  const size_t bytesPerVoxel = layout.bytesPerVoxel();
+  assert(bytesPerVoxel <= sizeof(T));
+
+  if (control) {
+    control->setTotal((uint32_t)reads.size());
+  }
+  uint32_t numThreads = parallelThreadCount(reads.size(), maxThreads);
+  std::vector<std::vector<uint8_t>> shuffled(numThreads);
+  std::vector<std::vector<uint8_t>> decoded(numThreads);
+  std::atomic<bool> damaged(false);
+  parallelFor(reads.size(), numThreads, [&](size_t index, uint32_t worker) {
+    if (damaged || (control && control->isCancelled())) {
+      return;
+    }
+    const BrickRead& read = reads[index];
+    const VoxelRegion& brick = read.brick;
+    BrickIndexEntry entry = readBrickIndexEntry(mapping, layout, read.brickNumber);
+    const uint8_t* brickVoxels = nullptr;
+    if (entry.offset <= layout.indexOffset && entry.size <= layout.indexOffset - entry.offset) {
+      size_t count = size_t(brick.sizeX()) * brick.sizeY() * brick.sizeZ();
+      brickVoxels =
+        decodeBrick(mapping.data() + entry.offset, entry, count, bytesPerVoxel, shuffled[worker], decoded[worker]);
+    }
+    if (!brickVoxels) {
+      damaged = true;
+      return;
+    }
+
+    // copy the rows of the brick that fall inside the region
+    uint32_t x0 = std::max(brick.minX, box.minX), x1 = std::min(brick.maxX, box.maxX);
+    uint32_t y0 = std::max(brick.minY, box.minY), y1 = std::min(brick.maxY, box.maxY);
+    uint32_t z0 = std::max(brick.minZ, box.minZ), z1 = std::min(brick.maxZ, box.maxZ);
+    T* channelData = voxels + read.outputChannel * channelVoxels;
+    for (uint32_t z = z0; z < z1; ++z) {
+      for (uint32_t y = y0; y < y1; ++y) {
+        size_t srcVoxel =
+          (size_t(z - brick.minZ) * brick.sizeY() + (y - brick.minY)) * brick.sizeX() + (x0 - brick.minX);
+        const uint8_t* src = brickVoxels + srcVoxel * bytesPerVoxel;
+        T* dst =
+          channelData + size_t(z - box.minZ) * planeVoxels + size_t(y - box.minY) * box.sizeX() + (x0 - box.minX);
+        if (bytesPerVoxel == sizeof(T)) {
+          memcpy(dst, src, size_t(x1 - x0) * sizeof(T));
+        } else {
+          widen8to16(src, reinterpret_cast<uint16_t*>(dst), x1 - x0);
+        }
+      }
+      if (counts) {
+        const T* rows = channelData + size_t(z - box.minZ) * planeVoxels + size_t(y0 - box.minY) * box.sizeX() +
+                        (x0 - box.minX);
+        counts->addRows(read.outputChannel,
+                        reinterpret_cast<const uint8_t*>(rows),
+                        x1 - x0,
+                        y1 - y0,
+                        size_t(box.sizeX()) * sizeof(T));
+      }
+    }
+    if (control) {
+      control->stepDone();
+    }
+  });
+
+  if (bricksRead) {
+    *bricksRead = reads.size();
+  }
+  return !damaged && !(control && control->isCancelled());
+}
+
+// Serves the bricks of an open bricked file to a PagedVolume. The file stays mapped for as long as the source lives.
+class BricksFileSource : public BrickSource
+{
+public:
+  BricksFileSource(std::shared_ptr<MemoryMappedFile> mapping, const BrickLayout& layout)
+    : m_mapping(mapping)
+    , m_layout(layout)
+  {
+  }
+
+  VolumeDimensions dimensions() const override { return m_layout.dims; }
+  void brickSize(uint32_t& x, uint32_t& y, uint32_t& z) const override { x = y = z = m_layout.brickSize; }
+  bool readRegion(uint32_t c, uint32_t t, const VoxelRegion& region, uint16_t* dst) override
+  {
+    if (c >= m_layout.dims.sizeC || t >= m_layout.dims.sizeT || region.isEmpty() ||
+        region.maxX > m_layout.dims.sizeX || region.maxY > m_layout.dims.sizeY || region.maxZ > m_layout.dims.sizeZ) {
+      return false;
+    }
+    // PagedVolume reads bricks in parallel already
+    return readBricksRegion(
+      *m_mapping, m_layout, (int32_t)t, region, std::vector<uint32_t>(1, c), dst, nullptr, 1, nullptr);
+  }
+
+private:
+  std::shared_ptr<MemoryMappedFile> m_mapping;
+  BrickLayout m_layout;
+};
+
+FileReaderBricks::FileReaderBricks() {}
+
+FileReaderBricks::~FileReaderBricks() {}
+
+std::shared_ptr<ImageXYZC>
+FileReaderBricks::loadBricks(const LoadSpec& spec, VolumeDimensions* dims, LoadControl* control)
+{
+  if (spec.level > 0 || spec.maxDimension > 0) {
+    spdlog::warn("Bricked volume files have a single resolution level; reading full resolution");
+  }
+  return loadBricks(spec.filepath, spec.time, spec.region, spec.channels, dims, control);
+}
+
+std::shared_ptr<ImageXYZC>
+FileReaderBricks::loadBricks(const std::string& filepath,
+                             int32_t time,
+                             const VoxelRegion& region,
+                             const std::vector<uint32_t>& channels,
+                             VolumeDimensions* dims,
+                             LoadControl* control)
+{
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  std::shared_ptr<MemoryMappedFile> mapping = std::make_shared<MemoryMappedFile>(filepath);
+  if (!mapping->isOpen()) {
+    spdlog::error("Could not open {}", filepath);
+    return nullptr;
+  }
+  BrickLayout layout;
+  if (!readBrickLayout(*mapping, layout)) {
+    spdlog::error("{} is not a valid bricked volume file", filepath);
+    return nullptr;
+  }
+  const VolumeDimensions& fileDims = layout.dims;
+
+  if (time < 0 || time >= (int32_t)fileDims.sizeT) {
+    spdlog::error("Time {} is out of range for {} with {} timepoints", time, filepath, fileDims.sizeT);
+    return nullptr;
+  }
+  std::vector<uint32_t> readChannels = channels;
+  if (readChannels.empty()) {
+    for (uint32_t c = 0; c < fileDims.sizeC; ++c) {
+      readChannels.push_back(c);
+    }
+  }
+  for (uint32_t c : readChannels) {
+    if (c >= fileDims.sizeC) {
+      spdlog::error("Channel {} is out of range for {} with {} channels", c, filepath, fileDims.sizeC);
+      return nullptr;
+    }
+  }
+  if (!region.isValid()) {
+    spdlog::error("The requested region of {} is empty; leave it at its default to read the whole volume", filepath);
+    return nullptr;
+  }
+  VoxelRegion box = region.clampedTo(fileDims.sizeX, fileDims.sizeY, fileDims.sizeZ);
+  if (box.isEmpty()) {
+    spdlog::error("The requested region lies outside of {}", filepath);
+    return nullptr;
+  }
+
+  const size_t channelVoxels = size_t(box.sizeX()) * box.sizeY() * box.sizeZ();
+  uint8_t* data = new uint8_t[channelVoxels * readChannels.size() * layout.bytesPerVoxel()];
+  // the channel histograms are gathered while the bricks are decoded, not in another pass afterwards
+  HistogramAccumulator counts((uint32_t)readChannels.size(), layout.dims.bitsPerPixel);
+  size_t bricksRead = 0;
+  bool read = false;
+  if (layout.bytesPerVoxel() == 1) {
+    read = readBricksRegion(*mapping,
+                            layout,
+                            time,
+                            box,
+                            readChannels,
+                            data,
+                            &counts,
+                            FileReader::loaderThreadCount(),
+                            control,
+                            &bricksRead);
+  } else {
+    read = readBricksRegion(*mapping,
+                            layout,
+                            time,
+                            box,
+                            readChannels,
+                            reinterpret_cast<uint16_t*>(data),
+                            &counts,
+                            FileReader::loaderThreadCount(),
+                            control,
+                            &bricksRead);
+  }
+  if (!read) {
+    if (control && control->isCancelled()) {
+      spdlog::info("Load of {} cancelled", filepath);
+    } else {
+      spdlog::error("{} is damaged: a brick could not be decoded", filepath);
+    }
+    delete[] data;
+    return nullptr;
+  }
+
+  VolumeDimensions readDims = fileDims;
+  readDims.sizeX = box.sizeX();
+  readDims.sizeY = box.sizeY();
+  readDims.sizeZ = box.sizeZ();
+  readDims.sizeC = (uint32_t)readChannels.size();
+  readDims.channelNames.clear();
+  if (fileDims.channelNames.size() == fileDims.sizeC) {
+    for (uint32_t c : readChannels) {
+      readDims.channelNames.push_back(fileDims.channelNames[c]);
+    }
+  }
+
+  auto endTime = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> elapsed = endTime - startTime;
+  spdlog::debug("{} bricks read in {} ms", bricksRead, elapsed.count() * 1000.0);
+
+  ImageXYZC* im = new ImageXYZC(readDims.sizeX,
+                                readDims.sizeY,
+                                readDims.sizeZ,
+                                readDims.sizeC,
+                                fileDims.bitsPerPixel,
+                                data,
+                                readDims.physicalSizeX,
+                                readDims.physicalSizeY,
+                                readDims.physicalSizeZ,
+                                nullptr,
+                                counts.histograms(),
+                                {});
+  im->setPhysicalOffset(
+    box.minX * readDims.physicalSizeX, box.minY * readDims.physicalSizeY, box.minZ * readDims.physicalSizeZ);
+  if (readDims.channelNames.size() == readDims.sizeC) {
+    im->setChannelNames(readDims.channelNames);
+  }
+  if (dims) {
+    *dims = readDims;
+  }
+  return std::shared_ptr<ImageXYZC>(im);
+}
+
+std::shared_ptr<BrickSource>
+FileReaderBricks::openBrickSource(const std::string& filepath)
+{
+  std::shared_ptr<MemoryMappedFile> mapping = std::make_shared<MemoryMappedFile>(filepath);
+  BrickLayout layout;
+  if (!mapping->isOpen() || !readBrickLayout(*mapping, layout)) {
+    spdlog::error("{} is not a valid bricked volume file", filepath);
+    return nullptr;
+  }
+  return std::make_shared<BricksFileSource>(mapping, layout);
+}
+
+VolumeDimensions
+FileReaderBricks::loadDimensionsBricks(const std::string& filepath)
+{
+  MemoryMappedFile mapping(filepath);
+  BrickLayout layout;
+  if (!mapping.isOpen() || !readBrickLayout(mapping, layout)) {
+    spdlog::error("{} is not a valid bricked volume file", filepath);
+    return VolumeDimensions();
+  }
+  return layout.dims;
+}
+
+bool
+FileReaderBricks::writeBricks(const std::string& filepath,
+                              const VolumeDimensions& dims,
+                              const std::function<std::shared_ptr<ImageXYZC>(int32_t time)>& timepoint,
+                              uint32_t brickSize,
+                              LoadControl* control)
+{
+  if (brickSize == 0 || !dims.validate()) {
+    spdlog::error("Can't write {}: invalid dimensions or brick size", filepath);
+    return false;
+  }
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  BrickLayout layout;
+  layout.dims = dims;
+  // 8-bit volumes stay 8-bit; anything else is stored as ImageXYZC holds it, in 16 bits
+  layout.dims.bitsPerPixel = dims.bitsPerPixel == 8 ? 8 : 16;
+  layout.setBrickSize(brickSize);
+
+  BinaryWriter header;
+  header.put(BRICKS_MAGIC);
+  header.put(BRICKS_VERSION);
+  header.put(BRICKS_BYTE_ORDER);
+  // filled in once the bricks are written
+  header.put(uint64_t(0));
+  writeVolumeDimensions(header, layout.dims);
+  header.put(brickSize);
+
+  std::ofstream out(filepath, std::ios::binary | std::ios::trunc);
+  out.write(header.bytes().data(), header.bytes().size());
+  uint64_t position = header.bytes().size();
+
+  std::vector<BrickIndexEntry> index;
+  index.reserve(layout.indexSize());
+  if (control) {
+    control->setTotal(dims.sizeT * dims.sizeC);
+  }
+  uint32_t numThreads = parallelThreadCount(layout.bricksPerChannel(), FileReader::loaderThreadCount());
+  std::vector<std::vector<uint8_t>> gathered(numThreads);
+  std::vector<std::vector<uint8_t>> shuffled(numThreads);
+  std::vector<std::string> encoded(layout.bricksPerChannel());
+  std::vector<uint32_t> codecs(layout.bricksPerChannel());
+
+  bool ok = (bool)out;
+  for (uint32_t t = 0; ok && t < dims.sizeT; ++t) {
+    std::shared_ptr<ImageXYZC> image = timepoint(t);
+    if (!image || image->sizeX() != dims.sizeX || image->sizeY() != dims.sizeY || image->sizeZ() != dims.sizeZ ||
+        image->sizeC() != dims.sizeC || image->sizeOfElement() != layout.bytesPerVoxel()) {
+      spdlog::error("Can't write {}: timepoint {} is missing or doesn't match the dimensions", filepath, t);
+      ok = false;
+      break;
+    }
+    for (uint32_t c = 0; ok && c < dims.sizeC; ++c) {
+      const uint8_t* channel = image->ptr(c);
+      const size_t bytesPerVoxel = layout.bytesPerVoxel();
+      parallelFor(layout.bricksPerChannel(), numThreads, [&](size_t i, uint32_t worker) {
+        uint32_t bx = uint32_t(i % layout.bricksX);
+        uint32_t by = uint32_t(i / layout.bricksX % layout.bricksY);
+        uint32_t bz = uint32_t(i / layout.bricksX / layout.bricksY);
+        VoxelRegion brick = layout.brickRegion(bx, by, bz);
+        const size_t count = size_t(brick.sizeX()) * brick.sizeY() * brick.sizeZ();
+        std::vector<uint8_t>& voxels = gathered[worker];
+        voxels.resize(count * bytesPerVoxel);
+        uint8_t* dst = voxels.data();
+        for (uint32_t z = brick.minZ; z < brick.maxZ; ++z) {
+          for (uint32_t y = brick.minY; y < brick.maxY; ++y) {
+            const uint8_t* src = channel + ((size_t(z) * dims.sizeY + y) * dims.sizeX + brick.minX) * bytesPerVoxel;
+            memcpy(dst, src, brick.sizeX() * bytesPerVoxel);
+            dst += brick.sizeX() * bytesPerVoxel;
+          }
+        }
+        encodeBrick(voxels.data(), count, bytesPerVoxel, shuffled[worker], encoded[i], codecs[i]);
+      });
+
+      for (size_t i = 0; i < encoded.size(); ++i) {
+        out.write(encoded[i].data(), encoded[i].size());
+        index.push_back({ position, uint32_t(encoded[i].size()), codecs[i] });
+        position += encoded[i].size();
+      }
+      ok = (bool)out;
+      if (control) {
+        control->stepDone();
+        if (control->isCancelled()) {
+          ok = false;
+        }
+      }
+    }
+  }
+
+  if (ok) {
+    uint64_t indexEntries = index.size();
+    out.write(reinterpret_cast<const char*>(&indexEntries), sizeof(indexEntries));
+    out.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(BrickIndexEntry));
+    out.seekp(BRICKS_INDEX_OFFSET_POSITION);
+    out.write(reinterpret_cast<const char*>(&position), sizeof(position));
+    out.close();
+    ok = (bool)out;
+  }
+  if (!ok) {
+    out.close();
+    std::remove(filepath.c_str());
+    spdlog::error("Failed to write {}", filepath);
+    return false;
+  }
+
+  auto endTime = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> elapsed = endTime - startTime;
+  spdlog::info("Wrote {} bricks ({} bytes) to {} in {} ms", index.size(), position, filepath, elapsed.count() * 1000.0);
+  return true;
+}
+
+bool
+FileReaderBricks::convertToBricks(const std::string& sourcePath,
+                                  const std::string& filepath,
+                                  int32_t scene,
+                                  uint32_t brickSize,
+                                  LoadControl* control)
+{
+  VolumeDimensions dims;
+  std::shared_ptr<ImageXYZC> first = FileReader::loadFromFile(LoadSpec(sourcePath, 0, scene), &dims);
+  if (!first) {
+    spdlog::error("Can't convert {}: it could not be loaded", sourcePath);
+    return false;
+  }
+  auto timepoint = [&](int32_t time) {
+    if (time == 0) {
+      // hand over the timepoint already loaded, and let it go once written
+      std::shared_ptr<ImageXYZC> image = first;
+      first.reset();
+      return image;
+    }
+    return FileReader::loadFromFile(LoadSpec(sourcePath, time, scene));
+  };
+  return writeBricks(filepath, dims, timepoint, brickSize, control);
+}
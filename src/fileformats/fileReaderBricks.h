@@ -0,0 +1,58 @@
+#pragma once
+
+#include "graphics/volumeDimensions.h"
+#include "loadSpec.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class BrickSource;
+class ImageXYZC;
+class LoadControl;
+
+// Reads and writes AGAVE's own bricked volume files (.agvb), made for fast repeated access to data converted once
+// from slower formats. Each timepoint and channel is cut into bricks of brickSize^3 voxels (smaller at the far edges),
+// compressed one by one, and found through an index of bricks at the end of the file. A read maps the file into
+// memory and decodes just the bricks it needs, in parallel, so reading a region or a few channels costs only the
+// bricks that overlap them.
+class FileReaderBricks
+{
+public:
+  FileReaderBricks();
+  virtual ~FileReaderBricks();
+
+  static const char* EXTENSION;
+  static const uint32_t DEFAULT_BRICK_SIZE = 64;
+
+  // the scene and resolution level of spec are ignored: a bricked file holds one scene at one resolution
+  static std::shared_ptr<ImageXYZC> loadBricks(const LoadSpec& spec,
+                                               VolumeDimensions* dims = nullptr,
+                                               LoadControl* control = nullptr);
+  // Reads the voxels in region of the given channels (all of them if channels is empty) at one timepoint.
+  // dims describes the result: the size of the region, and the channels that were read.
+  static std::shared_ptr<ImageXYZC> loadBricks(const std::string& filepath,
+                                               int32_t time,
+                                               const VoxelRegion& region,
+                                               const std::vector<uint32_t>& channels,
+                                               VolumeDimensions* dims = nullptr,
+                                               LoadControl* control = nullptr);
+  static VolumeDimensions loadDimensionsBricks(const std::string& filepath);
+  // Opens a bricked file for reading brick by brick, e.g. into a PagedVolume, without loading any of it.
+  static std::shared_ptr<BrickSource> openBrickSource(const std::string& filepath);
+
+  // Writes a bricked file of the volume described by dims, with timepoint(t) supplying each of its timepoints.
+  // control counts one step per timepoint and channel, and can cancel the write.
+  static bool writeBricks(const std::string& filepath,
+                          const VolumeDimensions& dims,
+                          const std::function<std::shared_ptr<ImageXYZC>(int32_t time)>& timepoint,
+                          uint32_t brickSize = DEFAULT_BRICK_SIZE,
+                          LoadControl* control = nullptr);
+  // Converts one scene of any file that FileReader can load, all of its timepoints, into a bricked file.
+  static bool convertToBricks(const std::string& sourcePath,
+                              const std::string& filepath,
+                              int32_t scene = 0,
+                              uint32_t brickSize = DEFAULT_BRICK_SIZE,
+                              LoadControl* control = nullptr);
+};
@@ -1,7 +1,13 @@
 #include "fileReaderCzi.h"
 
+#include "cziSubBlockIndex.h"
+#include "fileReader.h"
+#include "loadControl.h"
 #include "graphics/boundingBox.h"
+#include "graphics/histogramAccumulator.h"
 #include "graphics/imageXYZC.h"
+#include "graphics/parallel.h"
+#include "graphics/pixelConversion.h"
 #include "graphics/volumeDimensions.h"
 
 #include "pugixml.hpp"
@@ -9,13 +15,22 @@
 
 #include <libCZI/Src/libCZI/libCZI.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
 #include <codecvt>
 #include <locale>
 #include <map>
-#include <set>
+#include <mutex>
 
-static const int IN_MEMORY_BPP = 16;
+// bits per pixel of the planes as they are read: 8-bit pixels stay 8-bit and float pixels are read as they are, to be
+// converted to 16 bits afterwards; everything else is kept as 16 bit
+static uint32_t
+readBpp(const VolumeDimensions& dims)
+{
+  return (dims.bitsPerPixel == 8 || dims.bitsPerPixel == 32) ? dims.bitsPerPixel : 16;
+}
 
 FileReaderCzi::FileReaderCzi() {}
 
@@ -62,18 +77,22 @@ getSceneYXSize(libCZI::SubBlockStatistics& statistics, int sceneIndex = 0)
   return statistics.boundingBoxLayer0Only;
 }
 
+// layer 0 pixel rectangle covered by a scene's planes, scene counted from the first scene in the file
+libCZI::IntRect
+getScenePlaneRect(libCZI::SubBlockStatistics& statistics, int32_t scene)
+{
+  int sStart = 0, sSize = 0;
+  statistics.dimBounds.TryGetInterval(libCZI::DimensionIndex::S, &sStart, &sSize);
+  return getSceneYXSize(statistics, sStart + scene);
+}
+
 bool
 readCziDimensions(const std::shared_ptr<libCZI::ICZIReader>& reader,
                   const std::string filepath,
                   libCZI::SubBlockStatistics& statistics,
-                  VolumeDimensions& dims)
+                  VolumeDimensions& dims,
+                  int32_t scene = 0)
 {
-  // check for mosaic.  we can't (won't) handle those right now.
-  if (statistics.maxMindex > 0) {
-    spdlog::error("CZI file is mosaic; mosaic reading not yet implemented");
-    return false;
-  }
-
   // metadata xml
   auto mds = reader->ReadMetadataSegment();
   std::shared_ptr<libCZI::ICziMetadata> md = mds->CreateMetaFromMetadataSegment();
@@ -103,7 +122,8 @@ readCziDimensions(const std::shared_ptr<libCZI::ICZIReader>& reader,
     return true;
   });
 
-  libCZI::IntRect planebox = getSceneYXSize(statistics);
+  // mosaic tiles get composited into the bounding box of their scene
+  libCZI::IntRect planebox = getScenePlaneRect(statistics, scene);
   dims.sizeX = planebox.w;
   dims.sizeY = planebox.h;
 
@@ -181,52 +201,326 @@ readCziDimensions(const std::shared_ptr<libCZI::ICZIReader>& reader,
   return dims.validate();
 }
 
+// The pyramid layer to read for a LoadSpec, and how much smaller than full resolution it is.
+struct CziPyramidLevel
+{
+  int layer = 0;
+  double downscale = 1.0;
+};
+
+CziPyramidLevel
+chooseCziPyramidLevel(const CziSubBlockIndex& index, const LoadSpec& spec, const libCZI::IntRect& planeRect)
+{
+  std::vector<int> layers(index.layers().begin(), index.layers().end());
+  if (layers.empty() || layers[0] != 0) {
+    layers.insert(layers.begin(), 0);
+  }
+  auto downscale = [&](int layer) { return std::pow((double)index.minificationFactor(), layer); };
+
+  size_t level = std::min((size_t)spec.level, layers.size() - 1);
+  if (spec.maxDimension > 0) {
+    level = layers.size() - 1;
+    for (size_t i = 0; i < layers.size(); ++i) {
+      if (std::max(planeRect.w, planeRect.h) / downscale(layers[i]) <= spec.maxDimension) {
+        level = i;
+        break;
+      }
+    }
+  } else if (spec.level >= layers.size()) {
+    spdlog::warn("CZI has no resolution level {}; using level {}", spec.level, level);
+  }
+
+  CziPyramidLevel result;
+  result.layer = layers[level];
+  result.downscale = downscale(result.layer);
+  return result;
+}
+
+// Scale layer 0 dimensions to those of a pyramid level.
+// The planes cover the same area at every level, each pixel covering more of it.
+void
+applyCziPyramidLevel(const CziPyramidLevel& level, const libCZI::IntRect& planeRect, VolumeDimensions& dims)
+{
+  if (level.layer == 0) {
+    return;
+  }
+  dims.sizeX = std::max(1u, (uint32_t)std::ceil(planeRect.w / level.downscale));
+  dims.sizeY = std::max(1u, (uint32_t)std::ceil(planeRect.h / level.downscale));
+  dims.physicalSizeX *= (float)level.downscale;
+  dims.physicalSizeY *= (float)level.downscale;
+}
+
+// Subblock indices of files read before, so that reading another timepoint of a file skips the directory pass.
+// An entry is rebuilt if its file has been modified since.
+std::shared_ptr<const CziSubBlockIndex>
+getCziSubBlockIndex(const std::string& filepath,
+                    const std::shared_ptr<libCZI::ICZIReader>& reader,
+                    const libCZI::SubBlockStatistics& statistics)
+{
+  static std::mutex sCacheMutex;
+  static std::map<std::string, std::pair<int64_t, std::shared_ptr<const CziSubBlockIndex>>> sCache;
+
+  int64_t modified = FileReader::fileModificationTime(filepath);
+  {
+    std::lock_guard<std::mutex> lock(sCacheMutex);
+    auto cached = sCache.find(filepath);
+    if (cached != sCache.end() && cached->second.first == modified) {
+      return cached->second.second;
+    }
+  }
+
+  auto tStart = std::chrono::high_resolution_clock::now();
+  std::shared_ptr<CziSubBlockIndex> index = std::make_shared<CziSubBlockIndex>();
+  index->build(reader, statistics);
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - tStart;
+  spdlog::debug("CZI subblock index built in {} ms", elapsed.count() * 1000.0);
+
+  std::lock_guard<std::mutex> lock(sCacheMutex);
+  sCache[filepath] = std::make_pair(modified, index);
+  return index;
+}
+
+// Where a subblock's pixels go in the part of a plane that is read, box, at a given downscale from full resolution.
+// planeRect is the plane's rectangle in layer 0 pixel coordinates; box is in the pixels of the level read.
+libCZI::IntRect
+placeCziSubBlock(const CziSubBlock& subblock,
+                 const libCZI::IntRect& planeRect,
+                 double downscale,
+                 const VoxelRegion& box)
+{
+  libCZI::IntRect placed;
+  placed.x = (int)std::floor((subblock.rect.x - planeRect.x) / downscale) - (int)box.minX;
+  placed.y = (int)std::floor((subblock.rect.y - planeRect.y) / downscale) - (int)box.minY;
+  placed.w = (int)subblock.size.w;
+  placed.h = (int)subblock.size.h;
+  return placed;
+}
+
+struct CziPlaneRead
+{
+  // in increasing M order; where mosaic tiles overlap, the tile with the higher M index, or the later one in the
+  // file if they have none, wins
+  std::vector<CziSubBlock> tiles;
+  // where the plane goes in the ImageXYZC buffer
+  size_t destOffset;
+  // the ImageXYZC channel it belongs to
+  uint32_t channel;
+};
+
+// Find the subblocks of every plane of the given channels at one timepoint and scene that hold pixels of box, in
+// subblock order.
+// Subblocks are numbered in the order of the file's subblock directory, which is the order they were written in, so
+// reading them in this order sweeps through the file instead of jumping back and forth whenever the file's dimension
+// order differs from our channel/slice order.
+std::vector<CziPlaneRead>
+planCziPlaneReads(const CziSubBlockIndex& index,
+                  const std::vector<uint32_t>& channels,
+                  const VoxelRegion& box,
+                  uint32_t bpp,
+                  const libCZI::IntRect& planeRect,
+                  const CziPyramidLevel& level,
+                  int32_t time,
+                  int32_t scene)
+{
+  const size_t planesize_bytes = (size_t)box.sizeX() * box.sizeY() * (bpp / 8);
+  std::vector<CziPlaneRead> planes;
+  for (uint32_t i = 0; i < channels.size(); ++i) {
+    for (uint32_t slice = box.minZ; slice < box.maxZ; ++slice) {
+      CziPlaneRead plane{ {}, planesize_bytes * (i * box.sizeZ() + (slice - box.minZ)), i };
+      const std::vector<CziSubBlock>* tiles = index.tiles({ (int)slice, (int)channels[i], time, scene, level.layer });
+      if (!tiles) {
+        continue;
+      }
+      for (const CziSubBlock& tile : *tiles) {
+        libCZI::IntRect placed = placeCziSubBlock(tile, planeRect, level.downscale, box);
+        if (placed.x < (int)box.sizeX() && placed.x + placed.w > 0 && placed.y < (int)box.sizeY() &&
+            placed.y + placed.h > 0) {
+          plane.tiles.push_back(tile);
+        }
+      }
+      if (!plane.tiles.empty()) {
+        planes.push_back(plane);
+      }
+    }
+  }
+
+  auto firstSubBlock = [](const CziPlaneRead& plane) {
+    int first = plane.tiles[0].index;
+    for (const CziSubBlock& tile : plane.tiles) {
+      first = std::min(first, tile.index);
+    }
+    return first;
+  };
+  std::sort(planes.begin(), planes.end(), [&](const CziPlaneRead& a, const CziPlaneRead& b) {
+    return firstSubBlock(a) < firstSubBlock(b);
+  });
+  return planes;
+}
+
+// time spent by one worker in each stage of reading planes
+struct CziWorkerTimes
+{
+  uint32_t subblocks = 0;
+  double read = 0.0;
+  double decode = 0.0;
+  double copy = 0.0;
+};
+
+// Read and decompress (JPEG-XR or otherwise) one subblock, and lock its pixels for reading
+std::unique_ptr<libCZI::ScopedBitmapLockerSP>
+decodeCziSubBlock(const std::shared_ptr<libCZI::ICZIReader>& reader, int subblockIndex, CziWorkerTimes& times)
+{
+  auto t0 = std::chrono::high_resolution_clock::now();
+  std::shared_ptr<libCZI::ISubBlock> subblock = reader->ReadSubBlock(subblockIndex);
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+  std::shared_ptr<libCZI::IBitmapData> bitmap = subblock->CreateBitmap();
+  std::unique_ptr<libCZI::ScopedBitmapLockerSP> locked(new libCZI::ScopedBitmapLockerSP(bitmap));
+
+  auto t2 = std::chrono::high_resolution_clock::now();
+  times.subblocks++;
+  times.read += std::chrono::duration<double>(t1 - t0).count();
+  times.decode += std::chrono::duration<double>(t2 - t1).count();
+  return locked;
+}
+
+// Copy the part of a decoded subblock that falls within rows [y0, y1) of the plane.
+// placed is where the subblock goes in the plane; it gets clipped to the plane.
+// DANGER: assumes dataPtr has enough space allocated!!!!
+void
+copyCziSubBlockRows(const libCZI::BitmapLockInfo& bitmap,
+                    const libCZI::IntRect& placed,
+                    const VolumeDimensions& volumeDims,
+                    int y0,
+                    int y1,
+                    uint8_t* dataPtr)
+{
+  const int x0 = std::max(placed.x, 0);
+  const int x1 = std::min(placed.x + placed.w, (int)volumeDims.sizeX);
+  y0 = std::max(y0, placed.y);
+  y1 = std::min(y1, placed.y + placed.h);
+  if (x0 >= x1) {
+    return;
+  }
+
+  if (volumeDims.bitsPerPixel != 8 && volumeDims.bitsPerPixel != 16 && volumeDims.bitsPerPixel != 32) {
+    return;
+  }
+  const size_t bytesPerPixel = volumeDims.bitsPerPixel / 8;
+  const size_t count = x1 - x0;
+  for (int y = y0; y < y1; ++y) {
+    const std::uint8_t* ptrLine = (const std::uint8_t*)bitmap.ptrDataRoi + (size_t)(y - placed.y) * bitmap.stride +
+                                  (x0 - placed.x) * bytesPerPixel;
+    uint8_t* destLine = dataPtr + ((size_t)y * volumeDims.sizeX + x0) * bytesPerPixel;
+    memcpy(destLine, ptrLine, count * bytesPerPixel);
+  }
+}
+
+// Read a plane made of one subblock. If counts is not null, the plane's pixels are counted into it right away.
 // DANGER: assumes dataPtr has enough space allocated!!!!
 bool
 readCziPlane(const std::shared_ptr<libCZI::ICZIReader>& reader,
+             const CziPlaneRead& plane,
              const libCZI::IntRect& planeRect,
-             const libCZI::CDimCoordinate& planeCoord,
+             double downscale,
+             const VoxelRegion& box,
              const VolumeDimensions& volumeDims,
-             uint8_t* dataPtr)
+             uint8_t* dataPtr,
+             HistogramAccumulator* counts,
+             CziWorkerTimes& times)
 {
-  reader->EnumSubset(&planeCoord, &planeRect, true, [&](int idx, const libCZI::SubBlockInfo& info) -> bool {
-    // accept first subblock
-    std::shared_ptr<libCZI::ISubBlock> subblock = reader->ReadSubBlock(idx);
-
-    std::shared_ptr<libCZI::IBitmapData> bitmap = subblock->CreateBitmap();
-    // and copy memory
-    libCZI::IntSize size = bitmap->GetSize();
-    {
-      libCZI::ScopedBitmapLockerSP lckScoped{ bitmap };
-      assert(lckScoped.ptrDataRoi == lckScoped.ptrData);
-      assert(volumeDims.sizeX == size.w);
-      assert(volumeDims.sizeY == size.h);
-      size_t bytesPerRow = size.w * 2; // destination stride
-      if (volumeDims.bitsPerPixel == 16) {
-        assert(lckScoped.stride >= size.w * 2);
-        // stridewise copying
-        for (std::uint32_t y = 0; y < size.h; ++y) {
-          const std::uint8_t* ptrLine = ((const std::uint8_t*)lckScoped.ptrDataRoi) + y * lckScoped.stride;
-          // uint16 is 2 bytes per pixel
-          memcpy(dataPtr + (bytesPerRow * y), ptrLine, bytesPerRow);
-        }
-      } else if (volumeDims.bitsPerPixel == 8) {
-        assert(lckScoped.stride >= size.w);
-        // stridewise copying
-        for (std::uint32_t y = 0; y < size.h; ++y) {
-          const std::uint8_t* ptrLine = ((const std::uint8_t*)lckScoped.ptrDataRoi) + y * lckScoped.stride;
-          uint16_t* destLine = reinterpret_cast<uint16_t*>(dataPtr + (bytesPerRow * y));
-          for (size_t x = 0; x < size.w; ++x) {
-            *destLine++ = *(ptrLine + x);
-          }
-        }
+  const CziSubBlock& subblock = plane.tiles[0];
+  std::unique_ptr<libCZI::ScopedBitmapLockerSP> bitmap = decodeCziSubBlock(reader, subblock.index, times);
+
+  auto tCopy = std::chrono::high_resolution_clock::now();
+  libCZI::IntRect placed = placeCziSubBlock(subblock, planeRect, downscale, box);
+  copyCziSubBlockRows(*bitmap, placed, volumeDims, 0, volumeDims.sizeY, dataPtr);
+  if (counts) {
+    counts->add(plane.channel, dataPtr, (size_t)volumeDims.sizeX * volumeDims.sizeY);
+  }
+  times.copy += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tCopy).count();
+  return true;
+}
+
+// Decoded tiles held at once while reading mosaic planes, in bytes: planes are read in batches of about this much.
+static const size_t CZI_MOSAIC_BATCH_BYTES = (size_t)256 << 20;
+
+// Read mosaic planes: decode the tiles of a batch of planes concurrently, then composite them into their planes.
+// Batching several planes into each parallelFor keeps the threads busy across plane boundaries without starting new
+// ones for every plane, while holding only a batch's worth of decoded tiles.
+// Compositing is split into bands of rows, each written by one worker only. Within a band tiles are drawn in
+// increasing M order, so where tiles overlap the result does not depend on thread timing.
+// If counts is not null, each band's pixels are counted into it once the band is complete.
+// DANGER: assumes dataPtr has enough space allocated for every plane!!!!
+bool
+readCziMosaicPlanes(const std::shared_ptr<libCZI::ICZIReader>& reader,
+                    const std::vector<CziPlaneRead>& planes,
+                    const libCZI::IntRect& planeRect,
+                    double downscale,
+                    const VoxelRegion& box,
+                    const VolumeDimensions& volumeDims,
+                    uint8_t* dataPtr,
+                    HistogramAccumulator* counts,
+                    uint32_t numThreads,
+                    std::vector<CziWorkerTimes>& times,
+                    LoadControl* control)
+{
+  const size_t pixelBytes = std::max(1u, volumeDims.bitsPerPixel / 8);
+  const size_t rowBytes = (size_t)volumeDims.sizeX * (readBpp(volumeDims) / 8);
+  for (size_t first = 0; first < planes.size();) {
+    // whole planes, until their tiles add up to the batch size
+    std::vector<std::pair<size_t, size_t>> tiles;
+    size_t last = first;
+    size_t bytes = 0;
+    while (last < planes.size() && (last == first || bytes < CZI_MOSAIC_BATCH_BYTES)) {
+      for (size_t i = 0; i < planes[last].tiles.size(); ++i) {
+        tiles.emplace_back(last, i);
+        bytes += (size_t)planes[last].tiles[i].size.w * planes[last].tiles[i].size.h * pixelBytes;
       }
+      ++last;
     }
 
-    // stop iterating, on the assumption that there is only one subblock that fits this planecoordinate
-    return false;
-  });
+    std::vector<std::vector<std::unique_ptr<libCZI::ScopedBitmapLockerSP>>> bitmaps(last - first);
+    for (size_t p = first; p < last; ++p) {
+      bitmaps[p - first].resize(planes[p].tiles.size());
+    }
+    parallelFor(tiles.size(), numThreads, [&](size_t i, uint32_t worker) {
+      if (control && control->isCancelled()) {
+        return;
+      }
+      const CziPlaneRead& plane = planes[tiles[i].first];
+      bitmaps[tiles[i].first - first][tiles[i].second] =
+        decodeCziSubBlock(reader, plane.tiles[tiles[i].second].index, times[worker]);
+      if (control) {
+        control->stepDone();
+      }
+    });
+    if (control && control->isCancelled()) {
+      return false;
+    }
 
+    // a few bands per thread evens out bands that happen to overlap more tiles than others
+    const uint32_t batchPlanes = (uint32_t)(last - first);
+    const uint32_t bands = std::max(1u, std::min(volumeDims.sizeY, (numThreads * 4 + batchPlanes - 1) / batchPlanes));
+    const uint32_t bandRows = (volumeDims.sizeY + bands - 1) / bands;
+    parallelFor((size_t)batchPlanes * bands, numThreads, [&](size_t item, uint32_t worker) {
+      auto tCopy = std::chrono::high_resolution_clock::now();
+      const size_t p = first + item / bands;
+      const CziPlaneRead& plane = planes[p];
+      uint8_t* dest = dataPtr + plane.destOffset;
+      int y0 = (int)((item % bands) * bandRows);
+      int y1 = std::min(y0 + (int)bandRows, (int)volumeDims.sizeY);
+      for (size_t i = 0; i < plane.tiles.size(); ++i) {
+        libCZI::IntRect placed = placeCziSubBlock(plane.tiles[i], planeRect, downscale, box);
+        copyCziSubBlockRows(*bitmaps[p - first][i], placed, volumeDims, y0, y1, dest);
+      }
+      if (counts && y0 < y1) {
+        counts->add(plane.channel, dest + y0 * rowBytes, (size_t)(y1 - y0) * volumeDims.sizeX);
+      }
+      times[worker].copy += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tCopy).count();
+    });
+    first = last;
+  }
   return true;
 }
 
@@ -240,7 +534,7 @@ FileReaderCzi::loadDimensionsCzi(const std::string& filepath, int32_t scene)
 
     auto statistics = cziReader->GetStatistics();
 
-    bool dims_ok = readCziDimensions(cziReader, filepath, statistics, dims);
+    bool dims_ok = readCziDimensions(cziReader, filepath, statistics, dims, scene);
     if (!dims_ok) {
       return VolumeDimensions();
     }
@@ -259,8 +553,17 @@ FileReaderCzi::loadDimensionsCzi(const std::string& filepath, int32_t scene)
 
 std::shared_ptr<ImageXYZC>
 FileReaderCzi::loadCzi(const std::string& filepath, VolumeDimensions* outDims, int32_t time, int32_t scene)
+{
+  return loadCzi(LoadSpec(filepath, time, scene), outDims);
+}
+
+std::shared_ptr<ImageXYZC>
+FileReaderCzi::loadCzi(const LoadSpec& spec, VolumeDimensions* outDims, LoadControl* control)
 {
   std::shared_ptr<ImageXYZC> emptyimage;
+  const std::string& filepath = spec.filepath;
+  int32_t time = spec.time;
+  int32_t scene = spec.scene;
 
   auto tStart = std::chrono::high_resolution_clock::now();
 
@@ -271,7 +574,7 @@ FileReaderCzi::loadCzi(const std::string& filepath, VolumeDimensions* outDims, i
     auto statistics = cziReader->GetStatistics();
 
     VolumeDimensions dims;
-    bool dims_ok = readCziDimensions(cziReader, filepath, statistics, dims);
+    bool dims_ok = readCziDimensions(cziReader, filepath, statistics, dims, scene);
     if (!dims_ok) {
       return emptyimage;
     }
@@ -293,57 +596,203 @@ FileReaderCzi::loadCzi(const std::string& filepath, VolumeDimensions* outDims, i
       return emptyimage;
     }
 
-    size_t planesize = dims.sizeX * dims.sizeY * dims.bitsPerPixel / 8;
-    uint8_t* data = new uint8_t[planesize * dims.sizeZ * dims.sizeC];
-    memset(data, 0, planesize * dims.sizeZ * dims.sizeC);
+    // choose the resolution level before sizing anything
+    std::shared_ptr<const CziSubBlockIndex> index = getCziSubBlockIndex(filepath, cziReader, statistics);
+    libCZI::IntRect planeRect = getScenePlaneRect(statistics, scene);
+    CziPyramidLevel level = chooseCziPyramidLevel(*index, spec, planeRect);
+    applyCziPyramidLevel(level, planeRect, dims);
+    if (level.layer > 0) {
+      spdlog::debug("Reading CZI pyramid layer {} ({}x{})", level.layer, dims.sizeX, dims.sizeY);
+    }
+
+    if (!spec.region.isValid()) {
+      spdlog::error("The requested region of {} is empty; leave it at its default to read the whole volume", filepath);
+      return emptyimage;
+    }
+    // the part of the level to read, and the dimensions of the image returned
+    VoxelRegion box = spec.region.clampedTo(dims.sizeX, dims.sizeY, dims.sizeZ);
+    if (box.isEmpty()) {
+      spdlog::error("The requested region lies outside of {}", filepath);
+      return emptyimage;
+    }
+    std::vector<uint32_t> channels = spec.channelsToRead(dims.sizeC);
+    if (channels.empty()) {
+      spdlog::error("Channels requested are out of range for {} with {} channels", filepath, dims.sizeC);
+      return emptyimage;
+    }
+    VolumeDimensions readDims = dims;
+    readDims.sizeX = box.sizeX();
+    readDims.sizeY = box.sizeY();
+    readDims.sizeZ = box.sizeZ();
+    readDims.sizeC = (uint32_t)channels.size();
+    readDims.channelNames.clear();
+    for (uint32_t channel : channels) {
+      readDims.channelNames.push_back(channel < dims.channelNames.size() ? dims.channelNames[channel] : "");
+    }
+
+    // planes end up as 8 or 16 bit in memory whatever their bit depth in the file
+    const uint32_t bpp = readBpp(dims);
+    size_t planesize = (size_t)readDims.sizeX * readDims.sizeY * bpp / 8;
+    uint8_t* data = new uint8_t[planesize * readDims.sizeZ * readDims.sizeC];
+    // planes missing from the file stay blank
+    memset(data, 0, planesize * readDims.sizeZ * readDims.sizeC);
 
     // stash it here in case of early exit, it will be deleted
     std::unique_ptr<uint8_t[]> smartPtr(data);
 
-    uint8_t* destptr = data;
-
-    // now ready to read channels one by one.
+    // only the subblocks of the channels read that overlap the region are read and decoded
+    std::vector<CziPlaneRead> planes = planCziPlaneReads(*index, channels, box, bpp, planeRect, level, time, scene);
+    if (box.sizeX() == dims.sizeX && box.sizeY() == dims.sizeY && planes.size() < readDims.sizeZ * readDims.sizeC) {
+      spdlog::warn(
+        "CZI file has only {} of {} planes for time {}", planes.size(), readDims.sizeZ * readDims.sizeC, time);
+    }
 
-    for (uint32_t channel = 0; channel < dims.sizeC; ++channel) {
-      for (uint32_t slice = 0; slice < dims.sizeZ; ++slice) {
-        destptr = data + planesize * (channel * dims.sizeZ + slice);
+    // the channel histograms are gathered while the planes are read, not in another pass afterwards.
+    // Float pixels are counted only once converted, by ImageXYZC.
+    std::unique_ptr<HistogramAccumulator> counts;
+    if (bpp <= 16) {
+      counts.reset(new HistogramAccumulator(readDims.sizeC, bpp));
+      // planes missing from the file count as blank
+      std::vector<uint32_t> planesRead(readDims.sizeC, 0);
+      for (const CziPlaneRead& plane : planes) {
+        planesRead[plane.channel]++;
+      }
+      for (uint32_t c = 0; c < readDims.sizeC; ++c) {
+        counts->addZeros(c, (size_t)(readDims.sizeZ - planesRead[c]) * readDims.sizeX * readDims.sizeY);
+      }
+    }
 
-        // adjust coordinates by offsets from dims
-        libCZI::CDimCoordinate planeCoord{ { libCZI::DimensionIndex::Z, (int)slice + startZ } };
-        if (hasC) {
-          planeCoord.Set(libCZI::DimensionIndex::C, (int)channel + startC);
+    uint32_t nthreads = FileReader::loaderThreadCount();
+    std::vector<CziWorkerTimes> times(nthreads);
+    if (index->maxTilesPerPlane() > 1) {
+      // tiles of a batch of planes at a time get spread across threads
+      spdlog::debug("CZI mosaic of up to {} tiles per plane", index->maxTilesPerPlane());
+      if (control) {
+        size_t tiles = 0;
+        for (const CziPlaneRead& plane : planes) {
+          tiles += plane.tiles.size();
         }
-        if (hasS) {
-          planeCoord.Set(libCZI::DimensionIndex::S, scene + startS);
+        control->setTotal((uint32_t)tiles);
+      }
+      if (!readCziMosaicPlanes(cziReader,
+                               planes,
+                               planeRect,
+                               level.downscale,
+                               box,
+                               readDims,
+                               data,
+                               counts.get(),
+                               nthreads,
+                               times,
+                               control)) {
+        if (control && control->isCancelled()) {
+          spdlog::info("Loading {} cancelled", filepath);
         }
-        if (hasT) {
-          planeCoord.Set(libCZI::DimensionIndex::T, time + startT);
+        return emptyimage;
+      }
+    } else {
+      // Spread the planes across threads, handed out in file order.
+      // The reader serializes the file reads of ReadSubBlock internally; decoding (JPEG-XR in particular, which
+      // dominates load time of compressed files) and copying then run concurrently, each plane going straight to its
+      // own place in the image.
+      nthreads = parallelThreadCount(planes.size(), nthreads);
+      std::atomic<bool> failed(false);
+      if (control) {
+        control->setTotal((uint32_t)planes.size());
+      }
+      parallelFor(planes.size(), nthreads, [&](size_t i, uint32_t worker) {
+        if (failed || (control && control->isCancelled())) {
+          return;
         }
-
-        if (!readCziPlane(cziReader, statistics.boundingBoxLayer0Only, planeCoord, dims, destptr)) {
-          return emptyimage;
+        uint8_t* dest = data + planes[i].destOffset;
+        if (!readCziPlane(
+              cziReader, planes[i], planeRect, level.downscale, box, readDims, dest, counts.get(), times[worker])) {
+          failed = true;
+        }
+        if (control) {
+          control->stepDone();
         }
+      });
+      if (control && control->isCancelled()) {
+        spdlog::info("Loading {} cancelled", filepath);
+        return emptyimage;
+      }
+      if (failed) {
+        return emptyimage;
       }
     }
 
     auto tEnd = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> elapsed = tEnd - tStart;
-    spdlog::debug("CZI loaded in {} ms", elapsed.count() * 1000.0);
+    spdlog::debug("CZI loaded in {} ms using {} threads", elapsed.count() * 1000.0, nthreads);
+    for (uint32_t t = 0; t < nthreads; ++t) {
+      spdlog::debug("  thread {}: {} subblocks, read {} ms, decode {} ms, copy {} ms",
+                    t,
+                    times[t].subblocks,
+                    times[t].read * 1000.0,
+                    times[t].decode * 1000.0,
+                    times[t].copy * 1000.0);
+    }
 
     auto tStartImage = std::chrono::high_resolution_clock::now();
 
-    // TODO: convert data to uint16_t pixels if not already.
+    if (bpp == 32) {
+      // Scale float pixels to 16 bits: from the spec's range if it has one, which holds for every load of the file, or
+      // else each channel from the range of its own values. The value mappings record which.
+      const size_t channelVoxels = (size_t)readDims.sizeX * readDims.sizeY * readDims.sizeZ;
+      uint8_t* converted = new uint8_t[channelVoxels * readDims.sizeC * 2];
+      readDims.valueOffsets.assign(readDims.sizeC, 0.0);
+      readDims.valueScales.assign(readDims.sizeC, 0.0);
+      for (uint32_t c = 0; c < readDims.sizeC; ++c) {
+        const float* src = reinterpret_cast<const float*>(data) + c * channelVoxels;
+        uint16_t* dst = reinterpret_cast<uint16_t*>(converted) + c * channelVoxels;
+        float min = (float)spec.valueMin, max = (float)spec.valueMax;
+        if (spec.hasValueRange()) {
+          convertFloat32To16(src, dst, channelVoxels, FileReader::loaderThreadCount(), min, max);
+        } else {
+          normalizeFloat32To16(src, dst, channelVoxels, FileReader::loaderThreadCount(), min, max);
+          spdlog::info("Channel {} float values from {} to {} scaled to 16 bits", c, min, max);
+        }
+        if (min < max) {
+          readDims.valueOffsets[c] = min;
+          readDims.valueScales[c] = ((double)max - min) / 65535.0;
+        }
+      }
+      smartPtr.reset(converted);
+      readDims.bitsPerPixel = 16;
+    }
+
+    // TODO: convert data of other pixel types to uint16_t pixels.
     // we can release the smartPtr because ImageXYZC will now own the raw data memory
-    ImageXYZC* im = new ImageXYZC(dims.sizeX,
-                                  dims.sizeY,
-                                  dims.sizeZ,
-                                  dims.sizeC,
-                                  IN_MEMORY_BPP, // dims.bitsPerPixel,
-                                  smartPtr.release(),
-                                  dims.physicalSizeX,
-                                  dims.physicalSizeY,
-                                  dims.physicalSizeZ);
-    im->setChannelNames(dims.channelNames);
+    ImageXYZC* im = nullptr;
+    if (counts) {
+      im = new ImageXYZC(readDims.sizeX,
+                         readDims.sizeY,
+                         readDims.sizeZ,
+                         readDims.sizeC,
+                         bpp,
+                         smartPtr.release(),
+                         readDims.physicalSizeX,
+                         readDims.physicalSizeY,
+                         readDims.physicalSizeZ,
+                         nullptr,
+                         counts->histograms(),
+                         {});
+    } else {
+      im = new ImageXYZC(readDims.sizeX,
+                         readDims.sizeY,
+                         readDims.sizeZ,
+                         readDims.sizeC,
+                         16,
+                         smartPtr.release(),
+                         readDims.physicalSizeX,
+                         readDims.physicalSizeY,
+                         readDims.physicalSizeZ);
+    }
+    im->setPhysicalOffset(
+      box.minX * readDims.physicalSizeX, box.minY * readDims.physicalSizeY, box.minZ * readDims.physicalSizeZ);
+    im->setChannelNames(readDims.channelNames);
+    im->setValueMappings(readDims.valueOffsets, readDims.valueScales);
 
     tEnd = std::chrono::high_resolution_clock::now();
     elapsed = tEnd - tStartImage;
@@ -354,7 +803,7 @@ FileReaderCzi::loadCzi(const std::string& filepath, VolumeDimensions* outDims, i
 
     std::shared_ptr<ImageXYZC> sharedImage(im);
     if (outDims != nullptr) {
-      *outDims = dims;
+      *outDims = readDims;
     }
     return sharedImage;
 
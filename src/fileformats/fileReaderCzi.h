@@ -1,6 +1,7 @@
 #pragma once
 
 #include "graphics/volumeDimensions.h"
+#include "loadSpec.h"
 
 #include <map>
 #include <memory>
@@ -9,6 +10,7 @@
 
 class CBoundingBox;
 class ImageXYZC;
+class LoadControl;
 
 class FileReaderCzi
 {
@@ -20,5 +22,8 @@ public:
                                             VolumeDimensions* dims = nullptr,
                                             int32_t time = 0,
                                             int32_t scene = 0);
+  static std::shared_ptr<ImageXYZC> loadCzi(const LoadSpec& spec,
+                                            VolumeDimensions* dims = nullptr,
+                                            LoadControl* control = nullptr);
   static VolumeDimensions loadDimensionsCzi(const std::string& filepath, int32_t scene = 0);
 };
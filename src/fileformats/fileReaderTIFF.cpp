@@ -1,8 +1,14 @@
 #include "fileReaderTIFF.h"
 
+#include "fileReader.h"
+#include "loadControl.h"
 #include "graphics/boundingBox.h"
+#include "graphics/histogramAccumulator.h"
 #include "graphics/imageXYZC.h"
+#include "graphics/parallel.h"
+#include "graphics/pixelConversion.h"
 #include "graphics/volumeDimensions.h"
+#include "memoryMappedFile.h"
 
 #include "pugixml.hpp"
 #include "spdlog/spdlog.h"
@@ -10,9 +16,15 @@
 #include <tiff.h>
 #include <tiffio.h>
 
+#include <atomic>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <limits>
 #include <map>
+#include <mutex>
 #include <set>
+#include <unordered_set>
 
 bool
 startsWith(std::string const& mainStr, std::string const& toMatch)
@@ -45,21 +57,149 @@ split(const std::string& str, Container& cont, char delim = ' ')
   }
 }
 
-static const uint32_t IN_MEMORY_BPP = 16;
-
 FileReaderTIFF::FileReaderTIFF() {}
 
 FileReaderTIFF::~FileReaderTIFF() {}
 
+// File offsets of every IFD in a tiff, in chain order.
+// TIFFSetDirectory(n) walks the IFD chain from the start of the file every time it is called,
+// which makes reading all planes of a long time series quadratic in the number of IFDs.
+// Instead we walk the chain exactly once, reading only each directory's entry count and next-IFD
+// pointer, and later jump straight to a plane's directory with TIFFSetSubDirectory.
+class TiffDirectoryIndex
+{
+public:
+  bool build(TIFF* tiff)
+  {
+    m_offsets.clear();
+
+    thandle_t handle = TIFFClientdata(tiff);
+    TIFFReadWriteProc readProc = TIFFGetReadProc(tiff);
+    TIFFSeekProc seekProc = TIFFGetSeekProc(tiff);
+    bool swap = TIFFIsByteSwapped(tiff) != 0;
+    uint64_t fileSize = TIFFGetSizeProc(tiff)(handle);
+
+    auto readAt = [&](uint64_t offset, void* buf, tmsize_t size) -> bool {
+      if (offset + size > fileSize || seekProc(handle, offset, SEEK_SET) != offset) {
+        return false;
+      }
+      return readProc(handle, buf, size) == size;
+    };
+
+    // classic tiff header: byte order(2), version 42(2), first IFD offset(4)
+    // BigTIFF header: byte order(2), version 43(2), offset size(2), reserved(2), first IFD offset(8)
+    uint8_t header[16];
+    if (!readAt(0, header, 8)) {
+      return false;
+    }
+    uint16_t version;
+    memcpy(&version, header + 2, sizeof(version));
+    if (swap) {
+      TIFFSwabShort(&version);
+    }
+    bool bigTiff = (version == 43);
+
+    uint64_t offset = 0;
+    if (bigTiff) {
+      if (!readAt(8, &offset, sizeof(offset))) {
+        return false;
+      }
+      if (swap) {
+        TIFFSwabLong8(&offset);
+      }
+    } else {
+      uint32_t offset32;
+      memcpy(&offset32, header + 4, sizeof(offset32));
+      if (swap) {
+        TIFFSwabLong(&offset32);
+      }
+      offset = offset32;
+    }
+
+    // entry count and next pointer widths, and the size of one directory entry
+    const uint64_t countSize = bigTiff ? 8 : 2;
+    const uint64_t entrySize = bigTiff ? 20 : 12;
+
+    std::unordered_set<uint64_t> visited;
+    while (offset != 0) {
+      if (!visited.insert(offset).second) {
+        spdlog::warn("TIFF IFD chain loops back to offset {}; ignoring remaining directories", offset);
+        break;
+      }
+
+      uint64_t entryCount = 0;
+      if (bigTiff) {
+        if (!readAt(offset, &entryCount, 8)) {
+          break;
+        }
+        if (swap) {
+          TIFFSwabLong8(&entryCount);
+        }
+      } else {
+        uint16_t entryCount16;
+        if (!readAt(offset, &entryCount16, 2)) {
+          break;
+        }
+        if (swap) {
+          TIFFSwabShort(&entryCount16);
+        }
+        entryCount = entryCount16;
+      }
+      m_offsets.push_back(offset);
+
+      uint64_t nextPtr = offset + countSize + entryCount * entrySize;
+      if (bigTiff) {
+        if (!readAt(nextPtr, &offset, 8)) {
+          break;
+        }
+        if (swap) {
+          TIFFSwabLong8(&offset);
+        }
+      } else {
+        uint32_t offset32;
+        if (!readAt(nextPtr, &offset32, 4)) {
+          break;
+        }
+        if (swap) {
+          TIFFSwabLong(&offset32);
+        }
+        offset = offset32;
+      }
+    }
+
+    return !m_offsets.empty();
+  }
+
+  uint32_t size() const { return (uint32_t)m_offsets.size(); }
+
+  // file offset of the IFD of planeIndex
+  uint64_t offset(uint32_t planeIndex) const { return m_offsets[planeIndex]; }
+
+  // position tiff at the IFD of planeIndex
+  bool setDirectory(TIFF* tiff, uint32_t planeIndex) const
+  {
+    if (planeIndex >= m_offsets.size()) {
+      return false;
+    }
+    return TIFFSetSubDirectory(tiff, m_offsets[planeIndex]) != 0;
+  }
+
+private:
+  std::vector<uint64_t> m_offsets;
+};
+
 class ScopedTiffReader
 {
 public:
-  ScopedTiffReader(const std::string& filepath)
+  // additional readers of a file that is already open elsewhere can skip building their own directory index
+  ScopedTiffReader(const std::string& filepath, bool indexDirectories = true)
   {
     // Loads tiff file
     m_tiff = TIFFOpen(filepath.c_str(), "r");
     if (!m_tiff) {
       spdlog::error("Failed to open TIFF: '{}'", filepath);
+    } else if (indexDirectories && !m_directories.build(m_tiff)) {
+      spdlog::error("Failed to read IFD chain of TIFF: '{}'", filepath);
     }
   }
   ~ScopedTiffReader()
@@ -69,13 +209,20 @@ public:
     }
   }
   TIFF* reader() { return m_tiff; }
+  const TiffDirectoryIndex& directories() const { return m_directories; }
 
 protected:
   TIFF* m_tiff;
+  TiffDirectoryIndex m_directories;
 };
 
+// sampleFormat, if given, receives the TIFF SAMPLEFORMAT of the pixels: unsigned integer or (32-bit only) float.
 bool
-readTiffDimensions(TIFF* tiff, const std::string filepath, VolumeDimensions& dims)
+readTiffDimensions(TIFF* tiff,
+                   const TiffDirectoryIndex& directories,
+                   const std::string filepath,
+                   VolumeDimensions& dims,
+                   uint16_t* sampleFormatOut = nullptr)
 {
   char* imagedescriptionptr = nullptr;
   // metadata is in ImageDescription of first IFD in the file.
@@ -106,8 +253,9 @@ readTiffDimensions(TIFF* tiff, const std::string filepath, VolumeDimensions& dim
   }
 
   uint16_t sampleFormat = SAMPLEFORMAT_UINT;
-  if (TIFFGetField(tiff, TIFFTAG_SAMPLEFORMAT, &sampleFormat) != 1) {
-    // just warn here.  We are not yet using sampleFormat!
+  const bool hasSampleFormat = TIFFGetField(tiff, TIFFTAG_SAMPLEFORMAT, &sampleFormat) == 1;
+  if (!hasSampleFormat) {
+    // just warn here; unsigned integer pixels are the TIFF default.
     spdlog::warn("Failed to read sampleformat of TIFF: '{}'", filepath);
   }
 
@@ -241,9 +389,8 @@ readTiffDimensions(TIFF* tiff, const std::string filepath, VolumeDimensions& dim
       pixelType.begin(), pixelType.end(), pixelType.begin(), [](unsigned char c) { return std::tolower(c); });
     spdlog::info("pixel type: {}", pixelType);
     bpp = mapPixelTypeBPP[pixelType];
-    if (bpp != 16 && bpp != 8) {
-      spdlog::error("Image must be 8 or 16-bit integer typed");
-      return false;
+    if (!hasSampleFormat && pixelType == "float") {
+      sampleFormat = SAMPLEFORMAT_IEEEFP;
     }
     sizeX = pixelsEl.attribute("SizeX").as_int(0);
     sizeY = pixelsEl.attribute("SizeY").as_int(0);
@@ -275,18 +422,25 @@ readTiffDimensions(TIFF* tiff, const std::string filepath, VolumeDimensions& dim
     }
   } else {
     // unrecognized string / no metadata.
-    // walk the file and count the directories and assume that is Z
-    // sizeZ was initialized to 1.
-    sizeZ = 0;
-    while (TIFFSetDirectory(tiff, sizeZ)) {
-      sizeZ++;
-    };
+    // count the directories and assume that is Z
+    sizeZ = directories.size();
     channelNames.push_back("0");
   }
 
   assert(sizeX == width);
   assert(sizeY == height);
 
+  // 32-bit pixels are converted to 16 bits when loaded
+  const bool supported = bpp == 8 || bpp == 16 ||
+                         (bpp == 32 && (sampleFormat == SAMPLEFORMAT_UINT || sampleFormat == SAMPLEFORMAT_IEEEFP));
+  if (!supported) {
+    spdlog::error("Image must be 8 or 16-bit integer, 32-bit unsigned integer or float typed: '{}'", filepath);
+    return false;
+  }
+  if (sampleFormatOut) {
+    *sampleFormatOut = sampleFormat;
+  }
+
   // allocate the destination buffer!!!!
   assert(sizeT >= 1);
   assert(sizeC >= 1);
@@ -311,107 +465,706 @@ readTiffDimensions(TIFF* tiff, const std::string filepath, VolumeDimensions& dim
   return dims.validate();
 }
 
+// Geometry of the strips or tiles ("striles") of the current directory.
+// A strip is handled as a tile that is as wide as the image.
+struct TiffStrileLayout
+{
+  bool tiled = false;
+  // size in pixels of one strile
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // striles per row of striles
+  uint32_t across = 1;
+  uint32_t count = 0;
+  // pixels are decoded and kept in memory at the file's pixel size
+  size_t bytesPerPixel = 2;
+
+  bool read(TIFF* tiff, const VolumeDimensions& dims)
+  {
+    tiled = TIFFIsTiled(tiff) != 0;
+    bytesPerPixel = dims.bitsPerPixel / 8;
+    if (tiled) {
+      if (TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &width) != 1 || TIFFGetField(tiff, TIFFTAG_TILELENGTH, &height) != 1 ||
+          width == 0 || height == 0) {
+        spdlog::error("Failed to read tile size of tiff");
+        return false;
+      }
+      across = (dims.sizeX + width - 1) / width;
+      count = TIFFNumberOfTiles(tiff);
+    } else {
+      width = dims.sizeX;
+      height = dims.sizeY;
+      TIFFGetFieldDefaulted(tiff, TIFFTAG_ROWSPERSTRIP, &height);
+      height = std::max(1u, std::min(height, dims.sizeY));
+      across = 1;
+      count = TIFFNumberOfStrips(tiff);
+    }
+    // every pixel of the plane must be covered, since the destination is not cleared beforehand
+    uint32_t down = (dims.sizeY + height - 1) / height;
+    if (count < across * down) {
+      spdlog::error("Tiff has {} {}s, expected {}", count, tiled ? "tile" : "strip", across * down);
+      return false;
+    }
+    return true;
+  }
+
+  // pixel rectangle covered by strile i, clipped to the image.
+  // returns false if the strile lies entirely outside of the image.
+  bool rect(uint32_t i, const VolumeDimensions& dims, uint32_t& x, uint32_t& y, uint32_t& w, uint32_t& h) const
+  {
+    x = (i % across) * width;
+    y = (i / across) * height;
+    if (x >= dims.sizeX || y >= dims.sizeY) {
+      return false;
+    }
+    w = std::min(width, dims.sizeX - x);
+    h = std::min(height, dims.sizeY - y);
+    return true;
+  }
+
+  // number of bytes libtiff decodes for a strile that covers h rows of the image.
+  // tiles always decode to a full tile, the last strip only to its remaining rows.
+  tmsize_t decodedSize(TIFF* tiff, uint32_t h) const { return tiled ? TIFFTileSize(tiff) : TIFFVStripSize(tiff, h); }
+
+  // whether the strile at (x, y) of size w x h holds any of the pixels of box
+  static bool overlaps(uint32_t x, uint32_t y, uint32_t w, uint32_t h, const VoxelRegion& box)
+  {
+    return x < box.maxX && x + w > box.minX && y < box.maxY && y + h > box.minY;
+  }
+
+  // the striles that hold pixels of box
+  std::vector<uint32_t> overlapping(const VolumeDimensions& dims, const VoxelRegion& box) const
+  {
+    std::vector<uint32_t> striles;
+    for (uint32_t strile = 0; strile < count; ++strile) {
+      uint32_t x, y, w, h;
+      if (rect(strile, dims, x, y, w, h) && overlaps(x, y, w, h, box)) {
+        striles.push_back(strile);
+      }
+    }
+    return striles;
+  }
+
+  // Strips that lie wholly inside a box as wide as the image are contiguous rows of the destination plane and can be
+  // decoded straight into it, with no scratch buffer and no copy.
+  bool decodesInPlace(const VolumeDimensions& dims, const VoxelRegion& box, uint32_t y, uint32_t h) const
+  {
+    return !tiled && box.minX == 0 && box.maxX == dims.sizeX && y >= box.minY && y + h <= box.maxY;
+  }
+
+  // byte offset of pixel (x, y) of the image in the destination plane, which holds the pixels of box
+  size_t destOffset(uint32_t x, uint32_t y, const VoxelRegion& box) const
+  {
+    return ((size_t)(y - box.minY) * box.sizeX() + (x - box.minX)) * bytesPerPixel;
+  }
+};
+
+// Copy the part inside box of the w x h top left pixels of a decoded strile (rows of srcWidth pixels), which sits at
+// (x, y) of the image, to the destination plane of box's pixels.
+void
+copyStrileToPlane(const uint8_t* src,
+                  uint32_t srcWidth,
+                  uint32_t x,
+                  uint32_t y,
+                  uint32_t w,
+                  uint32_t h,
+                  const VolumeDimensions& dims,
+                  const VoxelRegion& box,
+                  uint8_t* dataPtr)
+{
+  const uint32_t x0 = std::max(x, box.minX), x1 = std::min(x + w, box.maxX);
+  const uint32_t y0 = std::max(y, box.minY), y1 = std::min(y + h, box.maxY);
+  if (x0 >= x1 || y0 >= y1) {
+    return;
+  }
+  const size_t bytesPerPixel = dims.bitsPerPixel / 8;
+  const size_t srcRowBytes = srcWidth * bytesPerPixel;
+  const size_t destRowBytes = box.sizeX() * bytesPerPixel;
+  const size_t count = x1 - x0;
+  src += (size_t)(y0 - y) * srcRowBytes + (x0 - x) * bytesPerPixel;
+  uint8_t* dest = dataPtr + (size_t)(y0 - box.minY) * destRowBytes + (x0 - box.minX) * bytesPerPixel;
+  for (uint32_t row = y0; row < y1; ++row) {
+    memcpy(dest, src, count * bytesPerPixel);
+    src += srcRowBytes;
+    dest += destRowBytes;
+  }
+}
+
+// Decodes the strips or tiles of a plane that hold the pixels of box, and stores those pixels in dataPtr.
+// scratch is reused from call to call to hold decoded strips or tiles that need converting or clipping.
 // DANGER: assumes dataPtr has enough space allocated!!!!
 bool
-readTiffPlane(TIFF* tiff, int planeIndex, const VolumeDimensions& dims, uint8_t* dataPtr)
+readTiffPlane(TIFF* tiff,
+              const TiffDirectoryIndex& directories,
+              uint32_t planeIndex,
+              const VolumeDimensions& dims,
+              const VoxelRegion& box,
+              uint8_t* dataPtr,
+              std::vector<uint8_t>& scratch)
 {
-  int setdirok = TIFFSetDirectory(tiff, planeIndex);
-  if (setdirok == 0) {
+  if (!directories.setDirectory(tiff, planeIndex)) {
     spdlog::error("Bad tiff directory specified: {}", planeIndex);
     return false;
   }
+  if (dims.bitsPerPixel != 8 && dims.bitsPerPixel != 16 && dims.bitsPerPixel != 32) {
+    spdlog::error("Unexpected tiff pixel size {} bits", dims.bitsPerPixel);
+    return false;
+  }
 
-  int numBytesRead = 0;
-  // TODO future optimize:
-  // This function is usually called in a loop. We could factor out the TIFFmalloc and TIFFfree calls.
-  // Should profile to see if the repeated malloc/frees are any kind of loading bottleneck.
-  if (TIFFIsTiled(tiff)) {
-    tsize_t tilesize = TIFFTileSize(tiff);
-    uint32 ntiles = TIFFNumberOfTiles(tiff);
-    if (ntiles != 1) {
-      spdlog::error("Reader doesn't support more than 1 tile per plane");
+  TiffStrileLayout layout;
+  if (!layout.read(tiff, dims)) {
+    return false;
+  }
+
+  for (uint32_t strile = 0; strile < layout.count; ++strile) {
+    uint32_t x, y, w, h;
+    if (!layout.rect(strile, dims, x, y, w, h) || !TiffStrileLayout::overlaps(x, y, w, h, box)) {
+      continue;
+    }
+    tmsize_t size = layout.decodedSize(tiff, h);
+    const bool inPlace = layout.decodesInPlace(dims, box, y, h);
+    if (!inPlace) {
+      scratch.resize(layout.decodedSize(tiff, layout.height));
+    }
+    uint8_t* buf = inPlace ? dataPtr + layout.destOffset(x, y, box) : scratch.data();
+    tmsize_t numBytesRead =
+      layout.tiled ? TIFFReadEncodedTile(tiff, strile, buf, size) : TIFFReadEncodedStrip(tiff, strile, buf, size);
+    if (numBytesRead < 0) {
+      spdlog::error("Error reading tiff {} {}", layout.tiled ? "tile" : "strip", strile);
       return false;
     }
-    // assuming ntiles == 1 for all IFDs
-    tdata_t buf = _TIFFmalloc(tilesize);
+    if (!inPlace) {
+      copyStrileToPlane(buf, layout.width, x, y, w, h, dims, box, dataPtr);
+    }
+  }
 
-    uint32_t i = planeIndex;
+  return true;
+}
 
-    numBytesRead = TIFFReadEncodedTile(tiff, 0, buf, tilesize);
-    if (numBytesRead < 0) {
-      spdlog::error("Error reading tiff tile");
-      _TIFFfree(buf);
-      return false;
+// Per-worker decoding state for one file.
+// A TIFF* can only be used by one thread at a time, so each worker lazily opens its own handle
+// (sharing the directory index of the primary reader) and keeps its own scratch buffers.
+class TiffWorkers
+{
+public:
+  struct Worker
+  {
+    std::unique_ptr<ScopedTiffReader> reader;
+    TIFF* tiff = nullptr;
+    // directory the handle was last positioned on by readTiffPlaneConcurrent
+    uint32_t planeIndex = std::numeric_limits<uint32_t>::max();
+    // scratch buffers, reused for every strip or tile this worker reads
+    std::vector<uint8_t> raw;
+    std::vector<uint8_t> decoded;
+
+    size_t bytes = 0;
+    double seconds = 0.0;
+  };
+
+  // if primary is not null, worker 0 uses it instead of opening its own handle.
+  TiffWorkers(const std::string& filepath, uint32_t count, TIFF* primary = nullptr)
+    : m_filepath(filepath)
+    , m_workers(count)
+  {
+    m_workers[0].tiff = primary;
+  }
+
+  // returns nullptr if the file could not be opened for this worker
+  Worker* get(uint32_t worker)
+  {
+    Worker& w = m_workers[worker];
+    if (!w.tiff) {
+      if (w.reader) {
+        // already failed to open
+        return nullptr;
+      }
+      w.reader.reset(new ScopedTiffReader(m_filepath, false));
+      w.tiff = w.reader->reader();
+      if (!w.tiff) {
+        return nullptr;
+      }
     }
-    // copy buf into data.
-    if (IN_MEMORY_BPP == dims.bitsPerPixel) {
-      memcpy(dataPtr, buf, numBytesRead);
-    } else {
-      // convert pixels
-      if (dims.bitsPerPixel != 8) {
-        spdlog::error("Unexpected tiff pixel size {} bits", dims.bitsPerPixel);
-        _TIFFfree(buf);
-        return false;
+    return &w;
+  }
+
+  uint32_t size() const { return (uint32_t)m_workers.size(); }
+  const Worker& operator[](uint32_t worker) const { return m_workers[worker]; }
+
+private:
+  std::string m_filepath;
+  std::vector<Worker> m_workers;
+};
+
+// Read the part of one plane inside box with its strips or tiles spread across threads, for files with a few very
+// large planes. The compressed bytes of each strile are read serially through ioTiff, then every worker
+// decompresses its striles concurrently through its own handle with TIFFReadFromUserBuffer,
+// which also undoes any predictor and byte swapping, and copies the result to the strile's
+// position in the plane, clipping tiles at the right and bottom edges.
+// If counts is not null, the pixels of each strile are counted into channel of it as soon as they are in place.
+// ioTiff must not be one of the workers' handles.
+// DANGER: assumes dataPtr has enough space allocated!!!!
+bool
+readTiffPlaneConcurrent(TIFF* ioTiff,
+                        TiffWorkers& workers,
+                        const TiffDirectoryIndex& directories,
+                        uint32_t planeIndex,
+                        const VolumeDimensions& dims,
+                        const VoxelRegion& box,
+                        uint8_t* dataPtr,
+                        HistogramAccumulator* counts,
+                        uint32_t channel,
+                        LoadControl* control)
+{
+  if (!directories.setDirectory(ioTiff, planeIndex)) {
+    spdlog::error("Bad tiff directory specified: {}", planeIndex);
+    return false;
+  }
+  if (dims.bitsPerPixel != 8 && dims.bitsPerPixel != 16 && dims.bitsPerPixel != 32) {
+    spdlog::error("Unexpected tiff pixel size {} bits", dims.bitsPerPixel);
+    return false;
+  }
+
+  TiffStrileLayout layout;
+  if (!layout.read(ioTiff, dims)) {
+    return false;
+  }
+  const char* strileName = layout.tiled ? "tile" : "strip";
+
+  std::vector<uint32_t> striles = layout.overlapping(dims, box);
+
+  std::mutex ioMutex;
+  std::atomic<bool> failed(false);
+  parallelFor(striles.size(), workers.size(), [&](size_t i, uint32_t worker) {
+    if (failed || (control && control->isCancelled())) {
+      return;
+    }
+    uint32_t strile = striles[i];
+    uint32_t x = 0, y = 0, w = 0, h = 0;
+    layout.rect(strile, dims, x, y, w, h);
+    const bool inPlace = layout.decodesInPlace(dims, box, y, h);
+    auto tStart = std::chrono::high_resolution_clock::now();
+
+    TiffWorkers::Worker* wk = workers.get(worker);
+    if (!wk) {
+      failed = true;
+      return;
+    }
+    if (wk->planeIndex != planeIndex) {
+      if (!directories.setDirectory(wk->tiff, planeIndex)) {
+        spdlog::error("Bad tiff directory specified: {}", planeIndex);
+        failed = true;
+        return;
       }
-      // this assumes tight packing of pixels in both buf(source) and dataptr(dest)
-      uint16_t* dataptr16 = reinterpret_cast<uint16_t*>(dataPtr);
-      uint8_t* tilebytes = reinterpret_cast<uint8_t*>(buf);
-      for (size_t b = 0; b < numBytesRead; ++b) {
-        *dataptr16 = (uint16_t)tilebytes[b];
-        dataptr16++;
+      wk->planeIndex = planeIndex;
+    }
+
+    {
+      // keep the file reads sequential
+      std::lock_guard<std::mutex> lock(ioMutex);
+      uint64_t rawSize = TIFFGetStrileByteCount(ioTiff, strile);
+      wk->raw.resize(rawSize);
+      tmsize_t numBytesRead = layout.tiled ? TIFFReadRawTile(ioTiff, strile, wk->raw.data(), rawSize)
+                                           : TIFFReadRawStrip(ioTiff, strile, wk->raw.data(), rawSize);
+      if (rawSize == 0 || numBytesRead != (tmsize_t)rawSize) {
+        spdlog::error("Error reading tiff {} {}", strileName, strile);
+        failed = true;
+        return;
       }
     }
 
-    _TIFFfree(buf);
-  } else {
-    // stripped.
+    tmsize_t decodedSize = layout.decodedSize(wk->tiff, h);
+    uint8_t* decoded = dataPtr + layout.destOffset(x, y, box);
+    if (!inPlace) {
+      wk->decoded.resize(decodedSize);
+      decoded = wk->decoded.data();
+    }
+    if (!TIFFReadFromUserBuffer(wk->tiff, strile, wk->raw.data(), (tmsize_t)wk->raw.size(), decoded, decodedSize)) {
+      spdlog::error("Error decoding tiff {} {}", strileName, strile);
+      failed = true;
+      return;
+    }
+    if (!inPlace) {
+      copyStrileToPlane(decoded, layout.width, x, y, w, h, dims, box, dataPtr);
+    }
+    if (counts) {
+      const uint32_t x0 = std::max(x, box.minX), x1 = std::min(x + w, box.maxX);
+      const uint32_t y0 = std::max(y, box.minY), y1 = std::min(y + h, box.maxY);
+      counts->addRows(channel,
+                      dataPtr + layout.destOffset(x0, y0, box),
+                      x1 - x0,
+                      y1 - y0,
+                      (size_t)box.sizeX() * layout.bytesPerPixel);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - tStart;
+    wk->bytes += (size_t)w * h * layout.bytesPerPixel;
+    wk->seconds += elapsed.count();
+  });
+
+  return !failed && !(control && control->isCancelled());
+}
+
+struct TiffPlaneRead
+{
+  uint32_t planeIndex;
+  // where the plane goes in the ImageXYZC buffer
+  size_t destOffset;
+  // the ImageXYZC channel it belongs to
+  uint32_t channel;
+};
+
+// Order planes as they are stored in the file, so that reading them sweeps through the file front to back instead of
+// jumping back and forth whenever the file's dimension order differs from our channel/slice order.
+// Writers store each plane's pixels near its IFD, so the IFD offset stands in for the pixels' offset.
+// Planes past the end of the IFD chain (ImageJ stacks over 4GB) are stored in plane index order after the first.
+void
+sortPlanesByFileOrder(std::vector<TiffPlaneRead>& planes, const TiffDirectoryIndex& directories)
+{
+  auto fileOrder = [&](const TiffPlaneRead& plane) {
+    uint64_t offset = std::numeric_limits<uint64_t>::max();
+    if (plane.planeIndex < directories.size()) {
+      offset = directories.offset(plane.planeIndex);
+    }
+    return std::make_pair(offset, plane.planeIndex);
+  };
+  std::sort(planes.begin(), planes.end(), [&](const TiffPlaneRead& a, const TiffPlaneRead& b) {
+    return fileOrder(a) < fileOrder(b);
+  });
+}
 
-    uint32_t i = planeIndex;
+// Whether to spread the striles of each plane across threads rather than the planes themselves. That only pays off
+// for a few planes that are each big enough to be worth a handle per thread, and that have enough striles in box to
+// keep more threads busy than the planes would. The first plane stands in for the rest.
+static bool
+wantsConcurrentStrips(TIFF* tiff,
+                      const TiffDirectoryIndex& directories,
+                      const VolumeDimensions& dims,
+                      const VoxelRegion& box,
+                      const std::vector<TiffPlaneRead>& planes,
+                      uint32_t availableThreads)
+{
+  static const size_t MIN_PLANE_BYTES = 64 * 1024 * 1024;
+  static const size_t MIN_STRILES = 16;
+
+  const size_t planeBytes = (size_t)box.sizeX() * box.sizeY() * (dims.bitsPerPixel / 8);
+  if (planes.empty() || planes.size() >= availableThreads || planeBytes < MIN_PLANE_BYTES) {
+    return false;
+  }
+  TiffStrileLayout layout;
+  if (!directories.setDirectory(tiff, planes[0].planeIndex) || !layout.read(tiff, dims)) {
+    // let the plane reads report the problem
+    return false;
+  }
+  size_t striles = layout.overlapping(dims, box).size();
+  return striles >= MIN_STRILES && striles > planes.size();
+}
 
-    uint32_t planeindexintiff = i;
+// Decode planes concurrently, each worker through its own TIFF handle.
+// When there are a few large planes (e.g. huge slide scanner planes), read the planes one at a time and spread each
+// plane's strips or tiles across the threads instead. In that case the primary handle only does the raw strip reads
+// and every worker opens a handle of its own for decompression.
+// If counts is not null, each plane's pixels are counted into it as soon as they are decoded.
+bool
+decodeTiffPlanes(ScopedTiffReader& tiffreader,
+                 const std::string& filepath,
+                 const VolumeDimensions& dims,
+                 const VoxelRegion& box,
+                 const std::vector<TiffPlaneRead>& planes,
+                 uint8_t* data,
+                 HistogramAccumulator* counts,
+                 LoadControl* control)
+{
+  auto tStart = std::chrono::high_resolution_clock::now();
 
-    // Number of bytes in a decoded scanline
-    tsize_t striplength = TIFFStripSize(tiff);
-    tdata_t buf = _TIFFmalloc(striplength);
+  TIFF* tiff = tiffreader.reader();
+  const TiffDirectoryIndex& directories = tiffreader.directories();
+  const size_t planesize_bytes = (size_t)box.sizeX() * box.sizeY() * (dims.bitsPerPixel / 8);
+  uint32_t availableThreads = FileReader::loaderThreadCount();
+  bool concurrentStrips = wantsConcurrentStrips(tiff, directories, dims, box, planes, availableThreads);
+  uint32_t nthreads = concurrentStrips ? availableThreads : parallelThreadCount(planes.size(), availableThreads);
+  TiffWorkers workers(filepath, nthreads, concurrentStrips ? nullptr : tiff);
+  std::atomic<bool> failed(false);
+  if (control) {
+    control->setTotal((uint32_t)planes.size());
+  }
 
-    uint32 nstrips = TIFFNumberOfStrips(tiff);
-    // spdlog::debug(nstrips;     // num y rows
-    // spdlog::debug(striplength; // x width * rows per strip
-    for (tstrip_t strip = 0; strip < nstrips; strip++) {
-      numBytesRead = TIFFReadEncodedStrip(tiff, strip, buf, striplength);
-      if (numBytesRead < 0) {
-        spdlog::error("Error reading tiff strip");
-        _TIFFfree(buf);
+  if (concurrentStrips) {
+    for (const TiffPlaneRead& plane : planes) {
+      uint8_t* dest = data + plane.destOffset;
+      if (!readTiffPlaneConcurrent(
+            tiff, workers, directories, plane.planeIndex, dims, box, dest, counts, plane.channel, control)) {
         return false;
       }
+      if (control) {
+        control->stepDone();
+      }
+    }
+  } else {
+    parallelFor(planes.size(), nthreads, [&](size_t i, uint32_t worker) {
+      if (failed || (control && control->isCancelled())) {
+        return;
+      }
+      TiffWorkers::Worker* w = workers.get(worker);
+      if (!w) {
+        failed = true;
+        return;
+      }
 
-      // copy buf into data.
-      if (IN_MEMORY_BPP == dims.bitsPerPixel) {
-        memcpy(dataPtr, buf, numBytesRead);
-        // advance to where the next strip will go
-        dataPtr += numBytesRead;
-      } else {
-        if (dims.bitsPerPixel != 8) {
-          spdlog::error("Unexpected tiff pixel size {} bits", dims.bitsPerPixel);
-          _TIFFfree(buf);
-          return false;
-        }
-        // convert pixels
-        // this assumes tight packing of pixels in both buf(source) and dataptr(dest)
-        uint8_t* stripbytes = reinterpret_cast<uint8_t*>(buf);
-        uint16_t* data16 = reinterpret_cast<uint16_t*>(dataPtr);
-        for (size_t b = 0; b < numBytesRead; ++b) {
-          *data16++ = *stripbytes++;
-          dataPtr++;
-          dataPtr++;
-        }
+      auto tPlaneStart = std::chrono::high_resolution_clock::now();
+      uint8_t* dest = data + planes[i].destOffset;
+      if (!readTiffPlane(w->tiff, directories, planes[i].planeIndex, dims, box, dest, w->decoded)) {
+        failed = true;
+        return;
+      }
+      if (counts) {
+        counts->add(planes[i].channel, dest, (size_t)box.sizeX() * box.sizeY());
       }
+      std::chrono::duration<double> planeElapsed = std::chrono::high_resolution_clock::now() - tPlaneStart;
+      w->bytes += planesize_bytes;
+      w->seconds += planeElapsed.count();
+      if (control) {
+        control->stepDone();
+      }
+    });
+  }
+
+  if (failed || (control && control->isCancelled())) {
+    return false;
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - tStart;
+  spdlog::debug("TIFF decoded in {} ms using {} threads{}",
+                elapsed.count() * 1000.0,
+                nthreads,
+                concurrentStrips ? " per plane" : "");
+  for (uint32_t t = 0; t < nthreads; ++t) {
+    double megabytes = (double)workers[t].bytes / (1024.0 * 1024.0);
+    spdlog::debug("  thread {}: {} MB in {} ms ({} MB/s)",
+                  t,
+                  megabytes,
+                  workers[t].seconds * 1000.0,
+                  workers[t].seconds > 0.0 ? megabytes / workers[t].seconds : 0.0);
+  }
+  return true;
+}
+
+// Uncompressed single channel planes (typical of ImageJ hyperstacks) need no decoding at all and can be
+// read straight out of a memory mapping of the file.
+// Finds the file offset of each plane's pixels, or returns false if any plane is not stored raw and contiguous.
+bool
+findRawPlaneOffsets(TIFF* tiff,
+                    const TiffDirectoryIndex& directories,
+                    const VolumeDimensions& dims,
+                    const std::vector<TiffPlaneRead>& planes,
+                    std::vector<uint64_t>& offsets)
+{
+  if (dims.bitsPerPixel != 8 && dims.bitsPerPixel != 16 && dims.bitsPerPixel != 32) {
+    return false;
+  }
+  const uint64_t planeBytes = (uint64_t)dims.sizeX * dims.sizeY * (dims.bitsPerPixel / 8);
+
+  // offset of the current directory's pixels, or 0 if they are not stored raw and contiguous
+  auto rawOffset = [&]() -> uint64_t {
+    uint16_t compression = COMPRESSION_NONE;
+    uint16_t samplesPerPixel = 1;
+    uint16_t bitsPerSample = 1;
+    uint32_t width = 0, height = 0;
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_COMPRESSION, &compression);
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel);
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
+    TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &height);
+    if (compression != COMPRESSION_NONE || samplesPerPixel != 1 || bitsPerSample != dims.bitsPerPixel ||
+        TIFFIsTiled(tiff) || width != dims.sizeX || height != dims.sizeY) {
+      return 0;
+    }
+    uint32_t strips = TIFFNumberOfStrips(tiff);
+    uint64_t start = TIFFGetStrileOffset(tiff, 0);
+    uint64_t end = start;
+    for (uint32_t strip = 0; strip < strips; ++strip) {
+      if (TIFFGetStrileOffset(tiff, strip) != end) {
+        return 0;
+      }
+      end += TIFFGetStrileByteCount(tiff, strip);
+    }
+    return (end - start >= planeBytes) ? start : 0;
+  };
+
+  offsets.clear();
+  if (directories.size() < (size_t)dims.sizeZ * dims.sizeC * dims.sizeT) {
+    // ImageJ writes stacks over 4GB with a single IFD; the other planes' pixels follow the first plane's directly.
+    if (directories.size() != 1 || !directories.setDirectory(tiff, 0)) {
+      return false;
+    }
+    uint64_t first = rawOffset();
+    if (!first) {
+      return false;
+    }
+    for (const TiffPlaneRead& plane : planes) {
+      offsets.push_back(first + plane.planeIndex * planeBytes);
+    }
+    return true;
+  }
+
+  for (const TiffPlaneRead& plane : planes) {
+    if (!directories.setDirectory(tiff, plane.planeIndex)) {
+      return false;
+    }
+    uint64_t offset = rawOffset();
+    if (!offset) {
+      return false;
     }
-    _TIFFfree(buf);
+    offsets.push_back(offset);
   }
   return true;
 }
 
+// The mapped file can serve as the ImageXYZC buffer itself if its pixels need no byte swapping or converting,
+// whole planes are read, and the planes sit in the file exactly as ImageXYZC lays them out:
+// channel after channel, slice after slice.
+// On success, start is the file offset of the first pixel of the ImageXYZC buffer.
+bool
+canAdoptRawPlanes(TIFF* tiff,
+                  const VolumeDimensions& dims,
+                  const VoxelRegion& box,
+                  const std::vector<TiffPlaneRead>& planes,
+                  const std::vector<uint64_t>& offsets,
+                  uint64_t& start)
+{
+  if (dims.bitsPerPixel > 16 || (dims.bitsPerPixel == 16 && TIFFIsByteSwapped(tiff)) || box.sizeX() != dims.sizeX ||
+      box.sizeY() != dims.sizeY || offsets[0] < planes[0].destOffset) {
+    return false;
+  }
+  start = offsets[0] - planes[0].destOffset;
+  if (start % (dims.bitsPerPixel / 8) != 0) {
+    return false;
+  }
+  for (size_t i = 0; i < planes.size(); ++i) {
+    if (offsets[i] != start + planes[i].destOffset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Copy the pixels inside box of raw planes out of the mapped file into the ImageXYZC buffer, byte swapping as needed.
+// If counts is not null, the pixels are counted into it block by block as they are copied.
+// Only the mapped pages that hold those pixels are ever read from disk.
+// Planes are split into blocks of rows of a few MB so that a handful of big planes still keeps every thread busy.
+bool
+copyRawPlanes(const uint8_t* mapped,
+              const std::vector<uint64_t>& offsets,
+              bool byteSwapped,
+              const VolumeDimensions& dims,
+              const VoxelRegion& box,
+              const std::vector<TiffPlaneRead>& planes,
+              uint8_t* data,
+              HistogramAccumulator* counts,
+              LoadControl* control)
+{
+  static const size_t BLOCK_PIXELS = 2 * 1024 * 1024;
+  const size_t bytesPerPixel = dims.bitsPerPixel / 8;
+  const uint32_t rowsPerBlock = (uint32_t)std::max<size_t>(1, BLOCK_PIXELS / box.sizeX());
+  const size_t blocksPerPlane = (box.sizeY() + rowsPerBlock - 1) / rowsPerBlock;
+  // rows as wide as the image are contiguous in the file and in the buffer, and are copied as one run
+  const bool wholeRows = box.sizeX() == dims.sizeX;
+  if (control) {
+    control->setTotal((uint32_t)(planes.size() * blocksPerPlane));
+  }
+
+  auto convert = [&](const uint8_t* src, uint8_t* dest, size_t count) {
+    if (bytesPerPixel == 2 && byteSwapped) {
+      byteSwap16(src, reinterpret_cast<uint16_t*>(dest), count);
+    } else if (bytesPerPixel == 4 && byteSwapped) {
+      byteSwap32(src, reinterpret_cast<uint32_t*>(dest), count);
+    } else {
+      memcpy(dest, src, count * bytesPerPixel);
+    }
+  };
+  parallelFor(planes.size() * blocksPerPlane, FileReader::loaderThreadCount(), [&](size_t i, uint32_t) {
+    if (control && control->isCancelled()) {
+      return;
+    }
+    size_t plane = i / blocksPerPlane;
+    uint32_t y0 = box.minY + (uint32_t)(i % blocksPerPlane) * rowsPerBlock;
+    uint32_t y1 = std::min(y0 + rowsPerBlock, box.maxY);
+    const uint8_t* src = mapped + offsets[plane] + ((size_t)y0 * dims.sizeX + box.minX) * bytesPerPixel;
+    uint8_t* dest = data + planes[plane].destOffset + (size_t)(y0 - box.minY) * box.sizeX() * bytesPerPixel;
+    uint8_t* blockStart = dest;
+    if (wholeRows) {
+      convert(src, dest, (size_t)(y1 - y0) * box.sizeX());
+    } else {
+      for (uint32_t y = y0; y < y1; ++y) {
+        convert(src, dest, box.sizeX());
+        src += (size_t)dims.sizeX * bytesPerPixel;
+        dest += (size_t)box.sizeX() * bytesPerPixel;
+      }
+    }
+    if (counts) {
+      counts->add(planes[plane].channel, blockStart, (size_t)(y1 - y0) * box.sizeX());
+    }
+    if (control) {
+      control->stepDone();
+    }
+  });
+  return !(control && control->isCancelled());
+}
+
+static uint32_t
+clampToUint32(double value)
+{
+  return (uint32_t)std::min(std::max(std::round(value), 0.0), 4294967295.0);
+}
+
+// Scale each channel of 32-bit unsigned or float pixels to 16 bits, and return the new 16-bit buffer.
+// The values are scaled from [rangeMin, rangeMax] if rangeMin < rangeMax, or else each channel from the range of its
+// own values. dims.bitsPerPixel becomes 16, and dims.valueOffsets and valueScales map the new values back.
+uint8_t*
+convert32To16(const uint8_t* data, bool isFloat, double rangeMin, double rangeMax, VolumeDimensions& dims)
+{
+  const bool hasRange = rangeMin < rangeMax;
+  const uint32_t numThreads = FileReader::loaderThreadCount();
+  const size_t channelVoxels = (size_t)dims.sizeX * dims.sizeY * dims.sizeZ;
+  uint8_t* converted = new uint8_t[channelVoxels * dims.sizeC * 2];
+  dims.valueOffsets.assign(dims.sizeC, 0.0);
+  dims.valueScales.assign(dims.sizeC, 0.0);
+  for (uint32_t c = 0; c < dims.sizeC; ++c) {
+    const uint8_t* src = data + c * channelVoxels * 4;
+    uint16_t* dst = reinterpret_cast<uint16_t*>(converted) + c * channelVoxels;
+    double min, max;
+    if (isFloat) {
+      const float* values = reinterpret_cast<const float*>(src);
+      float lo = (float)rangeMin, hi = (float)rangeMax;
+      if (hasRange) {
+        convertFloat32To16(values, dst, channelVoxels, numThreads, lo, hi);
+      } else {
+        normalizeFloat32To16(values, dst, channelVoxels, numThreads, lo, hi);
+        spdlog::info("Channel {} float values from {} to {} scaled to 16 bits", c, lo, hi);
+      }
+      min = lo;
+      max = hi;
+    } else {
+      const uint32_t* values = reinterpret_cast<const uint32_t*>(src);
+      uint32_t lo = clampToUint32(rangeMin), hi = clampToUint32(rangeMax);
+      if (hasRange) {
+        convertUint32To16(values, dst, channelVoxels, numThreads, lo, hi);
+      } else {
+        normalizeUint32To16(values, dst, channelVoxels, numThreads, lo, hi);
+        spdlog::info("Channel {} 32-bit values from {} to {} scaled to 16 bits", c, lo, hi);
+      }
+      min = lo;
+      max = hi;
+    }
+    // a channel with no finite values is all 0
+    if (min < max) {
+      dims.valueOffsets[c] = min;
+      dims.valueScales[c] = (max - min) / 65535.0;
+    }
+  }
+  dims.bitsPerPixel = 16;
+  return converted;
+}
+
 VolumeDimensions
 FileReaderTIFF::loadDimensionsTiff(const std::string& filepath, int32_t scene)
 {
@@ -423,7 +1176,7 @@ FileReaderTIFF::loadDimensionsTiff(const std::string& filepath, int32_t scene)
   }
 
   VolumeDimensions dims;
-  bool dims_ok = readTiffDimensions(tiff, filepath, dims);
+  bool dims_ok = readTiffDimensions(tiff, tiffreader.directories(), filepath, dims);
   if (!dims_ok) {
     return VolumeDimensions();
   }
@@ -433,8 +1186,17 @@ FileReaderTIFF::loadDimensionsTiff(const std::string& filepath, int32_t scene)
 
 std::shared_ptr<ImageXYZC>
 FileReaderTIFF::loadOMETiff(const std::string& filepath, VolumeDimensions* outDims, int32_t time, int32_t scene)
+{
+  return loadOMETiff(LoadSpec(filepath, time, scene), outDims);
+}
+
+std::shared_ptr<ImageXYZC>
+FileReaderTIFF::loadOMETiff(const LoadSpec& spec, VolumeDimensions* outDims, LoadControl* control)
 {
   std::shared_ptr<ImageXYZC> emptyimage;
+  const std::string& filepath = spec.filepath;
+  int32_t time = spec.time;
+  int32_t scene = spec.scene;
 
   auto tStart = std::chrono::high_resolution_clock::now();
 
@@ -446,7 +1208,8 @@ FileReaderTIFF::loadOMETiff(const std::string& filepath, VolumeDimensions* outDi
   }
 
   VolumeDimensions dims;
-  bool dims_ok = readTiffDimensions(tiff, filepath, dims);
+  uint16_t sampleFormat = SAMPLEFORMAT_UINT;
+  bool dims_ok = readTiffDimensions(tiff, tiffreader.directories(), filepath, dims, &sampleFormat);
   if (!dims_ok) {
     return emptyimage;
   }
@@ -455,10 +1218,37 @@ FileReaderTIFF::loadOMETiff(const std::string& filepath, VolumeDimensions* outDi
     spdlog::warn("Multiscene tiff not supported yet. Using scene 0");
     scene = 0;
   }
+  if (spec.level > 0 || spec.maxDimension > 0) {
+    spdlog::warn("Tiff resolution levels not supported yet. Using full resolution");
+  }
   if (time > (int32_t)(dims.sizeT - 1)) {
     spdlog::error("Time {} exceeds time samples in file: {}", time, dims.sizeT);
     return emptyimage;
   }
+  if (!spec.region.isValid()) {
+    spdlog::error("The requested region of {} is empty; leave it at its default to read the whole volume", filepath);
+    return emptyimage;
+  }
+  VoxelRegion box = spec.region.clampedTo(dims.sizeX, dims.sizeY, dims.sizeZ);
+  if (box.isEmpty()) {
+    spdlog::error("The requested region lies outside of {}", filepath);
+    return emptyimage;
+  }
+  std::vector<uint32_t> channels = spec.channelsToRead(dims.sizeC);
+  if (channels.empty()) {
+    spdlog::error("Channels requested are out of range for {} with {} channels", filepath, dims.sizeC);
+    return emptyimage;
+  }
+  // the dimensions of the image returned: those of the region and channels read
+  VolumeDimensions readDims = dims;
+  readDims.sizeX = box.sizeX();
+  readDims.sizeY = box.sizeY();
+  readDims.sizeZ = box.sizeZ();
+  readDims.sizeC = (uint32_t)channels.size();
+  readDims.channelNames.clear();
+  for (uint32_t channel : channels) {
+    readDims.channelNames.push_back(channel < dims.channelNames.size() ? dims.channelNames[channel] : "");
+  }
 
   spdlog::debug("Reading {} tiff...", (TIFFIsTiled(tiff) ? "tiled" : "stripped"));
 
@@ -477,44 +1267,133 @@ FileReaderTIFF::loadOMETiff(const std::string& filepath, VolumeDimensions* outDi
     spdlog::debug("PlanarConfig: {}", (planarConfig == 1 ? "PLANARCONFIG_CONTIG" : "PLANARCONFIG_SEPARATE"));
   }
 
-  size_t planesize_bytes = dims.sizeX * dims.sizeY * (IN_MEMORY_BPP / 8);
-  size_t channelsize_bytes = planesize_bytes * dims.sizeZ;
-  uint8_t* data = new uint8_t[channelsize_bytes * dims.sizeC];
-  memset(data, 0, channelsize_bytes * dims.sizeC);
-  // stash it here in case of early exit, it will be deleted
-  std::unique_ptr<uint8_t[]> smartPtr(data);
+  // 8 and 16-bit pixels alike are kept at their own size; 32-bit pixels are read as they are, then converted
+  size_t planesize_bytes = (size_t)readDims.sizeX * readDims.sizeY * (readDims.bitsPerPixel / 8);
+  size_t channelsize_bytes = planesize_bytes * readDims.sizeZ;
 
-  uint8_t* destptr = data;
+  std::vector<TiffPlaneRead> planes;
+  for (uint32_t i = 0; i < channels.size(); ++i) {
+    for (uint32_t slice = box.minZ; slice < box.maxZ; ++slice) {
+      planes.push_back({ dims.getPlaneIndex(slice, channels[i], time),
+                         i * channelsize_bytes + (slice - box.minZ) * planesize_bytes,
+                         i });
+    }
+  }
+
+  sortPlanesByFileOrder(planes, tiffreader.directories());
+
+  uint8_t* data = nullptr;
+  // owns data when it was decoded into memory of our own
+  std::unique_ptr<uint8_t[]> smartPtr;
+  // owns data when it lives in a memory mapping of the file
+  std::shared_ptr<MemoryMappedFile> mapping;
+
+  // the channel histograms are gathered while the pixels are decoded or copied, not in another pass afterwards.
+  // 32-bit pixels are counted only once converted, by ImageXYZC.
+  std::unique_ptr<HistogramAccumulator> counts;
+  if (readDims.bitsPerPixel <= 16) {
+    counts.reset(new HistogramAccumulator(readDims.sizeC, readDims.bitsPerPixel));
+  }
 
-  // now ready to read channels one by one.
-  for (uint32_t channel = 0; channel < dims.sizeC; ++channel) {
-    for (uint32_t slice = 0; slice < dims.sizeZ; ++slice) {
-      uint32_t planeIndex = dims.getPlaneIndex(slice, channel, time);
-      destptr = data + channel * channelsize_bytes + slice * planesize_bytes;
-      if (!readTiffPlane(tiff, planeIndex, dims, destptr)) {
+  std::vector<uint64_t> rawOffsets;
+  uint64_t rawStart = 0;
+  if (findRawPlaneOffsets(tiff, tiffreader.directories(), dims, planes, rawOffsets)) {
+    mapping = std::make_shared<MemoryMappedFile>(filepath);
+    const uint64_t rawPlaneBytes = (uint64_t)dims.sizeX * dims.sizeY * (dims.bitsPerPixel / 8);
+    bool inRange = mapping->isOpen();
+    for (size_t i = 0; inRange && i < rawOffsets.size(); ++i) {
+      inRange = rawOffsets[i] + rawPlaneBytes <= mapping->size();
+    }
+    if (!inRange) {
+      spdlog::warn("Uncompressed TIFF planes could not be memory mapped; decoding them instead");
+      mapping.reset();
+    } else if (canAdoptRawPlanes(tiff, dims, box, planes, rawOffsets, rawStart)) {
+      data = mapping->data() + rawStart;
+      // nothing passes through memory here to count on the way
+      counts.reset();
+      spdlog::debug("TIFF planes used in place from a memory mapping of the file");
+      if (control) {
+        control->setTotal(1);
+        control->stepDone();
+      }
+    } else {
+      data = new uint8_t[channelsize_bytes * readDims.sizeC];
+      smartPtr.reset(data);
+      bool copied = copyRawPlanes(
+        mapping->data(), rawOffsets, TIFFIsByteSwapped(tiff), dims, box, planes, data, counts.get(), control);
+      mapping.reset();
+      if (!copied) {
+        spdlog::info("Loading {} cancelled", filepath);
         return emptyimage;
       }
+      spdlog::debug("TIFF planes copied from a memory mapping of the file");
     }
   }
 
+  if (!data) {
+    // no need to clear this; every pixel of every plane gets decoded into it
+    data = new uint8_t[channelsize_bytes * readDims.sizeC];
+    // stash it here in case of early exit, it will be deleted
+    smartPtr.reset(data);
+    if (!decodeTiffPlanes(tiffreader, filepath, dims, box, planes, data, counts.get(), control)) {
+      if (control && control->isCancelled()) {
+        spdlog::info("Loading {} cancelled", filepath);
+      }
+      return emptyimage;
+    }
+  }
+
+  if (readDims.bitsPerPixel == 32) {
+    // 32-bit planes were decoded as they are in the file; scale them to 16 bits, from a range that holds for the whole
+    // file when there is one, so that every timepoint and region of it is scaled alike
+    double rangeMin = spec.valueMin, rangeMax = spec.valueMax;
+    if (!spec.hasValueRange() && !(TIFFGetField(tiff, TIFFTAG_SMINSAMPLEVALUE, &rangeMin) == 1 &&
+                                   TIFFGetField(tiff, TIFFTAG_SMAXSAMPLEVALUE, &rangeMax) == 1)) {
+      rangeMin = rangeMax = 0.0;
+    }
+    data = convert32To16(data, sampleFormat == SAMPLEFORMAT_IEEEFP, rangeMin, rangeMax, readDims);
+    smartPtr.reset(data);
+  }
+
   auto tEnd = std::chrono::high_resolution_clock::now();
   std::chrono::duration<double> elapsed = tEnd - tStart;
-  spdlog::debug("TIFF loaded in {} ms", elapsed.count() * 1000.0);
+  spdlog::debug("TIFF planes read in {} ms", elapsed.count() * 1000.0);
 
   auto tStartImage = std::chrono::high_resolution_clock::now();
 
-  // TODO: convert data to uint16_t pixels if not already.
   // we can release the smartPtr because ImageXYZC will now own the raw data memory
-  ImageXYZC* im = new ImageXYZC(dims.sizeX,
-                                dims.sizeY,
-                                dims.sizeZ,
-                                dims.sizeC,
-                                IN_MEMORY_BPP, // dims.bitsPerPixel,
-                                smartPtr.release(),
-                                dims.physicalSizeX,
-                                dims.physicalSizeY,
-                                dims.physicalSizeZ);
-  im->setChannelNames(dims.channelNames);
+  // (or keep the memory mapping alive, when the pixels are used in place)
+  smartPtr.release();
+  ImageXYZC* im = nullptr;
+  if (counts) {
+    im = new ImageXYZC(readDims.sizeX,
+                       readDims.sizeY,
+                       readDims.sizeZ,
+                       readDims.sizeC,
+                       readDims.bitsPerPixel,
+                       data,
+                       readDims.physicalSizeX,
+                       readDims.physicalSizeY,
+                       readDims.physicalSizeZ,
+                       mapping,
+                       counts->histograms(),
+                       {});
+  } else {
+    im = new ImageXYZC(readDims.sizeX,
+                       readDims.sizeY,
+                       readDims.sizeZ,
+                       readDims.sizeC,
+                       readDims.bitsPerPixel,
+                       data,
+                       readDims.physicalSizeX,
+                       readDims.physicalSizeY,
+                       readDims.physicalSizeZ,
+                       mapping);
+  }
+  im->setPhysicalOffset(
+    box.minX * readDims.physicalSizeX, box.minY * readDims.physicalSizeY, box.minZ * readDims.physicalSizeZ);
+  im->setChannelNames(readDims.channelNames);
+  im->setValueMappings(readDims.valueOffsets, readDims.valueScales);
 
   tEnd = std::chrono::high_resolution_clock::now();
   elapsed = tEnd - tStartImage;
@@ -525,7 +1404,7 @@ FileReaderTIFF::loadOMETiff(const std::string& filepath, VolumeDimensions* outDi
 
   std::shared_ptr<ImageXYZC> sharedImage(im);
   if (outDims != nullptr) {
-    *outDims = dims;
+    *outDims = readDims;
   }
   return sharedImage;
 }
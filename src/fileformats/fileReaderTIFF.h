@@ -1,11 +1,13 @@
 #pragma once
 
 #include "graphics/volumeDimensions.h"
+#include "loadSpec.h"
 
 #include <memory>
 #include <string>
 
 class ImageXYZC;
+class LoadControl;
 
 class FileReaderTIFF
 {
@@ -17,5 +19,8 @@ public:
                                                 VolumeDimensions* dims = nullptr,
                                                 int32_t time = 0,
                                                 int32_t scene = 0);
+  static std::shared_ptr<ImageXYZC> loadOMETiff(const LoadSpec& spec,
+                                                VolumeDimensions* dims = nullptr,
+                                                LoadControl* control = nullptr);
   static VolumeDimensions loadDimensionsTiff(const std::string& filepath, int32_t scene = 0);
 };
@@ -0,0 +1,933 @@
+#include "fileReaderZarr.h"
+
+#include "fileReader.h"
+#include "loadControl.h"
+
+#include "graphics/histogramAccumulator.h"
+#include "graphics/imageXYZC.h"
+#include "graphics/pagedVolume.h"
+#include "graphics/parallel.h"
+#include "graphics/pixelConversion.h"
+
+#include "json.hpp"
+#include "spdlog/spdlog.h"
+
+#include <blosc.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <set>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+using json = nlohmann::json;
+
+// the axes of a 5D image, in the order that zarr arrays without axes metadata use
+enum ZarrAxis
+{
+  AXIS_T = 0,
+  AXIS_C,
+  AXIS_Z,
+  AXIS_Y,
+  AXIS_X,
+  AXIS_COUNT
+};
+
+static bool
+readTextFile(const std::string& path, std::string& text)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  return true;
+}
+
+static bool
+readBinaryFile(const std::string& path, std::vector<uint8_t>& bytes)
+{
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in) {
+    return false;
+  }
+  std::streamoff size = in.tellg();
+  bytes.resize(size_t(size));
+  in.seekg(0);
+  return size == 0 || (bool)in.read(reinterpret_cast<char*>(bytes.data()), size);
+}
+
+static bool
+readJsonFile(const std::string& path, json& value)
+{
+  std::string text;
+  if (!readTextFile(path, text)) {
+    return false;
+  }
+  try {
+    value = json::parse(text);
+  } catch (std::exception& e) {
+    spdlog::error("Could not parse {}: {}", path, e.what());
+    return false;
+  }
+  return true;
+}
+
+static bool
+isDirectory(const std::string& path)
+{
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFDIR);
+}
+
+// The newest modification time of a directory and of everything under it, in seconds since the epoch.
+static int64_t
+newestModificationTime(const std::string& directory)
+{
+  int64_t newest = FileReader::fileModificationTime(directory);
+#ifdef _WIN32
+  WIN32_FIND_DATAA found;
+  HANDLE search = FindFirstFileA((directory + "/*").c_str(), &found);
+  if (search == INVALID_HANDLE_VALUE) {
+    return newest;
+  }
+  do {
+    std::string name = found.cFileName;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      newest = std::max(newest, newestModificationTime(directory + "/" + name));
+    } else {
+      // 100ns intervals since 1601
+      uint64_t written =
+        (uint64_t(found.ftLastWriteTime.dwHighDateTime) << 32) | found.ftLastWriteTime.dwLowDateTime;
+      newest = std::max(newest, int64_t((written - 116444736000000000ULL) / 10000000ULL));
+    }
+  } while (FindNextFileA(search, &found));
+  FindClose(search);
+#else
+  DIR* dir = opendir(directory.c_str());
+  if (!dir) {
+    return newest;
+  }
+  while (struct dirent* found = readdir(dir)) {
+    std::string name = found->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    std::string path = directory + "/" + name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      newest = std::max(newest, newestModificationTime(path));
+    } else {
+      newest = std::max(newest, int64_t(st.st_mtime));
+    }
+  }
+  closedir(dir);
+#endif
+  return newest;
+}
+
+static std::string
+withoutTrailingSeparator(const std::string& path)
+{
+  std::string trimmed = path;
+  while (trimmed.size() > 1 && (trimmed.back() == '/' || trimmed.back() == '\\')) {
+    trimmed.pop_back();
+  }
+  return trimmed;
+}
+
+static bool
+isLittleEndianHost()
+{
+  const uint16_t one = 1;
+  return *reinterpret_cast<const uint8_t*>(&one) == 1;
+}
+
+// One array of a zarr store, as described by its .zarray
+struct ZarrArray
+{
+  std::string directory;
+  std::vector<uint64_t> shape;
+  std::vector<uint64_t> chunks;
+  uint32_t bytesPerElement = 0;
+  // whether elements are in the opposite byte order to this machine's
+  bool byteSwapped = false;
+  // "" when chunks are stored uncompressed
+  std::string compressor;
+  uint16_t fillValue = 0;
+  char separator = '.';
+
+  bool read(const std::string& arrayDirectory)
+  {
+    directory = arrayDirectory;
+    json zarray;
+    if (!readJsonFile(directory + "/.zarray", zarray)) {
+      spdlog::error("No zarr array metadata in {}", directory);
+      return false;
+    }
+    try {
+      if (zarray.value("zarr_format", 0) != 2) {
+        spdlog::error("Only zarr format 2 arrays are supported ({})", directory);
+        return false;
+      }
+      shape = zarray.at("shape").get<std::vector<uint64_t>>();
+      chunks = zarray.at("chunks").get<std::vector<uint64_t>>();
+      if (zarray.value("order", std::string("C")) != "C") {
+        spdlog::error("Only C order zarr arrays are supported ({})", directory);
+        return false;
+      }
+      std::string dtype = zarray.at("dtype").get<std::string>();
+      if (dtype == "|u1" || dtype == "<u1" || dtype == ">u1") {
+        bytesPerElement = 1;
+      } else if (dtype == "<u2" || dtype == ">u2") {
+        bytesPerElement = 2;
+        byteSwapped = (dtype[0] == '<') != isLittleEndianHost();
+      } else {
+        spdlog::error("Zarr data type {} is not supported ({})", dtype, directory);
+        return false;
+      }
+      const json& codec = zarray.at("compressor");
+      if (!codec.is_null()) {
+        compressor = codec.at("id").get<std::string>();
+        if (compressor != "zlib" && compressor != "gzip" && compressor != "blosc") {
+          spdlog::error("Zarr compressor {} is not supported ({})", compressor, directory);
+          return false;
+        }
+      }
+      auto filters = zarray.find("filters");
+      if (filters != zarray.end() && !filters->is_null() && !filters->empty()) {
+        spdlog::error("Zarr filters are not supported ({})", directory);
+        return false;
+      }
+      auto fill = zarray.find("fill_value");
+      if (fill != zarray.end() && fill->is_number()) {
+        fillValue = fill->get<uint16_t>();
+      }
+      separator = zarray.value("dimension_separator", std::string(".")) == "/" ? '/' : '.';
+    } catch (std::exception& e) {
+      spdlog::error("Invalid zarr array metadata in {}: {}", directory, e.what());
+      return false;
+    }
+    if (shape.empty() || shape.size() != chunks.size() ||
+        std::find(chunks.begin(), chunks.end(), uint64_t(0)) != chunks.end()) {
+      spdlog::error("Invalid zarr array shape in {}", directory);
+      return false;
+    }
+    return true;
+  }
+
+  size_t chunkElements() const
+  {
+    size_t count = 1;
+    for (uint64_t c : chunks) {
+      count *= c;
+    }
+    return count;
+  }
+
+  std::string chunkPath(const std::vector<uint64_t>& chunkIndex) const
+  {
+    std::string path = directory + "/";
+    for (size_t d = 0; d < chunkIndex.size(); ++d) {
+      if (d > 0) {
+        path += separator;
+      }
+      path += std::to_string(chunkIndex[d]);
+    }
+    return path;
+  }
+};
+
+// An OME-Zarr multiscale image, as described by its .zattrs
+struct ZarrImage
+{
+  std::string directory;
+  // which axis each array dimension is
+  std::vector<ZarrAxis> axes;
+  // path of each resolution level, largest first
+  std::vector<std::string> levels;
+  // physical size of a voxel along each array dimension, for each level
+  std::vector<std::vector<double>> scales;
+  std::vector<std::string> channelNames;
+
+  bool read(const std::string& imageDirectory)
+  {
+    directory = imageDirectory;
+    json zattrs;
+    if (!readJsonFile(directory + "/.zattrs", zattrs)) {
+      spdlog::error("No OME-Zarr metadata in {}", directory);
+      return false;
+    }
+    try {
+      const json& multiscale = zattrs.at("multiscales").at(0);
+
+      auto axesMetadata = multiscale.find("axes");
+      if (axesMetadata == multiscale.end()) {
+        // before version 0.3, images were always 5D
+        axes = { AXIS_T, AXIS_C, AXIS_Z, AXIS_Y, AXIS_X };
+      } else {
+        for (const json& axis : *axesMetadata) {
+          // names in 0.3, objects with names in 0.4
+          std::string name = axis.is_string() ? axis.get<std::string>() : axis.at("name").get<std::string>();
+          static const std::string AXIS_NAMES = "tczyx";
+          size_t which = name.size() == 1 ? AXIS_NAMES.find(name[0]) : std::string::npos;
+          if (which == std::string::npos) {
+            spdlog::error("OME-Zarr axis {} is not supported ({})", name, directory);
+            return false;
+          }
+          axes.push_back(ZarrAxis(which));
+        }
+      }
+
+      // a scale for the whole multiscale image applies on top of each level's own
+      std::vector<double> globalScale(axes.size(), 1.0);
+      auto globalTransforms = multiscale.find("coordinateTransformations");
+      if (globalTransforms != multiscale.end()) {
+        readScale(*globalTransforms, globalScale);
+      }
+      for (const json& dataset : multiscale.at("datasets")) {
+        levels.push_back(dataset.at("path").get<std::string>());
+        std::vector<double> scale(axes.size(), 1.0);
+        auto transforms = dataset.find("coordinateTransformations");
+        if (transforms != dataset.end()) {
+          readScale(*transforms, scale);
+        }
+        for (size_t d = 0; d < scale.size(); ++d) {
+          scale[d] *= globalScale[d];
+        }
+        scales.push_back(scale);
+      }
+
+      auto omero = zattrs.find("omero");
+      if (omero != zattrs.end() && omero->find("channels") != omero->end()) {
+        for (const json& channel : omero->at("channels")) {
+          channelNames.push_back(channel.value("label", std::string()));
+        }
+      }
+    } catch (std::exception& e) {
+      spdlog::error("Invalid OME-Zarr metadata in {}: {}", directory, e.what());
+      return false;
+    }
+    if (levels.empty()) {
+      spdlog::error("No resolution levels in {}", directory);
+      return false;
+    }
+    return true;
+  }
+
+  static void readScale(const json& transforms, std::vector<double>& scale)
+  {
+    for (const json& transform : transforms) {
+      if (transform.value("type", std::string()) == "scale") {
+        std::vector<double> values = transform.at("scale").get<std::vector<double>>();
+        if (values.size() == scale.size()) {
+          scale = values;
+        }
+      }
+    }
+  }
+
+  // the array dimension of an axis, or -1 if the image doesn't have that axis
+  int dimensionOf(ZarrAxis axis) const
+  {
+    auto found = std::find(axes.begin(), axes.end(), axis);
+    return found == axes.end() ? -1 : int(found - axes.begin());
+  }
+};
+
+// the image of a scene: stores written by bioformats2raw keep one image per scene in numbered directories
+static std::string
+sceneDirectory(const std::string& storeDirectory, int32_t scene)
+{
+  json zattrs;
+  if (readJsonFile(storeDirectory + "/.zattrs", zattrs) && zattrs.find("bioformats2raw.layout") != zattrs.end()) {
+    return storeDirectory + "/" + std::to_string(scene);
+  }
+  if (scene != 0) {
+    spdlog::warn("{} holds a single image; reading it for scene {}", storeDirectory, scene);
+  }
+  return storeDirectory;
+}
+
+// size of an array along an axis, 1 if it doesn't have that axis
+static uint32_t
+sizeAlong(const ZarrImage& image, const ZarrArray& array, ZarrAxis axis)
+{
+  int d = image.dimensionOf(axis);
+  return d < 0 ? 1 : (uint32_t)array.shape[d];
+}
+
+static bool
+openZarrLevel(const LoadSpec& spec, ZarrImage& image, ZarrArray& array, size_t& level, VolumeDimensions& dims)
+{
+  std::string store = withoutTrailingSeparator(spec.filepath);
+  if (!image.read(sceneDirectory(store, spec.scene))) {
+    return false;
+  }
+
+  level = std::min<size_t>(spec.level, image.levels.size() - 1);
+  if (spec.maxDimension > 0) {
+    // the largest level that fits, or else the smallest level
+    level = image.levels.size() - 1;
+    for (size_t i = 0; i < image.levels.size(); ++i) {
+      ZarrArray candidate;
+      if (!candidate.read(image.directory + "/" + image.levels[i])) {
+        return false;
+      }
+      if (sizeAlong(image, candidate, AXIS_X) <= spec.maxDimension &&
+          sizeAlong(image, candidate, AXIS_Y) <= spec.maxDimension) {
+        level = i;
+        break;
+      }
+    }
+  }
+  if (!array.read(image.directory + "/" + image.levels[level])) {
+    return false;
+  }
+  if (array.shape.size() != image.axes.size()) {
+    spdlog::error("OME-Zarr axes don't match the array shape in {}", array.directory);
+    return false;
+  }
+
+  const std::vector<double>& scale = image.scales[level];
+  dims.sizeX = sizeAlong(image, array, AXIS_X);
+  dims.sizeY = sizeAlong(image, array, AXIS_Y);
+  dims.sizeZ = sizeAlong(image, array, AXIS_Z);
+  dims.sizeC = sizeAlong(image, array, AXIS_C);
+  dims.sizeT = sizeAlong(image, array, AXIS_T);
+  dims.physicalSizeX = image.dimensionOf(AXIS_X) < 0 ? 1.0f : (float)scale[image.dimensionOf(AXIS_X)];
+  dims.physicalSizeY = image.dimensionOf(AXIS_Y) < 0 ? 1.0f : (float)scale[image.dimensionOf(AXIS_Y)];
+  dims.physicalSizeZ = image.dimensionOf(AXIS_Z) < 0 ? 1.0f : (float)scale[image.dimensionOf(AXIS_Z)];
+  dims.bitsPerPixel = array.bytesPerElement * 8;
+  dims.dimensionOrder = "XYZCT";
+  dims.channelNames = image.channelNames;
+  if (dims.channelNames.size() != dims.sizeC) {
+    dims.channelNames.clear();
+    for (uint32_t c = 0; c < dims.sizeC; ++c) {
+      dims.channelNames.push_back(std::to_string(c));
+    }
+  }
+  return true;
+}
+
+// Decompresses a zlib or gzip chunk that must decode to exactly size bytes. inflate detects both alike.
+static bool
+inflateChunk(const std::vector<uint8_t>& compressed, std::vector<uint8_t>& decoded, size_t size)
+{
+  decoded.resize(size);
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+    return false;
+  }
+  stream.next_in = const_cast<Bytef*>(compressed.data());
+  stream.avail_in = uInt(compressed.size());
+  stream.next_out = decoded.data();
+  stream.avail_out = uInt(size);
+  int status = inflate(&stream, Z_FINISH);
+  bool complete = status == Z_STREAM_END && stream.total_out == size;
+  inflateEnd(&stream);
+  return complete;
+}
+
+// Decompresses a blosc chunk that must decode to exactly size bytes. Blosc undoes its own shuffle filter, whichever
+// inner codec (blosclz, lz4, zstd, zlib) compressed it.
+static bool
+decompressBloscChunk(const std::vector<uint8_t>& compressed, std::vector<uint8_t>& decoded, size_t size)
+{
+  // the header's sizes are checked against the buffer before they are trusted
+  size_t decodedSize = 0;
+  if (compressed.empty() || blosc_cbuffer_validate(compressed.data(), compressed.size(), &decodedSize) != 0 ||
+      decodedSize != size) {
+    return false;
+  }
+  decoded.resize(size);
+  // the _ctx variant keeps no global state, so chunks can be decompressed on several threads at once
+  return blosc_decompress_ctx(compressed.data(), decoded.data(), size, 1) == int(size);
+}
+
+static bool
+decodeChunk(const ZarrArray& array, const std::vector<uint8_t>& compressed, std::vector<uint8_t>& decoded, size_t size)
+{
+  if (array.compressor == "blosc") {
+    return decompressBloscChunk(compressed, decoded, size);
+  }
+  return inflateChunk(compressed, decoded, size);
+}
+
+// copies count 8-bit elements, each stride elements apart
+static void
+convertElements(const ZarrArray& array, const uint8_t* src, size_t stride, uint8_t* dst, size_t count)
+{
+  assert(array.bytesPerElement == 1);
+  if (stride == 1) {
+    memcpy(dst, src, count);
+    return;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = src[i * stride];
+  }
+}
+
+// converts count elements, each stride elements apart, to 16 bits
+static void
+convertElements(const ZarrArray& array, const uint8_t* src, size_t stride, uint16_t* dst, size_t count)
+{
+  if (stride == 1) {
+    if (array.bytesPerElement == 1) {
+      widen8to16(src, dst, count);
+    } else if (array.byteSwapped) {
+      byteSwap16(src, dst, count);
+    } else {
+      memcpy(dst, src, count * 2);
+    }
+    return;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    const uint8_t* element = src + i * stride * array.bytesPerElement;
+    if (array.bytesPerElement == 1) {
+      dst[i] = element[0];
+    } else if (array.byteSwapped) {
+      dst[i] = uint16_t((element[0] << 8) | element[1]);
+    } else {
+      memcpy(&dst[i], element, 2);
+    }
+  }
+}
+
+// Reads the voxels in box (which must lie inside the level) of the given channels at one timepoint into voxels,
+// one channel after another, from the chunks that overlap it on up to maxThreads threads. T is uint16_t, or uint8_t
+// for arrays of 8-bit elements that are to stay 8-bit.
+// If counts is not null, the voxels of each chunk are counted into it as soon as they are copied.
+// False if a chunk is damaged or control cancels the read.
+template<typename T>
+static bool
+readZarrRegion(const ZarrImage& image,
+               const ZarrArray& array,
+               const VolumeDimensions& levelDims,
+               int32_t time,
+               const VoxelRegion& box,
+               const std::vector<uint32_t>& readChannels,
+               T* voxels,
+               HistogramAccumulator* counts,
+               uint32_t maxThreads,
+               LoadControl* control,
+               size_t* chunksRead = nullptr)
+{
+  // the requested range along each axis, in voxels: [first, last]
+  uint64_t first[AXIS_COUNT], last[AXIS_COUNT];
+  first[AXIS_T] = last[AXIS_T] = (uint64_t)time;
+  first[AXIS_C] = *std::min_element(readChannels.begin(), readChannels.end());
+  last[AXIS_C] = *std::max_element(readChannels.begin(), readChannels.end());
+  first[AXIS_Z] = box.minZ;
+  last[AXIS_Z] = box.maxZ - 1;
+  first[AXIS_Y] = box.minY;
+  last[AXIS_Y] = box.maxY - 1;
+  first[AXIS_X] = box.minX;
+  last[AXIS_X] = box.maxX - 1;
+
+  // the chunks to read: every combination of the chunk indices that overlap the requested range along each array
+  // dimension, skipping channel chunks that hold none of the requested channels
+  const size_t ndims = array.shape.size();
+  std::vector<std::vector<uint64_t>> chunkRanges(ndims);
+  for (size_t d = 0; d < ndims; ++d) {
+    ZarrAxis axis = image.axes[d];
+    if (axis == AXIS_C) {
+      std::set<uint64_t> channelChunks;
+      for (uint32_t c : readChannels) {
+        channelChunks.insert(c / array.chunks[d]);
+      }
+      chunkRanges[d].assign(channelChunks.begin(), channelChunks.end());
+    } else {
+      for (uint64_t i = first[axis] / array.chunks[d]; i <= last[axis] / array.chunks[d]; ++i) {
+        chunkRanges[d].push_back(i);
+      }
+    }
+  }
+  std::vector<std::vector<uint64_t>> chunkIndices;
+  std::vector<uint64_t> chunkIndex(ndims);
+  std::function<void(size_t)> enumerate = [&](size_t d) {
+    if (d == ndims) {
+      chunkIndices.push_back(chunkIndex);
+      return;
+    }
+    for (uint64_t i : chunkRanges[d]) {
+      chunkIndex[d] = i;
+      enumerate(d + 1);
+    }
+  };
+  enumerate(0);
+
+  // the output channel of each file channel, or -1 if it isn't read
+  std::vector<int> outputChannel(levelDims.sizeC, -1);
+  for (size_t i = 0; i < readChannels.size(); ++i) {
+    outputChannel[readChannels[i]] = int(i);
+  }
+
+  // strides of each axis within a chunk, in elements; 0 for axes the image doesn't have
+  size_t chunkStride[AXIS_COUNT] = { 0, 0, 0, 0, 0 };
+  size_t stride = 1;
+  for (size_t d = ndims; d-- > 0;) {
+    chunkStride[image.axes[d]] = stride;
+    stride *= array.chunks[d];
+  }
+  const size_t chunkBytes = array.chunkElements() * array.bytesPerElement;
+
+  const size_t planeVoxels = size_t(box.sizeX()) * box.sizeY();
+  const size_t channelVoxels = planeVoxels * box.sizeZ();
+
+  if (control) {
+    control->setTotal((uint32_t)chunkIndices.size());
+  }
+  uint32_t numThreads = parallelThreadCount(chunkIndices.size(), maxThreads);
+  std::vector<std::vector<uint8_t>> compressed(numThreads);
+  std::vector<std::vector<uint8_t>> decoded(numThreads);
+  std::atomic<bool> damaged(false);
+  parallelFor(chunkIndices.size(), numThreads, [&](size_t index, uint32_t worker) {
+    if (damaged || (control && control->isCancelled())) {
+      return;
+    }
+    const std::vector<uint64_t>& chunk = chunkIndices[index];
+
+    // where the chunk starts along each axis, and the part of the requested range it holds
+    uint64_t origin[AXIS_COUNT] = { 0, 0, 0, 0, 0 };
+    uint64_t from[AXIS_COUNT], to[AXIS_COUNT];
+    for (int axis = 0; axis < AXIS_COUNT; ++axis) {
+      from[axis] = first[axis];
+      to[axis] = last[axis] + 1;
+    }
+    for (size_t d = 0; d < ndims; ++d) {
+      ZarrAxis axis = image.axes[d];
+      origin[axis] = chunk[d] * array.chunks[d];
+      from[axis] = std::max(from[axis], origin[axis]);
+      to[axis] = std::min(to[axis], std::min(origin[axis] + array.chunks[d], array.shape[d]));
+    }
+
+    // chunks that were never written hold only the fill value
+    const uint8_t* chunkData = nullptr;
+    std::vector<uint8_t>& bytes = compressed[worker];
+    if (readBinaryFile(array.chunkPath(chunk), bytes)) {
+      if (array.compressor.empty()) {
+        chunkData = bytes.size() == chunkBytes ? bytes.data() : nullptr;
+      } else {
+        chunkData = decodeChunk(array, bytes, decoded[worker], chunkBytes) ? decoded[worker].data() : nullptr;
+      }
+      if (!chunkData) {
+        spdlog::error("Zarr chunk {} is damaged", array.chunkPath(chunk));
+        damaged = true;
+        return;
+      }
+    }
+
+    const uint64_t t = from[AXIS_T];
+    const size_t rowLength = size_t(to[AXIS_X] - from[AXIS_X]);
+    for (uint64_t c = from[AXIS_C]; c < to[AXIS_C]; ++c) {
+      if (outputChannel[c] < 0) {
+        continue;
+      }
+      T* channelData = voxels + outputChannel[c] * channelVoxels;
+      for (uint64_t z = from[AXIS_Z]; z < to[AXIS_Z]; ++z) {
+        for (uint64_t y = from[AXIS_Y]; y < to[AXIS_Y]; ++y) {
+          T* dst = channelData + size_t(z - box.minZ) * planeVoxels + size_t(y - box.minY) * box.sizeX() +
+                   size_t(from[AXIS_X] - box.minX);
+          if (!chunkData) {
+            std::fill(dst, dst + rowLength, T(array.fillValue));
+            continue;
+          }
+          size_t element = (t - origin[AXIS_T]) * chunkStride[AXIS_T] + (c - origin[AXIS_C]) * chunkStride[AXIS_C] +
+                           (z - origin[AXIS_Z]) * chunkStride[AXIS_Z] + (y - origin[AXIS_Y]) * chunkStride[AXIS_Y] +
+                           (from[AXIS_X] - origin[AXIS_X]) * chunkStride[AXIS_X];
+          convertElements(
+            array, chunkData + element * array.bytesPerElement, chunkStride[AXIS_X], dst, rowLength);
+        }
+        if (counts) {
+          const T* rows = channelData + size_t(z - box.minZ) * planeVoxels +
+                          size_t(from[AXIS_Y] - box.minY) * box.sizeX() + size_t(from[AXIS_X] - box.minX);
+          counts->addRows(outputChannel[c],
+                          reinterpret_cast<const uint8_t*>(rows),
+                          rowLength,
+                          size_t(to[AXIS_Y] - from[AXIS_Y]),
+                          size_t(box.sizeX()) * sizeof(T));
+        }
+      }
+    }
+    if (control) {
+      control->stepDone();
+    }
+  });
+
+  if (chunksRead) {
+    *chunksRead = chunkIndices.size();
+  }
+  return !damaged && !(control && control->isCancelled());
+}
+
+// Serves one resolution level of an OME-Zarr image to a PagedVolume, reading the chunks under each brick.
+// Bricks are made of whole chunks, so that each chunk is read for one brick only, whatever the chunk shape: e.g.
+// 2 x 1024 x 1024 bricks for chunks of a single 1024 x 1024 plane. Chunks too big for a brick are cut in halves.
+class ZarrBrickSource : public BrickSource
+{
+public:
+  ZarrBrickSource(const ZarrImage& image, const ZarrArray& array, const VolumeDimensions& dims)
+    : m_image(image)
+    , m_array(array)
+    , m_dims(dims)
+  {
+  }
+
+  VolumeDimensions dimensions() const override { return m_dims; }
+  void brickSize(uint32_t& x, uint32_t& y, uint32_t& z) const override
+  {
+    // bricks grow to about MIN_VOXELS by doubling their shortest side, and never hold more than MAX_VOXELS
+    static const uint64_t MIN_VOXELS = 128 * 128 * 128;
+    static const uint64_t MAX_VOXELS = 256 * 256 * 256;
+
+    const ZarrAxis axes[3] = { AXIS_X, AXIS_Y, AXIS_Z };
+    const uint64_t volume[3] = { m_dims.sizeX, m_dims.sizeY, m_dims.sizeZ };
+    uint64_t size[3];
+    for (int i = 0; i < 3; ++i) {
+      int d = m_image.dimensionOf(axes[i]);
+      size[i] = std::min(d >= 0 ? m_array.chunks[d] : 1, volume[i]);
+    }
+    auto voxels = [&]() { return size[0] * size[1] * size[2]; };
+    while (voxels() > MAX_VOXELS) {
+      int longest = int(std::max_element(size, size + 3) - size);
+      size[longest] = (size[longest] + 1) / 2;
+    }
+    while (voxels() < MIN_VOXELS) {
+      int shortest = -1;
+      for (int i = 0; i < 3; ++i) {
+        if (size[i] < volume[i] && (shortest < 0 || size[i] < size[shortest])) {
+          shortest = i;
+        }
+      }
+      if (shortest < 0 || voxels() * 2 > MAX_VOXELS) {
+        break;
+      }
+      size[shortest] *= 2;
+    }
+    // a side that outgrew the volume covers all of it
+    x = (uint32_t)std::min(size[0], volume[0]);
+    y = (uint32_t)std::min(size[1], volume[1]);
+    z = (uint32_t)std::min(size[2], volume[2]);
+  }
+  bool readRegion(uint32_t c, uint32_t t, const VoxelRegion& region, uint16_t* dst) override
+  {
+    if (c >= m_dims.sizeC || t >= m_dims.sizeT || region.isEmpty() || region.maxX > m_dims.sizeX ||
+        region.maxY > m_dims.sizeY || region.maxZ > m_dims.sizeZ) {
+      return false;
+    }
+    // PagedVolume reads bricks in parallel already
+    return readZarrRegion(
+      m_image, m_array, m_dims, (int32_t)t, region, std::vector<uint32_t>(1, c), dst, nullptr, 1, nullptr);
+  }
+
+private:
+  ZarrImage m_image;
+  ZarrArray m_array;
+  VolumeDimensions m_dims;
+};
+
+FileReaderZarr::FileReaderZarr() {}
+
+FileReaderZarr::~FileReaderZarr() {}
+
+bool
+FileReaderZarr::isZarr(const std::string& filepath)
+{
+  std::string path = withoutTrailingSeparator(filepath);
+  std::string lower = path;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  static const std::string ZARR_EXTENSION = ".zarr";
+  bool named = lower.size() >= ZARR_EXTENSION.size() &&
+               lower.compare(lower.size() - ZARR_EXTENSION.size(), ZARR_EXTENSION.size(), ZARR_EXTENSION) == 0;
+  struct stat st;
+  return isDirectory(path) && (named || stat((path + "/.zattrs").c_str(), &st) == 0);
+}
+
+int64_t
+FileReaderZarr::modificationTime(const std::string& filepath, int32_t scene)
+{
+  // A directory's own time only changes as its entries come and go, not as they are rewritten, and chunks may be
+  // nested in directories of their own. So take the newest time of the metadata and of every file under each level.
+  std::string store = withoutTrailingSeparator(filepath);
+  int64_t newest = FileReader::fileModificationTime(store);
+  newest = std::max(newest, FileReader::fileModificationTime(store + "/.zattrs"));
+  ZarrImage image;
+  if (!image.read(sceneDirectory(store, scene))) {
+    return newest;
+  }
+  newest = std::max(newest, FileReader::fileModificationTime(image.directory + "/.zattrs"));
+  for (const std::string& level : image.levels) {
+    newest = std::max(newest, newestModificationTime(image.directory + "/" + level));
+  }
+  return newest;
+}
+
+std::shared_ptr<ImageXYZC>
+FileReaderZarr::loadOMEZarr(const LoadSpec& spec, VolumeDimensions* dims, LoadControl* control)
+{
+  return loadOMEZarr(spec, spec.region, spec.channels, dims, control);
+}
+
+std::shared_ptr<ImageXYZC>
+FileReaderZarr::loadOMEZarr(const LoadSpec& spec,
+                            const VoxelRegion& region,
+                            const std::vector<uint32_t>& channels,
+                            VolumeDimensions* dims,
+                            LoadControl* control)
+{
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  ZarrImage image;
+  ZarrArray array;
+  size_t level;
+  VolumeDimensions levelDims;
+  if (!openZarrLevel(spec, image, array, level, levelDims)) {
+    return nullptr;
+  }
+  if (spec.time < 0 || spec.time >= (int32_t)levelDims.sizeT) {
+    spdlog::error("Time {} is out of range for {} with {} timepoints", spec.time, spec.filepath, levelDims.sizeT);
+    return nullptr;
+  }
+  std::vector<uint32_t> readChannels = channels;
+  if (readChannels.empty()) {
+    for (uint32_t c = 0; c < levelDims.sizeC; ++c) {
+      readChannels.push_back(c);
+    }
+  }
+  for (uint32_t c : readChannels) {
+    if (c >= levelDims.sizeC) {
+      spdlog::error("Channel {} is out of range for {} with {} channels", c, spec.filepath, levelDims.sizeC);
+      return nullptr;
+    }
+  }
+  if (!region.isValid()) {
+    spdlog::error("The requested region of {} is empty; leave it at its default to read the whole volume",
+                  spec.filepath);
+    return nullptr;
+  }
+  VoxelRegion box = region.clampedTo(levelDims.sizeX, levelDims.sizeY, levelDims.sizeZ);
+  if (box.isEmpty()) {
+    spdlog::error("The requested region lies outside of {}", spec.filepath);
+    return nullptr;
+  }
+
+  // 8-bit arrays stay 8-bit in memory
+  const uint32_t bpp = array.bytesPerElement * 8;
+  const size_t channelVoxels = size_t(box.sizeX()) * box.sizeY() * box.sizeZ();
+  uint8_t* data = new uint8_t[channelVoxels * readChannels.size() * array.bytesPerElement];
+  // the channel histograms are gathered while the chunks are decoded, not in another pass afterwards
+  HistogramAccumulator counts((uint32_t)readChannels.size(), bpp);
+  size_t chunksRead = 0;
+  bool read = false;
+  if (bpp == 8) {
+    read = readZarrRegion(image,
+                          array,
+                          levelDims,
+                          spec.time,
+                          box,
+                          readChannels,
+                          data,
+                          &counts,
+                          FileReader::loaderThreadCount(),
+                          control,
+                          &chunksRead);
+  } else {
+    read = readZarrRegion(image,
+                          array,
+                          levelDims,
+                          spec.time,
+                          box,
+                          readChannels,
+                          reinterpret_cast<uint16_t*>(data),
+                          &counts,
+                          FileReader::loaderThreadCount(),
+                          control,
+                          &chunksRead);
+  }
+  if (!read) {
+    if (control && control->isCancelled()) {
+      spdlog::info("Load of {} cancelled", spec.filepath);
+    }
+    delete[] data;
+    return nullptr;
+  }
+
+  VolumeDimensions readDims = levelDims;
+  readDims.sizeX = box.sizeX();
+  readDims.sizeY = box.sizeY();
+  readDims.sizeZ = box.sizeZ();
+  readDims.sizeC = (uint32_t)readChannels.size();
+  readDims.channelNames.clear();
+  for (uint32_t c : readChannels) {
+    readDims.channelNames.push_back(levelDims.channelNames[c]);
+  }
+
+  auto endTime = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> elapsed = endTime - startTime;
+  spdlog::debug("{} zarr chunks of level {} read in {} ms", chunksRead, level, elapsed.count() * 1000.0);
+
+  ImageXYZC* im = new ImageXYZC(readDims.sizeX,
+                                readDims.sizeY,
+                                readDims.sizeZ,
+                                readDims.sizeC,
+                                bpp,
+                                data,
+                                readDims.physicalSizeX,
+                                readDims.physicalSizeY,
+                                readDims.physicalSizeZ,
+                                nullptr,
+                                counts.histograms(),
+                                {});
+  im->setPhysicalOffset(
+    box.minX * readDims.physicalSizeX, box.minY * readDims.physicalSizeY, box.minZ * readDims.physicalSizeZ);
+  im->setChannelNames(readDims.channelNames);
+  if (dims) {
+    *dims = readDims;
+  }
+  return std::shared_ptr<ImageXYZC>(im);
+}
+
+std::shared_ptr<BrickSource>
+FileReaderZarr::openBrickSource(const LoadSpec& spec)
+{
+  ZarrImage image;
+  ZarrArray array;
+  size_t level;
+  VolumeDimensions dims;
+  if (!openZarrLevel(spec, image, array, level, dims)) {
+    return nullptr;
+  }
+  return std::make_shared<ZarrBrickSource>(image, array, dims);
+}
+
+VolumeDimensions
+FileReaderZarr::loadDimensionsZarr(const std::string& filepath, int32_t scene)
+{
+  ZarrImage image;
+  ZarrArray array;
+  size_t level;
+  VolumeDimensions dims;
+  openZarrLevel(LoadSpec(filepath, 0, scene), image, array, level, dims);
+  return dims;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "graphics/volumeDimensions.h"
+#include "loadSpec.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class BrickSource;
+class ImageXYZC;
+class LoadControl;
+
+// Reads OME-Zarr images (NGFF 0.1 to 0.4, on zarr format 2) from directory stores on a local disk.
+// The resolution level comes from the multiscales metadata and the LoadSpec; the chunks that hold the requested
+// timepoint, channels and region are read and decompressed in parallel, and no others are touched.
+// Stores written by bioformats2raw hold one image per scene. Chunks may be uncompressed or compressed with zlib, gzip
+// or blosc, and hold 8 or 16-bit unsigned integers.
+class FileReaderZarr
+{
+public:
+  FileReaderZarr();
+  virtual ~FileReaderZarr();
+
+  static std::shared_ptr<ImageXYZC> loadOMEZarr(const LoadSpec& spec,
+                                                VolumeDimensions* dims = nullptr,
+                                                LoadControl* control = nullptr);
+  // Reads the voxels in region (in the coordinates of the chosen resolution level) of the given channels
+  // (all of them if channels is empty). dims describes the result: the size of the region, and the channels read.
+  static std::shared_ptr<ImageXYZC> loadOMEZarr(const LoadSpec& spec,
+                                                const VoxelRegion& region,
+                                                const std::vector<uint32_t>& channels,
+                                                VolumeDimensions* dims = nullptr,
+                                                LoadControl* control = nullptr);
+  // Opens the scene and resolution level of spec for reading brick by brick, e.g. into a PagedVolume.
+  static std::shared_ptr<BrickSource> openBrickSource(const LoadSpec& spec);
+  // dimensions of one scene at full resolution
+  static VolumeDimensions loadDimensionsZarr(const std::string& filepath, int32_t scene = 0);
+
+  // whether a path is the directory of a zarr store
+  static bool isZarr(const std::string& filepath);
+  // When a scene of a store was last modified, in seconds since the epoch: the newest time of its metadata and of
+  // every file and directory of its resolution levels, so that rewritten chunks count too. This visits each chunk.
+  static int64_t modificationTime(const std::string& filepath, int32_t scene = 0);
+};
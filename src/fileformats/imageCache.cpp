@@ -0,0 +1,387 @@
+#include "imageCache.h"
+
+#include "fileReader.h"
+#include "fileReaderZarr.h"
+#include "graphics/imageXYZC.h"
+#include "loadControl.h"
+
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <tuple>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+ImageCache::Key::Key(const LoadSpec& spec)
+  : filepath(spec.filepath)
+  , modified(FileReaderZarr::isZarr(spec.filepath) ? FileReaderZarr::modificationTime(spec.filepath, spec.scene)
+                                                   : FileReader::fileModificationTime(spec.filepath))
+  , time(spec.time)
+  , scene(spec.scene)
+  , level(spec.level)
+  , maxDimension(spec.maxDimension)
+  , region(spec.region)
+  , channels(spec.channels)
+  , valueMin(spec.valueMin)
+  , valueMax(spec.valueMax)
+{
+}
+
+bool
+ImageCache::Key::operator<(const Key& other) const
+{
+  return std::tie(filepath, modified, time, scene, level, maxDimension, region, channels, valueMin, valueMax) <
+         std::tie(other.filepath,
+                  other.modified,
+                  other.time,
+                  other.scene,
+                  other.level,
+                  other.maxDimension,
+                  other.region,
+                  other.channels,
+                  other.valueMin,
+                  other.valueMax);
+}
+
+ImageCache::ImageCache(size_t budget)
+  : m_bytes(0)
+  , m_budget(budget > 0 ? budget : defaultBudget())
+  , m_clock(0)
+  , m_hits(0)
+  , m_misses(0)
+  , m_evictions(0)
+  , m_sharedLoads(0)
+{
+}
+
+ImageCache::Shard&
+ImageCache::shardFor(const Key& key)
+{
+  size_t hash = std::hash<std::string>()(key.filepath);
+  hash = hash * 31 + std::hash<int64_t>()(key.modified);
+  hash = hash * 31 + std::hash<int32_t>()(key.time);
+  hash = hash * 31 + std::hash<int32_t>()(key.scene);
+  hash = hash * 31 + std::hash<uint32_t>()(key.level);
+  hash = hash * 31 + std::hash<uint32_t>()(key.maxDimension);
+  const VoxelRegion& r = key.region;
+  for (uint32_t bound : { r.minX, r.minY, r.minZ, r.maxX, r.maxY, r.maxZ }) {
+    hash = hash * 31 + std::hash<uint32_t>()(bound);
+  }
+  for (uint32_t channel : key.channels) {
+    hash = hash * 31 + std::hash<uint32_t>()(channel);
+  }
+  return m_shards[hash % SHARD_COUNT];
+}
+
+// call with shard.mutex held
+std::shared_ptr<ImageXYZC>
+ImageCache::findLocked(Shard& shard, const Key& key, VolumeDimensions* dims)
+{
+  auto found = shard.index.find(key);
+  if (found == shard.index.end()) {
+    return nullptr;
+  }
+  shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+  found->second->used = ++m_clock;
+  if (dims) {
+    *dims = found->second->dims;
+  }
+  return found->second->image;
+}
+
+// call with shard.mutex held
+void
+ImageCache::eraseLocked(Shard& shard, const Key& key)
+{
+  auto found = shard.index.find(key);
+  if (found != shard.index.end()) {
+    m_bytes -= found->second->bytes;
+    shard.entries.erase(found->second);
+    shard.index.erase(found);
+  }
+}
+
+std::shared_ptr<ImageXYZC>
+ImageCache::find(const Key& key, VolumeDimensions* dims)
+{
+  Shard& shard = shardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  std::shared_ptr<ImageXYZC> image = findLocked(shard, key, dims);
+  if (image) {
+    m_hits++;
+  } else {
+    m_misses++;
+  }
+  return image;
+}
+
+std::shared_ptr<ImageXYZC>
+ImageCache::findOrLoad(const Key& key,
+                       VolumeDimensions* dims,
+                       const Loader& load,
+                       bool keep,
+                       LoadControl* control)
+{
+  Shard& shard = shardFor(key);
+  std::promise<Loaded> promise;
+  std::shared_future<Loaded> loading;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    std::shared_ptr<ImageXYZC> image = findLocked(shard, key, dims);
+    if (image) {
+      m_hits++;
+      return image;
+    }
+    auto inProgress = shard.loading.find(key);
+    if (inProgress != shard.loading.end()) {
+      loading = inProgress->second;
+    } else {
+      m_misses++;
+      shard.loading[key] = promise.get_future().share();
+    }
+  }
+
+  if (loading.valid()) {
+    m_sharedLoads++;
+    while (loading.wait_for(std::chrono::milliseconds(20)) != std::future_status::ready) {
+      if (control && control->isCancelled()) {
+        return nullptr;
+      }
+    }
+    // rethrows if the load threw
+    const Loaded& loaded = loading.get();
+    if (loaded.cancelled) {
+      return findOrLoad(key, dims, load, keep, control);
+    }
+    if (!loaded.image) {
+      return nullptr;
+    }
+    if (keep) {
+      insert(key, loaded.image, loaded.dims);
+    }
+    if (dims) {
+      *dims = loaded.dims;
+    }
+    return loaded.image;
+  }
+
+  Loaded loaded;
+  try {
+    loaded.image = load(&loaded.dims);
+    loaded.cancelled = !loaded.image && control && control->isCancelled();
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.loading.erase(key);
+    }
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+  // cache the image before it stops being in progress, so that a request in between can't miss both
+  if (keep && loaded.image) {
+    insert(key, loaded.image, loaded.dims);
+  }
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.loading.erase(key);
+  }
+  promise.set_value(loaded);
+  if (dims) {
+    *dims = loaded.dims;
+  }
+  return loaded.image;
+}
+
+void
+ImageCache::insert(const Key& key, std::shared_ptr<ImageXYZC> image, const VolumeDimensions& dims)
+{
+  if (!image) {
+    return;
+  }
+  size_t bytes = image->size();
+  Shard& shard = shardFor(key);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    eraseLocked(shard, key);
+    if (bytes > m_budget) {
+      spdlog::debug("Not caching {}: {} bytes exceeds the cache budget of {} bytes", key.filepath, bytes, budget());
+      return;
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.image = image;
+    entry.dims = dims;
+    entry.bytes = bytes;
+    entry.used = ++m_clock;
+    shard.entries.push_front(entry);
+    shard.index[key] = shard.entries.begin();
+    m_bytes += bytes;
+  }
+  evict(m_budget);
+}
+
+void
+ImageCache::erase(const Key& key)
+{
+  Shard& shard = shardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  eraseLocked(shard, key);
+}
+
+void
+ImageCache::clear()
+{
+  for (Shard& shard : m_shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (const Entry& entry : shard.entries) {
+      m_bytes -= entry.bytes;
+    }
+    shard.entries.clear();
+    shard.index.clear();
+  }
+}
+
+void
+ImageCache::setBudget(size_t budget)
+{
+  m_budget = budget;
+  evict(budget);
+}
+
+size_t
+ImageCache::budget() const
+{
+  return m_budget;
+}
+
+ImageCache::Stats
+ImageCache::stats() const
+{
+  Stats stats;
+  stats.hits = m_hits;
+  stats.misses = m_misses;
+  stats.evictions = m_evictions;
+  stats.sharedLoads = m_sharedLoads;
+  for (const Shard& shard : m_shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    stats.entries += shard.entries.size();
+  }
+  stats.bytes = m_bytes;
+  stats.budget = m_budget;
+  return stats;
+}
+
+void
+ImageCache::resetStats()
+{
+  m_hits = 0;
+  m_misses = 0;
+  m_evictions = 0;
+  m_sharedLoads = 0;
+}
+
+// Evicts the least recently used entries of the whole cache. Shards are locked one at a time, never two at once,
+// so a shard can change between finding its oldest entry and evicting it; the order is then only nearly LRU.
+void
+ImageCache::evict(size_t budget)
+{
+  while (m_bytes > budget) {
+    Shard* oldestShard = nullptr;
+    uint64_t oldest = UINT64_MAX;
+    for (Shard& shard : m_shards) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      if (!shard.entries.empty() && shard.entries.back().used < oldest) {
+        oldest = shard.entries.back().used;
+        oldestShard = &shard;
+      }
+    }
+    if (!oldestShard) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(oldestShard->mutex);
+    if (oldestShard->entries.empty() || m_bytes <= budget) {
+      continue;
+    }
+    const Entry& evicted = oldestShard->entries.back();
+    spdlog::debug(
+      "Evicting {} (T={}, scene {}) from the image cache", evicted.key.filepath, evicted.key.time, evicted.key.scene);
+    m_bytes -= evicted.bytes;
+    oldestShard->index.erase(evicted.key);
+    oldestShard->entries.pop_back();
+    m_evictions++;
+  }
+}
+
+size_t
+ImageCache::defaultBudget()
+{
+  return memoryLimit() / 2;
+}
+
+static uint64_t
+physicalMemorySize()
+{
+#ifdef _WIN32
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (GlobalMemoryStatusEx(&status)) {
+    return status.ullTotalPhys;
+  }
+  return 0;
+#else
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long pageSize = sysconf(_SC_PAGESIZE);
+  return (pages > 0 && pageSize > 0) ? (uint64_t)pages * (uint64_t)pageSize : 0;
+#endif
+}
+
+// The limit in a cgroup v2 memory.max or v1 memory.limit_in_bytes file, or 0 if there is none.
+// Inside a container the cgroup namespace puts the process's own cgroup at /sys/fs/cgroup.
+static uint64_t
+cgroupMemoryLimit()
+{
+  static const char* limitFiles[] = { "/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes" };
+  for (const char* limitFile : limitFiles) {
+    std::ifstream in(limitFile);
+    std::string value;
+    if (!(in >> value)) {
+      continue;
+    }
+    // "max" in v2 means no limit; v1 reports no limit as a huge number instead
+    if (value == "max") {
+      return 0;
+    }
+    try {
+      return std::stoull(value);
+    } catch (...) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+size_t
+ImageCache::memoryLimit()
+{
+  // fall back on 8GB if even the physical memory size is unknown
+  uint64_t limit = physicalMemorySize();
+  if (limit == 0) {
+    limit = uint64_t(8) << 30;
+  }
+  uint64_t cgroupLimit = cgroupMemoryLimit();
+  if (cgroupLimit > 0 && cgroupLimit < limit) {
+    limit = cgroupLimit;
+  }
+  return (size_t)std::min<uint64_t>(limit, SIZE_MAX);
+}
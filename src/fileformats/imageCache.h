@@ -0,0 +1,144 @@
+#pragma once
+
+#include "graphics/volumeDimensions.h"
+#include "loadSpec.h"
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <inttypes.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class ImageXYZC;
+class LoadControl;
+
+// Keeps recently loaded volumes in memory, up to a budget in bytes, discarding the least recently used ones first.
+// An entry is one timepoint of one scene at one resolution level of a file (or a region or some channels of it), as it
+// was when loaded:
+// rewriting the file changes its modification time and so misses the stale entry.
+// Thread-safe. Entries are spread over shards with a lock each, so that lookups of different volumes don't queue
+// behind one another, and concurrent requests for the same volume share a single load (see findOrLoad).
+class ImageCache
+{
+public:
+  struct Key
+  {
+    std::string filepath;
+    // seconds since the epoch, 0 for names that aren't files (e.g. arrays handed over in memory)
+    int64_t modified = 0;
+    int32_t time = 0;
+    int32_t scene = 0;
+    uint32_t level = 0;
+    uint32_t maxDimension = 0;
+    VoxelRegion region;
+    std::vector<uint32_t> channels;
+    double valueMin = 0.0;
+    double valueMax = 0.0;
+
+    Key() {}
+    // looks up the file's modification time, or a zarr store's (see FileReaderZarr::modificationTime)
+    explicit Key(const LoadSpec& spec);
+
+    bool operator<(const Key& other) const;
+  };
+
+  struct Stats
+  {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    // requests that found the volume already being loaded and waited for that load instead of starting another
+    uint64_t sharedLoads = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+    size_t budget = 0;
+  };
+
+  // loads a volume that isn't cached, filling in dims; returns empty on failure
+  typedef std::function<std::shared_ptr<ImageXYZC>(VolumeDimensions* dims)> Loader;
+
+  // budget 0 means defaultBudget()
+  ImageCache(size_t budget = 0);
+
+  // The cached volume, marked as most recently used, or empty (a miss) if there is none.
+  // dims, if given, receives the dimensions it was loaded with.
+  std::shared_ptr<ImageXYZC> find(const Key& key, VolumeDimensions* dims = nullptr);
+  // As find, but on a miss calls load, and adds the result if keep is set.
+  // Only the first of several concurrent requests for a key loads it; the others wait for that load and get the same
+  // image. A waiter stops waiting, returning empty, once its control is cancelled. Should the load be cancelled by its
+  // own requester, a waiter loads the volume itself; should it fail, every waiter returns empty too, rather than
+  // failing the same way again one after another.
+  // Exceptions thrown by load reach the requester that called it and any waiters.
+  std::shared_ptr<ImageXYZC> findOrLoad(const Key& key,
+                                        VolumeDimensions* dims,
+                                        const Loader& load,
+                                        bool keep,
+                                        LoadControl* control = nullptr);
+  // Adds or replaces an entry, then evicts least recently used entries until the cache fits its budget.
+  // A volume bigger than the whole budget is not kept.
+  void insert(const Key& key, std::shared_ptr<ImageXYZC> image, const VolumeDimensions& dims);
+  void erase(const Key& key);
+  void clear();
+
+  // shrinking the budget evicts right away
+  void setBudget(size_t budget);
+  size_t budget() const;
+
+  Stats stats() const;
+  void resetStats();
+
+  // Half of memoryLimit(), leaving the rest for rendering and for the load in progress.
+  static size_t defaultBudget();
+  // The memory limit of the cgroup the process runs in (as in a container), or else the physical memory size.
+  static size_t memoryLimit();
+
+private:
+  struct Entry
+  {
+    Key key;
+    std::shared_ptr<ImageXYZC> image;
+    VolumeDimensions dims;
+    size_t bytes;
+    // when last used, in ticks of m_clock; lets eviction compare entries across shards
+    uint64_t used;
+  };
+  typedef std::list<Entry> EntryList;
+
+  struct Loaded
+  {
+    std::shared_ptr<ImageXYZC> image;
+    VolumeDimensions dims;
+    // empty because the requester that loaded it cancelled, not because it can't be loaded
+    bool cancelled = false;
+  };
+
+  struct Shard
+  {
+    mutable std::mutex mutex;
+    // most recently used first
+    EntryList entries;
+    std::map<Key, EntryList::iterator> index;
+    // loads in progress
+    std::map<Key, std::shared_future<Loaded>> loading;
+  };
+  static const size_t SHARD_COUNT = 16;
+
+  Shard& shardFor(const Key& key);
+  std::shared_ptr<ImageXYZC> findLocked(Shard& shard, const Key& key, VolumeDimensions* dims);
+  void eraseLocked(Shard& shard, const Key& key);
+  void evict(size_t budget);
+
+  std::array<Shard, SHARD_COUNT> m_shards;
+  std::atomic<size_t> m_bytes;
+  std::atomic<size_t> m_budget;
+  std::atomic<uint64_t> m_clock;
+  std::atomic<uint64_t> m_hits;
+  std::atomic<uint64_t> m_misses;
+  std::atomic<uint64_t> m_evictions;
+  std::atomic<uint64_t> m_sharedLoads;
+};
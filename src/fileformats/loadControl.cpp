@@ -0,0 +1,52 @@
+#include "loadControl.h"
+
+LoadControl::LoadControl(ProgressCallback progress)
+  : m_cancelled(false)
+  , m_done(0)
+  , m_total(0)
+  , m_progress(progress)
+{
+}
+
+void
+LoadControl::cancel()
+{
+  m_cancelled = true;
+}
+
+bool
+LoadControl::isCancelled() const
+{
+  return m_cancelled;
+}
+
+void
+LoadControl::setTotal(uint32_t total)
+{
+  m_done = 0;
+  m_total = total;
+}
+
+void
+LoadControl::stepDone(uint32_t steps)
+{
+  m_done += steps;
+  if (m_progress) {
+    // read the count under the lock: a count taken before it could be overtaken by another thread's, and reported
+    // after it, going backwards
+    std::lock_guard<std::mutex> lock(m_progressMutex);
+    m_progress(m_done, m_total);
+  }
+}
+
+uint32_t
+LoadControl::done() const
+{
+  return m_done;
+}
+
+uint32_t
+LoadControl::total() const
+{
+  return m_total;
+}
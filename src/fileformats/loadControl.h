@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <inttypes.h>
+#include <mutex>
+
+// Lets the caller of a load follow its progress and cancel it, typically from another thread.
+// Readers count progress in steps (planes, or parts of planes for very large ones) and check
+// for cancellation between steps.
+class LoadControl
+{
+public:
+  // Called with the number of steps done so far and the total, from whichever thread finished a step.
+  // Calls never overlap and the count never goes backwards, but they may come from any thread, including the caller's.
+  typedef std::function<void(uint32_t done, uint32_t total)> ProgressCallback;
+
+  LoadControl(ProgressCallback progress = nullptr);
+
+  // Ask the load to stop. It returns an empty image as soon as it next checks.
+  void cancel();
+  bool isCancelled() const;
+
+  // for readers: announce the number of steps ahead, then report each one as it completes
+  void setTotal(uint32_t total);
+  void stepDone(uint32_t steps = 1);
+
+  uint32_t done() const;
+  uint32_t total() const;
+
+private:
+  std::atomic<bool> m_cancelled;
+  std::atomic<uint32_t> m_done;
+  std::atomic<uint32_t> m_total;
+  ProgressCallback m_progress;
+  std::mutex m_progressMutex;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "graphics/voxelRegion.h"
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+// Selects what to read out of an image file
+struct LoadSpec
+{
+  std::string filepath;
+  int32_t scene = 0;
+  int32_t time = 0;
+
+  // Resolution level to read, for files that store downsampled pyramid layers:
+  // 0 is full resolution, each level above it is the next smaller layer present in the file.
+  // Levels past the smallest layer read the smallest layer.
+  uint32_t level = 0;
+  // If nonzero, overrides level: read the largest level whose X and Y sizes both fit within maxDimension,
+  // or the smallest level if none fits.
+  uint32_t maxDimension = 0;
+  // The box of voxels to read, in the coordinates of the chosen resolution level; the default box reads the whole
+  // volume, and any other empty box fails the load. Readers touch only the parts of the file that hold it, and return
+  // an image of just the box, placed at its physical offset in the volume.
+  VoxelRegion region;
+  // The channels to read, in the order they take in the image; empty (the default) reads all of them.
+  // Decoding time and memory scale with the channels read. FileReader::addChannels reads more of them later.
+  std::vector<uint32_t> channels;
+  // For files of 32-bit pixels (unsigned integers or floats), which are scaled to 16 bits: the range of values that
+  // maps onto [0, 65535]. Give every load of a file the same range for values that compare across timepoints and
+  // regions. If valueMin >= valueMax (the default), the range is the file's SMinSampleValue and SMaxSampleValue, for
+  // TIFF files that have them, or else that of the values read. Either way, VolumeDimensions::valueOffsets and
+  // valueScales map the 16-bit values back.
+  double valueMin = 0.0;
+  double valueMax = 0.0;
+
+  bool hasValueRange() const { return valueMin < valueMax; }
+
+  // the channels to read out of a volume of sizeC channels, or empty if any of channels is out of range
+  std::vector<uint32_t> channelsToRead(uint32_t sizeC) const
+  {
+    std::vector<uint32_t> read = channels;
+    if (read.empty()) {
+      for (uint32_t c = 0; c < sizeC; ++c) {
+        read.push_back(c);
+      }
+    }
+    for (uint32_t c : read) {
+      if (c >= sizeC) {
+        return std::vector<uint32_t>();
+      }
+    }
+    return read;
+  }
+
+  LoadSpec() {}
+  LoadSpec(const std::string& path, int32_t t = 0, int32_t s = 0)
+    : filepath(path)
+    , scene(s)
+    , time(t)
+  {
+  }
+};
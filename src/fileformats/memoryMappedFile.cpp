@@ -0,0 +1,96 @@
+#include "memoryMappedFile.h"
+
+#include "spdlog/spdlog.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MemoryMappedFile::MemoryMappedFile(const std::string& filepath)
+{
+  m_file = CreateFileA(filepath.c_str(),
+                       GENERIC_READ,
+                       FILE_SHARE_READ,
+                       nullptr,
+                       OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                       nullptr);
+  if (m_file == INVALID_HANDLE_VALUE) {
+    m_file = nullptr;
+    spdlog::error("Failed to open {} for memory mapping", filepath);
+    return;
+  }
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(m_file, &fileSize) || fileSize.QuadPart == 0) {
+    spdlog::error("Failed to get size of {} for memory mapping", filepath);
+    return;
+  }
+  m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+  if (!m_mapping) {
+    spdlog::error("Failed to memory map {}", filepath);
+    return;
+  }
+  m_data = reinterpret_cast<uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, 0));
+  if (!m_data) {
+    spdlog::error("Failed to memory map {}", filepath);
+    return;
+  }
+  m_size = fileSize.QuadPart;
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+  if (m_data) {
+    UnmapViewOfFile(m_data);
+  }
+  if (m_mapping) {
+    CloseHandle(m_mapping);
+  }
+  if (m_file) {
+    CloseHandle(m_file);
+  }
+}
+
+#else
+
+MemoryMappedFile::MemoryMappedFile(const std::string& filepath)
+{
+  int fd = open(filepath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    spdlog::error("Failed to open {} for memory mapping", filepath);
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    spdlog::error("Failed to get size of {} for memory mapping", filepath);
+    close(fd);
+    return;
+  }
+  void* ptr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    spdlog::error("Failed to memory map {}", filepath);
+    return;
+  }
+  m_data = reinterpret_cast<uint8_t*>(ptr);
+  m_size = st.st_size;
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+  if (m_data) {
+    munmap(m_data, m_size);
+  }
+}
+
+#endif
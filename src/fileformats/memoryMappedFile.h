@@ -0,0 +1,28 @@
+#pragma once
+
+#include <inttypes.h>
+#include <string>
+
+// A whole file mapped into memory. The file itself is never modified.
+// Pages are mapped copy-on-write: writes through data() are private to this process and never reach the file.
+class MemoryMappedFile
+{
+public:
+  MemoryMappedFile(const std::string& filepath);
+  ~MemoryMappedFile();
+
+  MemoryMappedFile(const MemoryMappedFile&) = delete;
+  MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+  bool isOpen() const { return m_data != nullptr; }
+  uint8_t* data() const { return m_data; }
+  uint64_t size() const { return m_size; }
+
+private:
+  uint8_t* m_data = nullptr;
+  uint64_t m_size = 0;
+#ifdef _WIN32
+  void* m_file = nullptr;
+  void* m_mapping = nullptr;
+#endif
+};
@@ -0,0 +1,118 @@
+#include "timelinePrefetcher.h"
+
+#include "graphics/timeline.h"
+#include "loadControl.h"
+
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+
+TimelinePrefetcher::TimelinePrefetcher(const LoadSpec& spec, uint32_t lookahead)
+  : m_spec(spec)
+  , m_lookahead(lookahead)
+{
+  m_thread = std::thread(&TimelinePrefetcher::run, this);
+}
+
+TimelinePrefetcher::~TimelinePrefetcher()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+    m_queue.clear();
+    if (m_loadingControl) {
+      m_loadingControl->cancel();
+    }
+  }
+  m_changed.notify_all();
+  m_thread.join();
+}
+
+void
+TimelinePrefetcher::update(const Timeline& timeline)
+{
+  std::vector<int32_t> upcoming = timeline.upcomingTimes(m_lookahead);
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_wanted = std::set<int32_t>(upcoming.begin(), upcoming.end());
+    m_wanted.insert(timeline.currentTime());
+    for (auto it = m_held.begin(); it != m_held.end();) {
+      if (m_wanted.count(it->first) == 0) {
+        it = m_held.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if (m_loading && m_wanted.count(m_loadingTime) == 0) {
+      spdlog::debug("Cancelling prefetch of time {}", m_loadingTime);
+      m_loadingControl->cancel();
+    }
+
+    m_queue.clear();
+    for (int32_t t : upcoming) {
+      bool inProgress = m_loading && m_loadingTime == t;
+      if (m_held.count(t) == 0 && !inProgress) {
+        m_queue.push_back(t);
+      }
+    }
+  }
+  m_changed.notify_all();
+}
+
+std::shared_ptr<ImageXYZC>
+TimelinePrefetcher::get(int32_t time, VolumeDimensions* dims)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // needed now: load it here rather than wait for its turn on the background thread
+    auto queued = std::find(m_queue.begin(), m_queue.end(), time);
+    if (queued != m_queue.end()) {
+      m_queue.erase(queued);
+    }
+  }
+
+  // a cache hit if it was prefetched; if it is being prefetched, the cache shares that load
+  LoadSpec spec = m_spec;
+  spec.time = time;
+  std::shared_ptr<ImageXYZC> image = FileReader::loadFromFile(spec, dims, true);
+  if (image) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_wanted.count(time)) {
+      m_held[time] = image;
+    }
+  }
+  return image;
+}
+
+void
+TimelinePrefetcher::run()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_changed.wait(lock, [&]() { return m_stop || !m_queue.empty(); });
+    if (m_stop) {
+      return;
+    }
+
+    LoadSpec spec = m_spec;
+    spec.time = m_queue.front();
+    m_queue.pop_front();
+    m_loading = true;
+    m_loadingTime = spec.time;
+    m_loadingControl = std::make_shared<LoadControl>();
+    std::shared_ptr<LoadControl> control = m_loadingControl;
+
+    lock.unlock();
+    std::shared_ptr<ImageXYZC> image = FileReader::loadFromFile(spec, nullptr, true, control.get());
+    lock.lock();
+
+    if (image && !control->isCancelled() && m_wanted.count(spec.time)) {
+      m_held[spec.time] = image;
+      spdlog::debug("Prefetched time {} of {}", spec.time, spec.filepath);
+    }
+    m_loading = false;
+    m_loadingControl.reset();
+    m_changed.notify_all();
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "fileReader.h"
+#include "loadSpec.h"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+class ImageXYZC;
+class LoadControl;
+class Timeline;
+
+// Loads the timepoints that playback is about to reach into the image cache on a background thread, so that stepping
+// through a time series finds each volume already in memory instead of stalling on a load from scratch.
+// Timepoints are loaded one after another, nearest first, each one using all the loader threads. The volumes of the
+// current and upcoming timepoints are held, so that the cache can't free them while they are wanted; the cache
+// evicts the others in its own time.
+// Nothing watches a Timeline on its own: whoever moves the timeline (the app) calls update() after each move.
+// Not thread-safe: call update() and get() from one thread, typically the one driving the timeline.
+class TimelinePrefetcher
+{
+public:
+  // spec selects the file, scene and resolution level; its time is ignored.
+  // lookahead is how many upcoming timepoints to keep loaded.
+  TimelinePrefetcher(const LoadSpec& spec, uint32_t lookahead = 2);
+  // cancels any load in progress and waits for it to stop
+  ~TimelinePrefetcher();
+
+  // Call whenever the timeline moves or changes direction or wrap mode.
+  // Queues the upcoming timepoints that aren't loaded yet, cancels a load that is no longer upcoming, and frees
+  // volumes that are neither current nor upcoming.
+  void update(const Timeline& timeline);
+
+  // The volume at a time, through the image cache: returns at once if it was prefetched, waits if it is being
+  // prefetched, and otherwise loads it right away on the calling thread.
+  std::shared_ptr<ImageXYZC> get(int32_t time, VolumeDimensions* dims = nullptr);
+
+private:
+  void run();
+
+  LoadSpec m_spec;
+  uint32_t m_lookahead;
+
+  std::mutex m_mutex;
+  std::condition_variable m_changed;
+  // times waiting to be loaded, nearest first
+  std::deque<int32_t> m_queue;
+  // the current and upcoming times as of the last update()
+  std::set<int32_t> m_wanted;
+  // volumes of wanted times that have been loaded, held so that they stay cached
+  std::map<int32_t, std::shared_ptr<ImageXYZC>> m_held;
+  // the load in progress on the background thread, if any
+  bool m_loading = false;
+  int32_t m_loadingTime = 0;
+  std::shared_ptr<LoadControl> m_loadingControl;
+  bool m_stop = false;
+
+  std::thread m_thread;
+};
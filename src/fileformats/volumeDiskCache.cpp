@@ -0,0 +1,497 @@
+#include "volumeDiskCache.h"
+
+#include "binaryStream.h"
+#include "memoryMappedFile.h"
+
+#include "graphics/histogram.h"
+#include "graphics/imageXYZC.h"
+
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#include <sys/utime.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+const uint64_t VolumeDiskCache::DEFAULT_BUDGET = uint64_t(16) << 30;
+
+static const char ENTRY_MAGIC[8] = { 'A', 'G', 'A', 'V', 'E', 'V', 'O', 'L' };
+static const uint32_t ENTRY_VERSION = 5;
+// reads back differently on a machine of the other byte order
+static const uint32_t ENTRY_BYTE_ORDER = 0x01020304;
+// magic, version, byte order, data offset, data size
+static const size_t ENTRY_PREFIX_SIZE = 8 + 4 + 4 + 8 + 8;
+// the data starts on a page boundary of any system, so that it can be used straight out of a memory mapping
+static const uint64_t ENTRY_DATA_ALIGNMENT = 65536;
+static const size_t LUT_LENGTH = 256;
+static const char* ENTRY_EXTENSION = ".agavevol";
+
+static void
+putKey(BinaryWriter& writer, const ImageCache::Key& key)
+{
+  writer.putString(key.filepath);
+  writer.put(key.modified);
+  writer.put(key.time);
+  writer.put(key.scene);
+  writer.put(key.level);
+  writer.put(key.maxDimension);
+  writer.put(key.region.minX);
+  writer.put(key.region.minY);
+  writer.put(key.region.minZ);
+  writer.put(key.region.maxX);
+  writer.put(key.region.maxY);
+  writer.put(key.region.maxZ);
+  writer.putArray(key.channels.data(), uint32_t(key.channels.size()));
+  writer.put(key.valueMin);
+  writer.put(key.valueMax);
+}
+
+static bool
+getKey(BinaryReader& reader, ImageCache::Key& key)
+{
+  return reader.getString(key.filepath) && reader.get(key.modified) && reader.get(key.time) &&
+         reader.get(key.scene) && reader.get(key.level) && reader.get(key.maxDimension) &&
+         reader.get(key.region.minX) && reader.get(key.region.minY) && reader.get(key.region.minZ) &&
+         reader.get(key.region.maxX) && reader.get(key.region.maxY) && reader.get(key.region.maxZ) &&
+         reader.getArray(key.channels) && reader.get(key.valueMin) && reader.get(key.valueMax);
+}
+
+// FNV-1a: unlike std::hash, stable across compilers and runs, which file names on disk need
+static uint64_t
+stableHash(const std::string& bytes)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (char c : bytes) {
+    hash ^= uint8_t(c);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// creates a directory and any missing parents
+static bool
+makeDirectories(const std::string& directory)
+{
+  for (size_t pos = 0; pos != std::string::npos;) {
+    pos = directory.find_first_of("/\\", pos + 1);
+    std::string partial = directory.substr(0, pos);
+    if (partial.empty() || partial.back() == ':') {
+      continue;
+    }
+#ifdef _WIN32
+    _mkdir(partial.c_str());
+#else
+    mkdir(partial.c_str(), 0755);
+#endif
+  }
+  struct stat st;
+  return stat(directory.c_str(), &st) == 0 && (st.st_mode & S_IFDIR);
+}
+
+static int
+currentProcessId()
+{
+#ifdef _WIN32
+  return _getpid();
+#else
+  return (int)getpid();
+#endif
+}
+
+// flushes a file's data from the system's cache to the disk
+static bool
+syncFile(std::FILE* file)
+{
+#ifdef _WIN32
+  return _commit(_fileno(file)) == 0;
+#else
+  return fsync(fileno(file)) == 0;
+#endif
+}
+
+// sets a file's modification time to now
+static void
+touchFile(const std::string& path)
+{
+#ifdef _WIN32
+  _utime(path.c_str(), nullptr);
+#else
+  utime(path.c_str(), nullptr);
+#endif
+}
+
+struct EntryFile
+{
+  std::string path;
+  uint64_t size;
+  // in the platform's finest unit, so that entries written within the same second still sort by age
+  int64_t modified;
+};
+
+// the entry files in a directory, leaving out temporary files being written
+static std::vector<EntryFile>
+listEntries(const std::string& directory)
+{
+  std::vector<EntryFile> entries;
+#ifdef _WIN32
+  WIN32_FIND_DATAA found;
+  HANDLE search = FindFirstFileA((directory + "/*" + ENTRY_EXTENSION).c_str(), &found);
+  if (search == INVALID_HANDLE_VALUE) {
+    return entries;
+  }
+  do {
+    if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      entries.push_back(EntryFile{ directory + "/" + found.cFileName,
+                                   (uint64_t(found.nFileSizeHigh) << 32) | found.nFileSizeLow,
+                                   int64_t((uint64_t(found.ftLastWriteTime.dwHighDateTime) << 32) |
+                                           found.ftLastWriteTime.dwLowDateTime) });
+    }
+  } while (FindNextFileA(search, &found));
+  FindClose(search);
+#else
+  DIR* dir = opendir(directory.c_str());
+  if (!dir) {
+    return entries;
+  }
+  const size_t extensionLength = strlen(ENTRY_EXTENSION);
+  while (struct dirent* found = readdir(dir)) {
+    std::string name = found->d_name;
+    if (name.size() <= extensionLength ||
+        name.compare(name.size() - extensionLength, extensionLength, ENTRY_EXTENSION) != 0) {
+      continue;
+    }
+    std::string path = directory + "/" + name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+#ifdef __APPLE__
+      const struct timespec& modified = st.st_mtimespec;
+#else
+      const struct timespec& modified = st.st_mtim;
+#endif
+      entries.push_back(
+        EntryFile{ path, uint64_t(st.st_size), int64_t(modified.tv_sec) * 1000000000 + int64_t(modified.tv_nsec) });
+    }
+  }
+  closedir(dir);
+#endif
+  return entries;
+}
+
+VolumeDiskCache::VolumeDiskCache(const std::string& directory, uint64_t budget)
+  : m_directory(directory)
+  , m_budget(budget)
+{
+}
+
+VolumeDiskCache::~VolumeDiskCache()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_queueMutex);
+    m_stopping = true;
+    m_queue.clear();
+  }
+  m_queueChanged.notify_all();
+  if (m_writer.joinable()) {
+    m_writer.join();
+  }
+}
+
+void
+VolumeDiskCache::setBudget(uint64_t bytes)
+{
+  m_budget = bytes;
+}
+
+uint64_t
+VolumeDiskCache::budget() const
+{
+  return m_budget;
+}
+
+std::string
+VolumeDiskCache::entryPath(const ImageCache::Key& key) const
+{
+  BinaryWriter writer;
+  putKey(writer, key);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx%s", (unsigned long long)stableHash(writer.bytes()), ENTRY_EXTENSION);
+  return m_directory + "/" + name;
+}
+
+std::shared_ptr<ImageXYZC>
+VolumeDiskCache::load(const ImageCache::Key& key, VolumeDimensions* dims) const
+{
+  if (key.modified == 0) {
+    return nullptr;
+  }
+  std::string path = entryPath(key);
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return nullptr;
+  }
+
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  std::shared_ptr<MemoryMappedFile> mapping = std::make_shared<MemoryMappedFile>(path);
+  if (!mapping->isOpen()) {
+    spdlog::warn("Could not map cached volume {}", path);
+    return nullptr;
+  }
+
+  BinaryReader reader(mapping->data(), mapping->size());
+  char magic[8];
+  uint32_t version, byteOrder;
+  uint64_t dataOffset, dataSize;
+  if (!(reader.get(magic) && reader.get(version) && reader.get(byteOrder) && reader.get(dataOffset) &&
+        reader.get(dataSize)) ||
+      memcmp(magic, ENTRY_MAGIC, sizeof(magic)) != 0 || version != ENTRY_VERSION || byteOrder != ENTRY_BYTE_ORDER) {
+    spdlog::debug("Ignoring cached volume {} of another format", path);
+    return nullptr;
+  }
+
+  // a different key with the same hash is simply a miss
+  ImageCache::Key storedKey;
+  if (!getKey(reader, storedKey) || storedKey < key || key < storedKey) {
+    return nullptr;
+  }
+
+  VolumeDimensions storedDims;
+  uint32_t sizeX, sizeY, sizeZ, sizeC, bpp;
+  float offsetX, offsetY, offsetZ;
+  if (!(readVolumeDimensions(reader, storedDims) && reader.getArray(storedDims.valueOffsets) &&
+        reader.getArray(storedDims.valueScales) && reader.get(sizeX) && reader.get(sizeY) && reader.get(sizeZ) &&
+        reader.get(sizeC) && reader.get(bpp) && reader.get(offsetX) && reader.get(offsetY) && reader.get(offsetZ))) {
+    spdlog::warn("Cached volume {} is damaged", path);
+    return nullptr;
+  }
+
+  std::vector<Histogram> histograms;
+  std::vector<std::vector<float>> luts(sizeC);
+  for (uint32_t i = 0; i < sizeC; ++i) {
+    uint16_t dataMin, dataMax;
+    uint64_t pixelCount;
+    std::vector<uint32_t> bins;
+    if (!(reader.get(dataMin) && reader.get(dataMax) && reader.get(pixelCount) && reader.getArray(bins) &&
+          reader.getArray(luts[i])) ||
+        bins.empty() || luts[i].size() != LUT_LENGTH) {
+      spdlog::warn("Cached volume {} is damaged", path);
+      return nullptr;
+    }
+    histograms.push_back(Histogram(bins, dataMin, dataMax, pixelCount));
+  }
+
+  uint64_t expectedSize = uint64_t(sizeX) * sizeY * sizeZ * sizeC * (bpp / 8);
+  if ((bpp != 8 && bpp != 16) || dataSize != expectedSize || dataOffset % ENTRY_DATA_ALIGNMENT != 0 ||
+      dataOffset > mapping->size() || mapping->size() - dataOffset < dataSize) {
+    spdlog::warn("Cached volume {} is damaged", path);
+    return nullptr;
+  }
+
+  // the image uses the data in place and keeps the mapping alive
+  std::shared_ptr<ImageXYZC> image = std::make_shared<ImageXYZC>(sizeX,
+                                                                 sizeY,
+                                                                 sizeZ,
+                                                                 sizeC,
+                                                                 bpp,
+                                                                 mapping->data() + dataOffset,
+                                                                 storedDims.physicalSizeX,
+                                                                 storedDims.physicalSizeY,
+                                                                 storedDims.physicalSizeZ,
+                                                                 mapping,
+                                                                 histograms,
+                                                                 luts);
+  image->setPhysicalOffset(offsetX, offsetY, offsetZ);
+  if (storedDims.channelNames.size() == sizeC) {
+    image->setChannelNames(storedDims.channelNames);
+  }
+  image->setValueMappings(storedDims.valueOffsets, storedDims.valueScales);
+  if (dims) {
+    *dims = storedDims;
+  }
+  // used now, so evicted last
+  touchFile(path);
+
+  auto endTime = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> elapsed = endTime - startTime;
+  spdlog::debug("Cached volume {} opened in {} ms", path, elapsed.count() * 1000.0);
+  return image;
+}
+
+bool
+VolumeDiskCache::store(const ImageCache::Key& key, const ImageXYZC& image, const VolumeDimensions& dims) const
+{
+  if (key.modified == 0 || image.size() > m_budget) {
+    return false;
+  }
+  if (!makeDirectories(m_directory)) {
+    spdlog::warn("Could not create volume cache directory {}", m_directory);
+    return false;
+  }
+
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  BinaryWriter writer;
+  putKey(writer, key);
+  writeVolumeDimensions(writer, dims);
+  writer.putArray(dims.valueOffsets.data(), uint32_t(dims.valueOffsets.size()));
+  writer.putArray(dims.valueScales.data(), uint32_t(dims.valueScales.size()));
+  writer.put(image.sizeX());
+  writer.put(image.sizeY());
+  writer.put(image.sizeZ());
+  writer.put(image.sizeC());
+  writer.put(image.sizeOfElement() * 8);
+  glm::vec3 offset = image.physicalOffset();
+  writer.put(offset.x);
+  writer.put(offset.y);
+  writer.put(offset.z);
+  for (uint32_t i = 0; i < image.sizeC(); ++i) {
+    const Channel* channel = image.channel(i);
+    const Histogram& histogram = channel->m_histogram;
+    writer.put(histogram._dataMin);
+    writer.put(histogram._dataMax);
+    writer.put(uint64_t(histogram._pixelCount));
+    writer.putArray(histogram._bins.data(), uint32_t(histogram._bins.size()));
+    writer.putArray(channel->m_lut, uint32_t(LUT_LENGTH));
+  }
+
+  uint64_t headerSize = ENTRY_PREFIX_SIZE + writer.bytes().size();
+  uint64_t dataOffset = (headerSize + ENTRY_DATA_ALIGNMENT - 1) / ENTRY_DATA_ALIGNMENT * ENTRY_DATA_ALIGNMENT;
+  uint64_t dataSize = image.size();
+
+  BinaryWriter prefix;
+  prefix.put(ENTRY_MAGIC);
+  prefix.put(ENTRY_VERSION);
+  prefix.put(ENTRY_BYTE_ORDER);
+  prefix.put(dataOffset);
+  prefix.put(dataSize);
+
+  // write aside and rename into place, so that a reader never maps a partly written entry.
+  // The temporary name is unique to this thread of this process, as other processes may share the cache directory.
+  std::string path = entryPath(key);
+  std::stringstream tempPath;
+  tempPath << path << "." << currentProcessId() << "." << std::hash<std::thread::id>()(std::this_thread::get_id())
+           << ".tmp";
+  {
+    std::FILE* out = std::fopen(tempPath.str().c_str(), "wb");
+    if (!out) {
+      spdlog::warn("Could not write cached volume {}", tempPath.str());
+      return false;
+    }
+    std::string padding(dataOffset - headerSize, '\0');
+    bool written = std::fwrite(prefix.bytes().data(), 1, prefix.bytes().size(), out) == prefix.bytes().size() &&
+                   std::fwrite(writer.bytes().data(), 1, writer.bytes().size(), out) == writer.bytes().size() &&
+                   std::fwrite(padding.data(), 1, padding.size(), out) == padding.size() &&
+                   std::fwrite(image.ptr(0), 1, dataSize, out) == dataSize;
+    // on disk before the rename, or a crash could leave a complete name over incomplete data
+    written = written && std::fflush(out) == 0 && syncFile(out);
+    written = std::fclose(out) == 0 && written;
+    if (!written) {
+      spdlog::warn("Could not write cached volume {}", tempPath.str());
+      std::remove(tempPath.str().c_str());
+      return false;
+    }
+  }
+#ifdef _WIN32
+  // rename doesn't replace an existing file on Windows
+  std::remove(path.c_str());
+#endif
+  if (std::rename(tempPath.str().c_str(), path.c_str()) != 0) {
+    spdlog::warn("Could not move cached volume into place at {}", path);
+    std::remove(tempPath.str().c_str());
+    return false;
+  }
+
+  auto endTime = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> elapsed = endTime - startTime;
+  spdlog::debug("Volume {} cached at {} in {} ms", key.filepath, path, elapsed.count() * 1000.0);
+
+  // file times may be too coarse to tell this entry from older ones
+  evict(m_budget, path);
+  return true;
+}
+
+void
+VolumeDiskCache::storeLater(const ImageCache::Key& key, std::shared_ptr<ImageXYZC> image, const VolumeDimensions& dims)
+{
+  std::lock_guard<std::mutex> lock(m_queueMutex);
+  m_queue.push_back(PendingStore{ key, image, dims });
+  if (!m_writer.joinable()) {
+    m_writer = std::thread(&VolumeDiskCache::writeQueued, this);
+  }
+  m_queueChanged.notify_all();
+}
+
+void
+VolumeDiskCache::flush()
+{
+  std::unique_lock<std::mutex> lock(m_queueMutex);
+  m_queueChanged.wait(lock, [this] { return m_stopping || (m_queue.empty() && !m_writing); });
+}
+
+void
+VolumeDiskCache::writeQueued()
+{
+  std::unique_lock<std::mutex> lock(m_queueMutex);
+  while (true) {
+    m_queueChanged.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+    if (m_stopping) {
+      return;
+    }
+    PendingStore pending = std::move(m_queue.front());
+    m_queue.pop_front();
+    m_writing = true;
+    lock.unlock();
+    store(pending.key, *pending.image, pending.dims);
+    // release the volume before waiting for the next
+    pending.image.reset();
+    lock.lock();
+    m_writing = false;
+    m_queueChanged.notify_all();
+  }
+}
+
+void
+VolumeDiskCache::evict(uint64_t bytes, const std::string& keep) const
+{
+  std::vector<EntryFile> entries = listEntries(m_directory);
+  uint64_t total = 0;
+  for (const EntryFile& entry : entries) {
+    total += entry.size;
+  }
+  if (total <= bytes) {
+    return;
+  }
+  std::sort(
+    entries.begin(), entries.end(), [](const EntryFile& a, const EntryFile& b) { return a.modified < b.modified; });
+  for (const EntryFile& entry : entries) {
+    if (total <= bytes) {
+      break;
+    }
+    if (entry.path == keep) {
+      continue;
+    }
+    // another process sharing the directory may have removed it already; either way it's gone
+    std::remove(entry.path.c_str());
+    total -= entry.size;
+    spdlog::debug("Evicted cached volume {}", entry.path);
+  }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "graphics/volumeDimensions.h"
+#include "imageCache.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class ImageXYZC;
+
+// Keeps decoded volumes in files under a directory, together with their channel histograms and luts, so that opening
+// one again maps its file into memory instead of decoding the original and scanning it for histograms.
+// An entry file holds a header (the cache key, the dimensions and value mappings, then per channel the data range,
+// histogram bins and lut) followed by the 8 or 16-bit channel data, laid out as in ImageXYZC and aligned to a page so
+// it can be used in place.
+// Entries are in native byte order and are only reused by the same version of the format on the same kind of machine.
+// The entries are kept within a budget of bytes: once over it, the least recently used are deleted, going by the
+// modification times of their files, which opening an entry refreshes.
+// Thread-safe: entries are written to a temporary file and renamed into place.
+class VolumeDiskCache
+{
+public:
+  static const uint64_t DEFAULT_BUDGET;
+
+  // the directory is created when the first entry is stored
+  VolumeDiskCache(const std::string& directory, uint64_t budget = DEFAULT_BUDGET);
+  // Finishes the entry being written; those still queued are dropped.
+  ~VolumeDiskCache();
+
+  const std::string& directory() const { return m_directory; }
+
+  void setBudget(uint64_t bytes);
+  uint64_t budget() const;
+
+  // The cached volume, or empty if there is no usable entry for the key.
+  std::shared_ptr<ImageXYZC> load(const ImageCache::Key& key, VolumeDimensions* dims) const;
+  // Writes an entry for a volume, then evicts entries to stay within the budget. Volumes that aren't files
+  // (modification time 0) can't be checked for staleness, and volumes larger than the budget can't be kept; neither
+  // is stored.
+  bool store(const ImageCache::Key& key, const ImageXYZC& image, const VolumeDimensions& dims) const;
+  // Stores on a background thread, so that the load which decoded the volume doesn't wait for the disk.
+  // The image is held until it is written.
+  void storeLater(const ImageCache::Key& key, std::shared_ptr<ImageXYZC> image, const VolumeDimensions& dims);
+  // waits until every entry queued by storeLater is written
+  void flush();
+
+  // Deletes the least recently used entries, other than the one at keep, until the rest fit in bytes.
+  void evict(uint64_t bytes, const std::string& keep = std::string()) const;
+
+  // the file that holds the entry for a key
+  std::string entryPath(const ImageCache::Key& key) const;
+
+private:
+  struct PendingStore
+  {
+    ImageCache::Key key;
+    std::shared_ptr<ImageXYZC> image;
+    VolumeDimensions dims;
+  };
+
+  void writeQueued();
+
+  std::string m_directory;
+  std::atomic<uint64_t> m_budget;
+
+  std::mutex m_queueMutex;
+  std::condition_variable m_queueChanged;
+  std::deque<PendingStore> m_queue;
+  // an entry has been taken off the queue and is being written
+  bool m_writing = false;
+  bool m_stopping = false;
+  // started with the first storeLater
+  std::thread m_writer;
+};
@@ -1,6 +1,7 @@
 #include "histogram.h"
 
 #include "gradientData.h"
+#include "parallel.h"
 
 #include "spdlog/spdlog.h"
 
@@ -21,11 +22,35 @@ clamp(const T& v, const T& lo, const T& hi)
 const float Histogram::DEFAULT_PCT_LOW = 0.5f;
 const float Histogram::DEFAULT_PCT_HIGH = 0.983f;
 
-Histogram::Histogram(uint16_t* data, size_t length, size_t num_bins)
+Histogram::Histogram(const uint16_t* data, size_t length, size_t num_bins)
   : _bins(num_bins)
   , _ccounts(num_bins)
   , _dataMin(0)
   , _dataMax(0)
+{
+  compute(data, length);
+}
+
+Histogram::Histogram(const uint8_t* data, size_t length, uint32_t bpp, size_t num_bins, uint32_t numThreads)
+  : _bins(num_bins)
+  , _ccounts(num_bins)
+  , _dataMin(0)
+  , _dataMax(0)
+{
+  assert(bpp == 8 || bpp == 16);
+  if (bpp == 8) {
+    compute(data, length, numThreads);
+  } else {
+    compute(reinterpret_cast<const uint16_t*>(data), length, numThreads);
+  }
+}
+
+// voxels per block when a histogram is split across threads; smaller data is not worth splitting
+static const size_t PARALLEL_BLOCK = 1 << 20;
+
+template<typename T>
+void
+Histogram::compute(const T* data, size_t length, uint32_t numThreads)
 {
   std::fill(_bins.begin(), _bins.end(), 0);
 
@@ -34,7 +59,46 @@ Histogram::Histogram(uint16_t* data, size_t length, size_t num_bins)
     _dataMax = data[0];
   }
 
-  uint16_t val;
+  const size_t blocks = (length + PARALLEL_BLOCK - 1) / PARALLEL_BLOCK;
+  if (numThreads > 1 && blocks > 1) {
+    // the same two passes, over blocks spread across threads. Each thread bins into bins of its own, so the
+    // result is exactly that of the single threaded passes.
+    const uint32_t nthreads = parallelThreadCount(blocks, numThreads);
+    std::vector<T> blockMin(blocks), blockMax(blocks);
+    parallelFor(blocks, nthreads, [&](size_t b, uint32_t) {
+      const T* first = data + b * PARALLEL_BLOCK;
+      const T* last = data + std::min(length, (b + 1) * PARALLEL_BLOCK);
+      auto minmax = std::minmax_element(first, last);
+      blockMin[b] = *minmax.first;
+      blockMax[b] = *minmax.second;
+    });
+    _dataMin = *std::min_element(blockMin.begin(), blockMin.end());
+    _dataMax = *std::max_element(blockMax.begin(), blockMax.end());
+
+    float range = (float)(_dataMax - _dataMin);
+    if (range == 0.0f) {
+      range = 1.0f;
+    }
+    float binmax = (float)(_bins.size() - 1);
+    std::vector<std::vector<uint32_t>> threadBins(nthreads, std::vector<uint32_t>(_bins.size(), 0));
+    parallelFor(blocks, nthreads, [&](size_t b, uint32_t worker) {
+      uint32_t* bins = threadBins[worker].data();
+      const size_t end = std::min(length, (b + 1) * PARALLEL_BLOCK);
+      for (size_t i = b * PARALLEL_BLOCK; i < end; ++i) {
+        bins[(size_t)((float)(data[i] - _dataMin) / range * binmax + 0.5)]++;
+      }
+    });
+    for (const std::vector<uint32_t>& bins : threadBins) {
+      for (size_t i = 0; i < _bins.size(); ++i) {
+        _bins[i] += bins[i];
+      }
+    }
+    _pixelCount = length;
+    summarizeBins();
+    return;
+  }
+
+  T val;
   for (size_t i = 0; i < length; ++i) {
     val = data[i];
     if (val > _dataMax) {
@@ -48,7 +112,7 @@ Histogram::Histogram(uint16_t* data, size_t length, size_t num_bins)
   if (range == 0.0f) {
     range = 1.0f;
   }
-  float binmax = (float)(num_bins - 1);
+  float binmax = (float)(_bins.size() - 1);
   for (size_t i = 0; i < length; ++i) {
     size_t whichbin = (size_t)((float)(data[i] - _dataMin) / range * binmax + 0.5);
     //		val = data[i];
@@ -66,6 +130,22 @@ Histogram::Histogram(uint16_t* data, size_t length, size_t num_bins)
   // total number of pixels
   _pixelCount = length;
 
+  summarizeBins();
+}
+
+Histogram::Histogram(const std::vector<uint32_t>& bins, uint16_t dataMin, uint16_t dataMax, size_t pixelCount)
+  : _bins(bins)
+  , _ccounts(bins.size())
+  , _dataMin(dataMin)
+  , _dataMax(dataMax)
+  , _pixelCount(pixelCount)
+{
+  summarizeBins();
+}
+
+void
+Histogram::summarizeBins()
+{
   // get the bin with the most frequently occurring value
   _maxBin = 0;
   uint32_t curmax = _bins[0];
@@ -8,7 +8,12 @@
 
 struct Histogram
 {
-  Histogram(uint16_t* data, size_t length, size_t bins = 256);
+  Histogram(const uint16_t* data, size_t length, size_t bins = 256);
+  // length voxels of bpp (8 or 16) bits each, e.g. one channel of an ImageXYZC.
+  // Large data is split across up to numThreads threads, each with bins of its own that are added up at the end.
+  Histogram(const uint8_t* data, size_t length, uint32_t bpp, size_t bins = 256, uint32_t numThreads = 1);
+  // a histogram computed earlier, e.g. stored along with its data; only the bin counts and data range are needed
+  Histogram(const std::vector<uint32_t>& bins, uint16_t dataMin, uint16_t dataMax, size_t pixelCount);
 
   static const float DEFAULT_PCT_LOW;
   static const float DEFAULT_PCT_HIGH;
@@ -43,4 +48,11 @@ struct Histogram
   float* initialize_thresholds(float vfrac_min = 0.01f, float vfrac_max = 0.90f) const;
 
   float* generateFromGradientData(const GradientData& gradientData, size_t length = 256) const;
+
+private:
+  // fill in the data range and _bins from the voxels of data, then summarize them
+  template<typename T>
+  void compute(const T* data, size_t length, uint32_t numThreads = 1);
+  // fill in _maxBin and _ccounts from _bins
+  void summarizeBins();
 };
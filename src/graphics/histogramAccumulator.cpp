@@ -0,0 +1,136 @@
+#include "histogramAccumulator.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <limits>
+
+HistogramAccumulator::HistogramAccumulator(uint32_t channels, uint32_t bpp)
+  : m_bpp(bpp)
+  , m_counts(channels, std::vector<uint32_t>((size_t)1 << bpp, 0))
+  , m_totals(channels, 0)
+  , m_mutexes(new std::mutex[channels])
+{
+  assert(bpp == 8 || bpp == 16);
+}
+
+void
+HistogramAccumulator::add(uint32_t channel, const uint8_t* data, size_t length)
+{
+  addRows(channel, data, length, 1, 0);
+}
+
+void
+HistogramAccumulator::addRows(uint32_t channel, const uint8_t* data, size_t rowLength, size_t rows, size_t rowStride)
+{
+  if (m_bpp == 8) {
+    addRowsOf<uint8_t>(channel, data, rowLength, rows, rowStride);
+  } else {
+    addRowsOf<uint16_t>(channel, data, rowLength, rows, rowStride);
+  }
+}
+
+template<typename T>
+void
+HistogramAccumulator::addRowsOf(uint32_t channel, const uint8_t* data, size_t rowLength, size_t rows, size_t rowStride)
+{
+  assert(channel < m_counts.size());
+  const size_t values = m_counts[channel].size();
+  const size_t length = rowLength * rows;
+  if (length < values * 4) {
+    // too few voxels to be worth counting apart: count them straight into the channel's counts
+    std::lock_guard<std::mutex> lock(m_mutexes[channel]);
+    uint32_t* counts = m_counts[channel].data();
+    for (size_t row = 0; row < rows; ++row) {
+      const T* p = reinterpret_cast<const T*>(data + row * rowStride);
+      for (size_t i = 0; i < rowLength; ++i) {
+        counts[p[i]]++;
+      }
+    }
+    m_totals[channel] += length;
+    return;
+  }
+
+  // count without holding the lock, then merge only the range of values seen
+  std::vector<uint32_t> local(values, 0);
+  T lo = std::numeric_limits<T>::max(), hi = 0;
+  for (size_t row = 0; row < rows; ++row) {
+    const T* p = reinterpret_cast<const T*>(data + row * rowStride);
+    for (size_t i = 0; i < rowLength; ++i) {
+      local[p[i]]++;
+    }
+  }
+  for (size_t v = 0; v < values; ++v) {
+    if (local[v]) {
+      lo = std::min(lo, (T)v);
+      hi = (T)v;
+    }
+  }
+  std::lock_guard<std::mutex> lock(m_mutexes[channel]);
+  uint32_t* counts = m_counts[channel].data();
+  for (size_t v = lo; v <= hi; ++v) {
+    counts[v] += local[v];
+  }
+  m_totals[channel] += length;
+}
+
+void
+HistogramAccumulator::addZeros(uint32_t channel, size_t count)
+{
+  assert(channel < m_counts.size());
+  std::lock_guard<std::mutex> lock(m_mutexes[channel]);
+  m_counts[channel][0] += (uint32_t)count;
+  m_totals[channel] += count;
+}
+
+size_t
+HistogramAccumulator::count(uint32_t channel) const
+{
+  std::lock_guard<std::mutex> lock(m_mutexes[channel]);
+  return m_totals[channel];
+}
+
+Histogram
+HistogramAccumulator::histogram(uint32_t channel, size_t bins) const
+{
+  std::lock_guard<std::mutex> lock(m_mutexes[channel]);
+  const std::vector<uint32_t>& counts = m_counts[channel];
+
+  uint16_t dataMin = 0, dataMax = 0;
+  size_t first = 0;
+  while (first < counts.size() && counts[first] == 0) {
+    ++first;
+  }
+  if (first < counts.size()) {
+    size_t last = counts.size() - 1;
+    while (counts[last] == 0) {
+      --last;
+    }
+    dataMin = (uint16_t)first;
+    dataMax = (uint16_t)last;
+  }
+
+  // binned as Histogram bins voxels one by one
+  std::vector<uint32_t> binCounts(bins, 0);
+  float range = (float)(dataMax - dataMin);
+  if (range == 0.0f) {
+    range = 1.0f;
+  }
+  float binmax = (float)(bins - 1);
+  for (size_t v = dataMin; v <= dataMax; ++v) {
+    if (counts[v]) {
+      size_t whichbin = (size_t)((float)((int)v - dataMin) / range * binmax + 0.5);
+      binCounts[whichbin] += counts[v];
+    }
+  }
+  return Histogram(binCounts, dataMin, dataMax, m_totals[channel]);
+}
+
+std::vector<Histogram>
+HistogramAccumulator::histograms(size_t bins) const
+{
+  std::vector<Histogram> result;
+  for (uint32_t i = 0; i < channels(); ++i) {
+    result.push_back(histogram(i, bins));
+  }
+  return result;
+}
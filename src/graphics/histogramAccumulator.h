@@ -0,0 +1,47 @@
+#pragma once
+
+#include "histogram.h"
+
+#include <inttypes.h>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <vector>
+
+// Counts of every voxel value of each channel of a volume, gathered by a loader while it decodes the volume, each
+// plane or strip being counted while it is still in cache. The channel histograms are then made from the counts,
+// which saves ImageXYZC two more passes over all of the data.
+// Any number of threads may add voxels at the same time.
+class HistogramAccumulator
+{
+public:
+  // bpp is 8 or 16
+  HistogramAccumulator(uint32_t channels, uint32_t bpp);
+
+  // count length voxels of channel, of bpp bits each
+  void add(uint32_t channel, const uint8_t* data, size_t length);
+  // count rows of rowLength voxels of channel, the rows starting rowStride bytes apart
+  void addRows(uint32_t channel, const uint8_t* data, size_t rowLength, size_t rows, size_t rowStride);
+  // count voxels of value 0, e.g. for planes missing from the file that are left blank
+  void addZeros(uint32_t channel, size_t count);
+
+  uint32_t channels() const { return (uint32_t)m_counts.size(); }
+  // number of voxels of channel counted so far
+  size_t count(uint32_t channel) const;
+
+  // the histogram of the voxels of channel, exactly as Histogram(data, length, bpp, bins) computes it
+  Histogram histogram(uint32_t channel, size_t bins = 256) const;
+  // the histograms of all channels, e.g. for ImageXYZC
+  std::vector<Histogram> histograms(size_t bins = 256) const;
+
+private:
+  template<typename T>
+  void addRowsOf(uint32_t channel, const uint8_t* data, size_t rowLength, size_t rows, size_t rowStride);
+
+  uint32_t m_bpp;
+  // per channel, the number of voxels of each value
+  std::vector<std::vector<uint32_t>> m_counts;
+  std::vector<size_t> m_totals;
+  // one per channel, guarding its counts
+  std::unique_ptr<std::mutex[]> m_mutexes;
+};
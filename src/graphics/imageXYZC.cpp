@@ -1,13 +1,57 @@
 #include "imageXYZC.h"
 
+#include "parallel.h"
+
 #include "spdlog/spdlog.h"
 
 #undef min
 #undef max
 #include <algorithm>
+#include <assert.h>
+#include <cstring>
+#include <limits>
 #include <math.h>
 #include <sstream>
 
+// the length of the luts that Histogram generates by default
+static const size_t LUT_LENGTH = 256;
+
+ImageXYZC::ImageXYZC(uint32_t x,
+                     uint32_t y,
+                     uint32_t z,
+                     uint32_t c,
+                     uint32_t bpp,
+                     uint8_t* data,
+                     float sx,
+                     float sy,
+                     float sz,
+                     std::shared_ptr<void> dataOwner)
+  : m_x(x)
+  , m_y(y)
+  , m_z(z)
+  , m_c(c)
+  , m_bpp(bpp)
+  , m_data(data)
+  , m_dataOwner(dataOwner)
+  , m_scaleX(sx)
+  , m_scaleY(sy)
+  , m_scaleZ(sz)
+  , m_offset(0.0f)
+{
+  // Channels are set up side by side, each computing its histogram and lut. When there are fewer channels than
+  // threads, the threads left over split up the histogram of each channel.
+  const uint32_t numThreads = hardwareThreadCount();
+  const uint32_t channelThreads = parallelThreadCount(m_c, numThreads);
+  const uint32_t threadsPerChannel = std::max(1u, numThreads / channelThreads);
+  m_channels.resize(m_c, nullptr);
+  parallelFor(m_c, channelThreads, [&](size_t i, uint32_t) {
+    m_channels[i] = new Channel(x, y, z, bpp, ptr((uint32_t)i), threadsPerChannel);
+  });
+  for (uint32_t i = 0; i < m_c; ++i) {
+    spdlog::info("Channel {}:{},{}", i, (m_channels[i]->m_min), (m_channels[i]->m_max));
+  }
+}
+
 ImageXYZC::ImageXYZC(uint32_t x,
                      uint32_t y,
                      uint32_t z,
@@ -16,19 +60,27 @@ ImageXYZC::ImageXYZC(uint32_t x,
                      uint8_t* data,
                      float sx,
                      float sy,
-                     float sz)
+                     float sz,
+                     std::shared_ptr<void> dataOwner,
+                     const std::vector<Histogram>& histograms,
+                     const std::vector<std::vector<float>>& luts)
   : m_x(x)
   , m_y(y)
   , m_z(z)
   , m_c(c)
   , m_bpp(bpp)
   , m_data(data)
+  , m_dataOwner(dataOwner)
   , m_scaleX(sx)
   , m_scaleY(sy)
   , m_scaleZ(sz)
+  , m_offset(0.0f)
 {
+  assert(histograms.size() == m_c);
+  assert(luts.empty() || luts.size() == m_c);
+  static const std::vector<float> NO_LUT;
   for (uint32_t i = 0; i < m_c; ++i) {
-    m_channels.push_back(new Channelu16(x, y, z, reinterpret_cast<uint16_t*>(ptr(i))));
+    m_channels.push_back(new Channel(x, y, z, bpp, ptr(i), histograms[i], luts.empty() ? NO_LUT : luts[i]));
   }
   for (uint32_t i = 0; i < m_c; ++i) {
     spdlog::info("Channel {}:{},{}", i, (m_channels[i]->m_min), (m_channels[i]->m_max));
@@ -41,7 +93,9 @@ ImageXYZC::~ImageXYZC()
     delete m_channels[i];
     m_channels[i] = nullptr;
   }
-  delete[] m_data;
+  if (!m_dataOwner) {
+    delete[] m_data;
+  }
 }
 
 void
@@ -52,6 +106,57 @@ ImageXYZC::setChannelNames(std::vector<std::string>& channelNames)
   }
 }
 
+void
+ImageXYZC::setValueMappings(const std::vector<double>& offsets, const std::vector<double>& scales)
+{
+  if (offsets.size() != m_c || scales.size() != m_c) {
+    return;
+  }
+  for (uint32_t i = 0; i < m_c; ++i) {
+    m_channels[i]->m_valueOffset = offsets[i];
+    m_channels[i]->m_valueScale = scales[i];
+  }
+}
+
+std::shared_ptr<ImageXYZC>
+ImageXYZC::addChannels(const ImageXYZC& other) const
+{
+  if (other.m_x != m_x || other.m_y != m_y || other.m_z != m_z || other.m_bpp != m_bpp) {
+    spdlog::error("Can't add channels of size {}x{}x{} to an image of size {}x{}x{}",
+                  other.m_x,
+                  other.m_y,
+                  other.m_z,
+                  m_x,
+                  m_y,
+                  m_z);
+    return nullptr;
+  }
+  uint8_t* data = new uint8_t[size() + other.size()];
+  memcpy(data, m_data, size());
+  memcpy(data + size(), other.m_data, other.size());
+
+  // every channel keeps its histogram, lut, name and value mapping, so nothing is computed again
+  std::vector<Histogram> histograms;
+  std::vector<std::vector<float>> luts;
+  std::vector<std::string> names;
+  std::vector<double> valueOffsets, valueScales;
+  for (const ImageXYZC* source : { this, &other }) {
+    for (const Channel* channel : source->m_channels) {
+      histograms.push_back(channel->m_histogram);
+      luts.emplace_back(channel->m_lut, channel->m_lut + LUT_LENGTH);
+      names.push_back(channel->m_name);
+      valueOffsets.push_back(channel->m_valueOffset);
+      valueScales.push_back(channel->m_valueScale);
+    }
+  }
+  std::shared_ptr<ImageXYZC> image = std::make_shared<ImageXYZC>(
+    m_x, m_y, m_z, m_c + other.m_c, m_bpp, data, m_scaleX, m_scaleY, m_scaleZ, nullptr, histograms, luts);
+  image->m_offset = m_offset;
+  image->setChannelNames(names);
+  image->setValueMappings(valueOffsets, valueScales);
+  return image;
+}
+
 uint32_t
 ImageXYZC::sizeX() const
 {
@@ -84,6 +189,18 @@ ImageXYZC::setPhysicalSize(float x, float y, float z)
   m_scaleZ = z;
 }
 
+void
+ImageXYZC::setPhysicalOffset(float x, float y, float z)
+{
+  m_offset = glm::vec3(x, y, z);
+}
+
+glm::vec3
+ImageXYZC::physicalOffset() const
+{
+  return m_offset;
+}
+
 float
 ImageXYZC::physicalSizeX() const
 {
@@ -139,7 +256,13 @@ ImageXYZC::ptr(uint32_t channel, uint32_t z) const
   return m_data + ((channel * sizeOfChannel()) + (z * sizeOfPlane()));
 }
 
-Channelu16*
+bool
+ImageXYZC::ownsData() const
+{
+  return !m_dataOwner;
+}
+
+Channel*
 ImageXYZC::channel(uint32_t channel) const
 {
   return m_channels[channel];
@@ -160,11 +283,13 @@ ImageXYZC::getDimensions() const
 
 // 3d median filter?
 
-Channelu16::Channelu16(uint32_t x, uint32_t y, uint32_t z, uint16_t* ptr)
-  : m_histogram(ptr, x * y * z)
+Channel::Channel(uint32_t x, uint32_t y, uint32_t z, uint32_t bpp, uint8_t* ptr, uint32_t numThreads)
+  : m_histogram(ptr, (size_t)x * y * z, bpp, 256, numThreads)
 {
+  assert(bpp == 8 || bpp == 16);
   m_gradientMagnitudePtr = nullptr;
   m_ptr = ptr;
+  m_bpp = bpp;
 
   m_x = x;
   m_y = y;
@@ -176,44 +301,74 @@ Channelu16::Channelu16(uint32_t x, uint32_t y, uint32_t z, uint16_t* ptr)
   m_lut = m_histogram.generate_percentiles();
 }
 
-Channelu16::~Channelu16()
+Channel::Channel(uint32_t x,
+                 uint32_t y,
+                 uint32_t z,
+                 uint32_t bpp,
+                 uint8_t* ptr,
+                 const Histogram& histogram,
+                 const std::vector<float>& lut)
+  : m_histogram(histogram)
+{
+  assert(bpp == 8 || bpp == 16);
+  m_gradientMagnitudePtr = nullptr;
+  m_ptr = ptr;
+  m_bpp = bpp;
+
+  m_x = x;
+  m_y = y;
+  m_z = z;
+
+  m_min = m_histogram._dataMin;
+  m_max = m_histogram._dataMax;
+
+  if (lut.empty()) {
+    m_lut = m_histogram.generate_percentiles();
+  } else {
+    m_lut = new float[lut.size()];
+    std::copy(lut.begin(), lut.end(), m_lut);
+  }
+}
+
+Channel::~Channel()
 {
   delete[] m_lut;
   delete[] m_gradientMagnitudePtr;
 }
 
-uint16_t*
-Channelu16::generateGradientMagnitudeVolume(float scalex, float scaley, float scalez)
+template<typename T>
+static void
+gradientMagnitude(const T* inptr,
+                  T* outptr,
+                  uint32_t sizeX,
+                  uint32_t sizeY,
+                  uint32_t sizeZ,
+                  float xspacing,
+                  float yspacing,
+                  float zspacing)
 {
-  float maxspacing = std::max(scalex, std::max(scaley, scalez));
-  float xspacing = scalex / maxspacing;
-  float yspacing = scaley / maxspacing;
-  float zspacing = scalez / maxspacing;
-
-  uint16_t* outptr = new uint16_t[m_x * m_y * m_z];
-  m_gradientMagnitudePtr = outptr;
+  const double maxValue = (double)std::numeric_limits<T>::max();
 
   int useZmin, useZmax, useYmin, useYmax, useXmin, useXmax;
 
   double d, sum;
 
   // deltaz is one plane of data (x*y pixels)
-  const int32_t dz = m_x * m_y;
+  const int32_t dz = sizeX * sizeY;
   // deltay is one row of data (x pixels)
-  const int32_t dy = m_x;
+  const int32_t dy = sizeX;
   // deltax is one pixel
   const int32_t dx = 1;
 
-  uint16_t* inptr = m_ptr;
-  for (uint32_t z = 0; z < m_z; ++z) {
+  for (uint32_t z = 0; z < sizeZ; ++z) {
     useZmin = (z <= 0) ? 0 : -dz;
-    useZmax = (z >= m_z - 1) ? 0 : dz;
-    for (uint32_t y = 0; y < m_y; ++y) {
+    useZmax = (z >= sizeZ - 1) ? 0 : dz;
+    for (uint32_t y = 0; y < sizeY; ++y) {
       useYmin = (y <= 0) ? 0 : -dy;
-      useYmax = (y >= m_y - 1) ? 0 : dy;
-      for (uint32_t x = 0; x < m_x; ++x) {
+      useYmax = (y >= sizeY - 1) ? 0 : dy;
+      for (uint32_t x = 0; x < sizeX; ++x) {
         useXmin = (x <= 0) ? 0 : -dx;
-        useXmax = (x >= m_x - 1) ? 0 : dx;
+        useXmax = (x >= sizeX - 1) ? 0 : dx;
 
         d = static_cast<double>(inptr[useXmin]);
         d -= static_cast<double>(inptr[useXmax]);
@@ -230,18 +385,42 @@ Channelu16::generateGradientMagnitudeVolume(float scalex, float scaley, float sc
         d /= zspacing; // divide or multiply here??
         sum += d * d;
 
-        *outptr = static_cast<uint16_t>(sqrt(sum));
+        *outptr = static_cast<T>(std::min(sqrt(sum), maxValue));
         outptr++;
         inptr++;
       }
     }
   }
+}
 
-  return outptr;
+uint8_t*
+Channel::generateGradientMagnitudeVolume(float scalex, float scaley, float scalez)
+{
+  float maxspacing = std::max(scalex, std::max(scaley, scalez));
+  float xspacing = scalex / maxspacing;
+  float yspacing = scaley / maxspacing;
+  float zspacing = scalez / maxspacing;
+
+  delete[] m_gradientMagnitudePtr;
+  m_gradientMagnitudePtr = new uint8_t[(size_t)m_x * m_y * m_z * sizeOfElement()];
+
+  if (m_bpp == 8) {
+    gradientMagnitude(m_ptr, m_gradientMagnitudePtr, m_x, m_y, m_z, xspacing, yspacing, zspacing);
+  } else {
+    gradientMagnitude(data<uint16_t>(),
+                      reinterpret_cast<uint16_t*>(m_gradientMagnitudePtr),
+                      m_x,
+                      m_y,
+                      m_z,
+                      xspacing,
+                      yspacing,
+                      zspacing);
+  }
+  return m_gradientMagnitudePtr;
 }
 
 void
-Channelu16::debugprint()
+Channel::debugprint()
 {
   // stringify for output
   std::stringstream ss;
@@ -5,26 +5,55 @@
 #include <glm/glm.hpp>
 
 #include <inttypes.h>
+#include <memory>
 #include <string>
 #include <vector>
 
-struct Channelu16
+// One channel of an ImageXYZC. Voxels are stored at the image's bits per pixel, so 8-bit data stays 8-bit, and
+// everything derived from them (histogram, luts, gradient magnitudes) works on the native type.
+struct Channel
 {
-  Channelu16(uint32_t x, uint32_t y, uint32_t z, uint16_t* ptr);
-  ~Channelu16();
+  // the histogram is computed on up to numThreads threads
+  Channel(uint32_t x, uint32_t y, uint32_t z, uint32_t bpp, uint8_t* ptr, uint32_t numThreads = 1);
+  // with the histogram of the data, and optionally its lut, computed earlier; an empty lut is generated as above
+  Channel(uint32_t x,
+          uint32_t y,
+          uint32_t z,
+          uint32_t bpp,
+          uint8_t* ptr,
+          const Histogram& histogram,
+          const std::vector<float>& lut);
+  ~Channel();
 
   uint32_t m_x, m_y, m_z;
+  // 8 or 16
+  uint32_t m_bpp;
 
-  uint16_t* m_ptr;
+  // the voxels, uint8_t or uint16_t as m_bpp says
+  uint8_t* m_ptr;
   uint16_t m_min;
   uint16_t m_max;
 
-  uint16_t* m_gradientMagnitudePtr;
+  // same type and size as the voxels
+  uint8_t* m_gradientMagnitudePtr;
 
   Histogram m_histogram;
   float* m_lut;
 
-  uint16_t* generateGradientMagnitudeVolume(float scalex, float scaley, float scalez);
+  // the value in the file of a voxel v is m_valueOffset + v * m_valueScale (see VolumeDimensions::valueOffsets)
+  double m_valueOffset = 0.0;
+  double m_valueScale = 1.0;
+
+  uint32_t sizeOfElement() const { return m_bpp / 8; }
+  // the voxels as T, which must match m_bpp
+  template<typename T>
+  T* data() const
+  {
+    return reinterpret_cast<T*>(m_ptr);
+  }
+
+  // fills in m_gradientMagnitudePtr, clamping the magnitudes to the range of the voxel type, and returns it
+  uint8_t* generateGradientMagnitudeVolume(float scalex, float scaley, float scalez);
 
   void generateFromGradientData(const GradientData& gradientData)
   {
@@ -81,6 +110,9 @@ struct Channelu16
 class ImageXYZC
 {
 public:
+  // bpp is 8 or 16: the voxels are kept at that size.
+  // The image takes ownership of data and will delete[] it, unless dataOwner is given:
+  // then data lives in memory held by dataOwner (e.g. a memory mapped file), which the image keeps alive instead.
   ImageXYZC(uint32_t x,
             uint32_t y,
             uint32_t z,
@@ -89,10 +121,30 @@ public:
             uint8_t* data = nullptr,
             float sx = 1.0,
             float sy = 1.0,
-            float sz = 1.0);
+            float sz = 1.0,
+            std::shared_ptr<void> dataOwner = nullptr);
+  // As above, for data whose channel histograms and luts were computed earlier (e.g. when it was cached on disk),
+  // which skips a pass over all of the data. There is one histogram per channel, and either one lut per channel
+  // or none, in which case they are generated from the histograms.
+  ImageXYZC(uint32_t x,
+            uint32_t y,
+            uint32_t z,
+            uint32_t c,
+            uint32_t bpp,
+            uint8_t* data,
+            float sx,
+            float sy,
+            float sz,
+            std::shared_ptr<void> dataOwner,
+            const std::vector<Histogram>& histograms,
+            const std::vector<std::vector<float>>& luts);
   virtual ~ImageXYZC();
 
   void setPhysicalSize(float x, float y, float z);
+  // Where the first voxel lies in the whole volume, in physical units, for images of a region of a volume.
+  // 0 for whole volumes.
+  void setPhysicalOffset(float x, float y, float z);
+  glm::vec3 physicalOffset() const;
 
   uint32_t sizeX() const;
   uint32_t sizeY() const;
@@ -112,13 +164,25 @@ public:
   size_t size() const;
 
   uint8_t* ptr(uint32_t channel = 0, uint32_t z = 0) const;
-  Channelu16* channel(uint32_t channel) const;
+  // false when the data is held by a dataOwner, e.g. mapped from a file
+  bool ownsData() const;
+  Channel* channel(uint32_t channel) const;
 
   void setChannelNames(std::vector<std::string>& channelNames);
+  // one offset and scale per channel, or none to leave the values as they are
+  void setValueMappings(const std::vector<double>& offsets, const std::vector<double>& scales);
+
+  // A new image with the channels of this one followed by those of other, which must have the same size and bits per
+  // pixel, e.g. channels of the same file loaded later on demand. Each channel keeps its histogram, lut and name.
+  // Neither image changes, so other holders of them (e.g. through the image cache) are unaffected.
+  // Null if the sizes differ.
+  std::shared_ptr<ImageXYZC> addChannels(const ImageXYZC& other) const;
 
 private:
   uint32_t m_x, m_y, m_z, m_c, m_bpp;
   uint8_t* m_data;
+  std::shared_ptr<void> m_dataOwner;
   float m_scaleX, m_scaleY, m_scaleZ;
-  std::vector<Channelu16*> m_channels;
+  glm::vec3 m_offset;
+  std::vector<Channel*> m_channels;
 };
@@ -0,0 +1,244 @@
+#include "pagedVolume.h"
+
+#include "parallel.h"
+
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+PagedVolume::PagedVolume(std::shared_ptr<BrickSource> source, size_t budget, uint32_t brickSize)
+  : m_source(source)
+  , m_dims(source->dimensions())
+  , m_budget(budget)
+{
+  if (brickSize > 0) {
+    m_brickX = m_brickY = m_brickZ = brickSize;
+  } else {
+    source->brickSize(m_brickX, m_brickY, m_brickZ);
+  }
+  for (uint32_t* size : { &m_brickX, &m_brickY, &m_brickZ }) {
+    if (*size == 0) {
+      *size = 64;
+    }
+  }
+  m_bricksX = (m_dims.sizeX + m_brickX - 1) / m_brickX;
+  m_bricksY = (m_dims.sizeY + m_brickY - 1) / m_brickY;
+  m_bricksZ = (m_dims.sizeZ + m_brickZ - 1) / m_brickZ;
+}
+
+VoxelRegion
+PagedVolume::brickRegion(uint32_t bx, uint32_t by, uint32_t bz) const
+{
+  VoxelRegion region;
+  region.minX = bx * m_brickX;
+  region.minY = by * m_brickY;
+  region.minZ = bz * m_brickZ;
+  region.maxX = std::min(region.minX + m_brickX, m_dims.sizeX);
+  region.maxY = std::min(region.minY + m_brickY, m_dims.sizeY);
+  region.maxZ = std::min(region.minZ + m_brickZ, m_dims.sizeZ);
+  return region;
+}
+
+std::shared_ptr<const PagedVolume::Brick>
+PagedVolume::brick(uint32_t c, uint32_t t, uint32_t bx, uint32_t by, uint32_t bz)
+{
+  if (c >= m_dims.sizeC || t >= m_dims.sizeT || bx >= m_bricksX || by >= m_bricksY || bz >= m_bricksZ) {
+    return nullptr;
+  }
+  BrickKey key(c, t, bx, by, bz);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_index.find(key);
+    if (found != m_index.end()) {
+      m_stats.hits++;
+      m_entries.splice(m_entries.begin(), m_entries, found->second);
+      return found->second->brick;
+    }
+    m_stats.misses++;
+  }
+
+  // read without holding the lock, so that other bricks can be read meanwhile;
+  // two threads that miss the same brick at once both read it, and the second copy is dropped
+  std::shared_ptr<Brick> loaded = std::make_shared<Brick>();
+  loaded->region = brickRegion(bx, by, bz);
+  loaded->voxels.resize(size_t(loaded->region.sizeX()) * loaded->region.sizeY() * loaded->region.sizeZ());
+  if (!m_source->readRegion(c, t, loaded->region, loaded->voxels.data())) {
+    spdlog::error("Failed to read brick ({}, {}, {}) of channel {} at time {}", bx, by, bz, c, t);
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto found = m_index.find(key);
+  if (found != m_index.end()) {
+    return found->second->brick;
+  }
+  Entry entry;
+  entry.key = key;
+  entry.brick = loaded;
+  entry.bytes = loaded->voxels.size() * sizeof(uint16_t);
+  m_entries.push_front(entry);
+  m_index[key] = m_entries.begin();
+  m_bytes += entry.bytes;
+  // keep the new brick even if it alone is over budget: the caller is about to use it
+  evict(m_budget > entry.bytes ? m_budget - entry.bytes : 0);
+  return loaded;
+}
+
+// call with m_mutex held; never evicts the most recently used brick
+void
+PagedVolume::evict(size_t budget)
+{
+  size_t keep = m_entries.empty() ? 0 : m_entries.front().bytes;
+  while (m_bytes - keep > budget && m_entries.size() > 1) {
+    const Entry& oldest = m_entries.back();
+    m_bytes -= oldest.bytes;
+    m_index.erase(oldest.key);
+    m_entries.pop_back();
+    m_stats.evictions++;
+  }
+}
+
+void
+PagedVolume::prefetch(uint32_t c, uint32_t t, const VoxelRegion& region)
+{
+  VoxelRegion box = region.clampedTo(m_dims.sizeX, m_dims.sizeY, m_dims.sizeZ);
+  if (box.isEmpty()) {
+    return;
+  }
+  std::vector<BrickKey> missing;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (uint32_t bz = box.minZ / m_brickZ; bz <= (box.maxZ - 1) / m_brickZ; ++bz) {
+      for (uint32_t by = box.minY / m_brickY; by <= (box.maxY - 1) / m_brickY; ++by) {
+        for (uint32_t bx = box.minX / m_brickX; bx <= (box.maxX - 1) / m_brickX; ++bx) {
+          BrickKey key(c, t, bx, by, bz);
+          if (m_index.find(key) == m_index.end()) {
+            missing.push_back(key);
+          }
+        }
+      }
+    }
+  }
+  parallelFor(missing.size(), 0, [&](size_t i, uint32_t) {
+    brick(std::get<0>(missing[i]),
+          std::get<1>(missing[i]),
+          std::get<2>(missing[i]),
+          std::get<3>(missing[i]),
+          std::get<4>(missing[i]));
+  });
+}
+
+bool
+PagedVolume::readRegion(uint32_t c, uint32_t t, const VoxelRegion& region, uint16_t* dst)
+{
+  if (region.isEmpty() || region.maxX > m_dims.sizeX || region.maxY > m_dims.sizeY || region.maxZ > m_dims.sizeZ) {
+    return false;
+  }
+  const size_t planeVoxels = size_t(region.sizeX()) * region.sizeY();
+  for (uint32_t bz = region.minZ / m_brickZ; bz <= (region.maxZ - 1) / m_brickZ; ++bz) {
+    for (uint32_t by = region.minY / m_brickY; by <= (region.maxY - 1) / m_brickY; ++by) {
+      for (uint32_t bx = region.minX / m_brickX; bx <= (region.maxX - 1) / m_brickX; ++bx) {
+        std::shared_ptr<const Brick> b = brick(c, t, bx, by, bz);
+        if (!b) {
+          return false;
+        }
+        const VoxelRegion& r = b->region;
+        uint32_t x0 = std::max(r.minX, region.minX), x1 = std::min(r.maxX, region.maxX);
+        uint32_t y0 = std::max(r.minY, region.minY), y1 = std::min(r.maxY, region.maxY);
+        uint32_t z0 = std::max(r.minZ, region.minZ), z1 = std::min(r.maxZ, region.maxZ);
+        for (uint32_t z = z0; z < z1; ++z) {
+          for (uint32_t y = y0; y < y1; ++y) {
+            const uint16_t* src =
+              b->voxels.data() + (size_t(z - r.minZ) * r.sizeY() + (y - r.minY)) * r.sizeX() + (x0 - r.minX);
+            uint16_t* out = dst + size_t(z - region.minZ) * planeVoxels + size_t(y - region.minY) * region.sizeX() +
+                            (x0 - region.minX);
+            memcpy(out, src, (x1 - x0) * sizeof(uint16_t));
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+uint16_t
+PagedVolume::voxel(uint32_t c, uint32_t t, uint32_t x, uint32_t y, uint32_t z)
+{
+  std::shared_ptr<const Brick> b = brick(c, t, x / m_brickX, y / m_brickY, z / m_brickZ);
+  if (!b) {
+    return 0;
+  }
+  const VoxelRegion& r = b->region;
+  return b->voxels[(size_t(z - r.minZ) * r.sizeY() + (y - r.minY)) * r.sizeX() + (x - r.minX)];
+}
+
+Histogram
+PagedVolume::histogram(uint32_t c, uint32_t t, size_t bins)
+{
+  // count every 16-bit value in one pass over the bricks, then bin the counts as Histogram would bin the voxels
+  std::vector<uint64_t> counts(65536, 0);
+  size_t pixelCount = 0;
+  for (uint32_t bz = 0; bz < m_bricksZ; ++bz) {
+    for (uint32_t by = 0; by < m_bricksY; ++by) {
+      for (uint32_t bx = 0; bx < m_bricksX; ++bx) {
+        std::shared_ptr<const Brick> b = brick(c, t, bx, by, bz);
+        if (!b) {
+          // a histogram missing some of the channel would look valid but be wrong
+          return Histogram(std::vector<uint32_t>(bins, 0), 0, 0, 0);
+        }
+        for (uint16_t v : b->voxels) {
+          counts[v]++;
+        }
+        pixelCount += b->voxels.size();
+      }
+    }
+  }
+
+  uint32_t dataMin = 0, dataMax = 0;
+  if (pixelCount > 0) {
+    while (counts[dataMin] == 0) {
+      ++dataMin;
+    }
+    dataMax = 65535;
+    while (counts[dataMax] == 0) {
+      --dataMax;
+    }
+  }
+  float range = (float)(dataMax - dataMin);
+  if (range == 0.0f) {
+    range = 1.0f;
+  }
+  float binmax = (float)(bins - 1);
+  std::vector<uint64_t> binned(bins, 0);
+  for (uint32_t v = dataMin; v <= dataMax && pixelCount > 0; ++v) {
+    if (counts[v] > 0) {
+      binned[(size_t)((float)(v - dataMin) / range * binmax + 0.5)] += counts[v];
+    }
+  }
+  std::vector<uint32_t> saturated(bins);
+  for (size_t i = 0; i < bins; ++i) {
+    saturated[i] = (uint32_t)std::min<uint64_t>(binned[i], std::numeric_limits<uint32_t>::max());
+  }
+  return Histogram(saturated, (uint16_t)dataMin, (uint16_t)dataMax, pixelCount);
+}
+
+void
+PagedVolume::setBudget(size_t budget)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_budget = budget;
+  evict(m_budget);
+}
+
+PagedVolume::Stats
+PagedVolume::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Stats stats = m_stats;
+  stats.bricks = m_entries.size();
+  stats.bytes = m_bytes;
+  stats.budget = m_budget;
+  return stats;
+}
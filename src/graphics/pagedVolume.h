@@ -0,0 +1,111 @@
+#pragma once
+
+#include "histogram.h"
+#include "volumeDimensions.h"
+#include "voxelRegion.h"
+
+#include <inttypes.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+// Where a PagedVolume gets its voxels: anything that can read an arbitrary box of one channel at one timepoint,
+// such as a file format that stores its data in bricks or chunks.
+class BrickSource
+{
+public:
+  virtual ~BrickSource() {}
+
+  virtual VolumeDimensions dimensions() const = 0;
+  // size along x, y and z of the bricks the source reads best, e.g. the bricks or chunks of the file
+  virtual void brickSize(uint32_t& x, uint32_t& y, uint32_t& z) const = 0;
+  // Reads the voxels of region of channel c at time t into dst, as 16-bit values with x varying fastest, then y,
+  // then z. Returns false on failure. Called from several threads at once.
+  virtual bool readRegion(uint32_t c, uint32_t t, const VoxelRegion& region, uint16_t* dst) = 0;
+};
+
+// A volume that doesn't need to fit in memory: it is cut into bricks that are read from a BrickSource the first
+// time they are used, and dropped again, least recently used first, to keep within a memory budget.
+// Slicing and histograms go brick by brick, so that no more than the budget (and the bricks in use) is ever held at
+// once. Thread-safe. Nothing uses it yet: the renderers, slicing and Scene still take a whole ImageXYZC.
+class PagedVolume
+{
+public:
+  // brickSize 0 means the source's own bricks, anything else cubes of that size
+  PagedVolume(std::shared_ptr<BrickSource> source, size_t budget, uint32_t brickSize = 0);
+
+  struct Brick
+  {
+    // the voxels the brick covers: a whole brick, or less at the far edges of the volume
+    VoxelRegion region;
+    // x varying fastest, then y, then z
+    std::vector<uint16_t> voxels;
+  };
+
+  struct Stats
+  {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t bricks = 0;
+    size_t bytes = 0;
+    size_t budget = 0;
+  };
+
+  const VolumeDimensions& dimensions() const { return m_dims; }
+  uint32_t brickSizeX() const { return m_brickX; }
+  uint32_t brickSizeY() const { return m_brickY; }
+  uint32_t brickSizeZ() const { return m_brickZ; }
+  uint32_t bricksX() const { return m_bricksX; }
+  uint32_t bricksY() const { return m_bricksY; }
+  uint32_t bricksZ() const { return m_bricksZ; }
+
+  // A brick, read from the source if it isn't resident. The brick stays valid for as long as it is held, even if
+  // the pool evicts it meanwhile. Empty if the source fails.
+  std::shared_ptr<const Brick> brick(uint32_t c, uint32_t t, uint32_t bx, uint32_t by, uint32_t bz);
+  // Reads the bricks that overlap region, in parallel, so that later requests for them don't wait.
+  // Reading more than the budget holds evicts the first of them again.
+  void prefetch(uint32_t c, uint32_t t, const VoxelRegion& region);
+
+  // Copies a box of voxels, e.g. a slice, into dst (x fastest, then y, then z), brick by brick.
+  bool readRegion(uint32_t c, uint32_t t, const VoxelRegion& region, uint16_t* dst);
+  uint16_t voxel(uint32_t c, uint32_t t, uint32_t x, uint32_t y, uint32_t z);
+  // The histogram of a whole channel, computed brick by brick: the same as a Histogram of the channel's data, except
+  // that bins are capped at 2^32 - 1 voxels, which only channels of over 4 billion voxels can reach. Empty, with a
+  // pixel count of 0, if the source fails to read a brick.
+  Histogram histogram(uint32_t c, uint32_t t, size_t bins = 256);
+
+  // shrinking the budget evicts right away
+  void setBudget(size_t budget);
+  Stats stats() const;
+
+private:
+  typedef std::tuple<uint32_t, uint32_t, uint32_t, uint32_t, uint32_t> BrickKey;
+  struct Entry
+  {
+    BrickKey key;
+    std::shared_ptr<const Brick> brick;
+    size_t bytes;
+  };
+  typedef std::list<Entry> EntryList;
+
+  VoxelRegion brickRegion(uint32_t bx, uint32_t by, uint32_t bz) const;
+  // call with m_mutex held
+  void evict(size_t budget);
+
+  std::shared_ptr<BrickSource> m_source;
+  VolumeDimensions m_dims;
+  uint32_t m_brickX, m_brickY, m_brickZ;
+  uint32_t m_bricksX, m_bricksY, m_bricksZ;
+
+  mutable std::mutex m_mutex;
+  // most recently used first
+  EntryList m_entries;
+  std::map<BrickKey, EntryList::iterator> m_index;
+  size_t m_bytes = 0;
+  size_t m_budget;
+  Stats m_stats;
+};
@@ -0,0 +1,72 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+uint32_t
+hardwareThreadCount()
+{
+  // hardware_concurrency is allowed to return 0 if it can't tell
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+uint32_t
+parallelThreadCount(size_t count, uint32_t numThreads)
+{
+  if (numThreads == 0) {
+    numThreads = hardwareThreadCount();
+  }
+  return (uint32_t)std::max<size_t>(1, std::min<size_t>(count, numThreads));
+}
+
+void
+parallelFor(size_t count, uint32_t numThreads, const std::function<void(size_t index, uint32_t worker)>& fn)
+{
+  if (count == 0) {
+    return;
+  }
+  uint32_t nthreads = parallelThreadCount(count, numThreads);
+  if (nthreads == 1) {
+    for (size_t i = 0; i < count; ++i) {
+      fn(i, 0);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next(0);
+  std::atomic<bool> stop(false);
+  std::exception_ptr firstError;
+  std::mutex errorMutex;
+
+  auto work = [&](uint32_t worker) {
+    for (size_t i = next++; i < count && !stop; i = next++) {
+      try {
+        fn(i, worker);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!firstError) {
+          firstError = std::current_exception();
+        }
+        stop = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads - 1);
+  for (uint32_t t = 1; t < nthreads; ++t) {
+    threads.emplace_back(work, t);
+  }
+  work(0);
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  if (firstError) {
+    std::rethrow_exception(firstError);
+  }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <functional>
+#include <inttypes.h>
+#include <stddef.h>
+
+// number of hardware threads available to this process, at least 1.
+uint32_t hardwareThreadCount();
+
+// number of threads that parallelFor will actually run for this many items.
+// numThreads == 0 means use hardwareThreadCount().
+uint32_t parallelThreadCount(size_t count, uint32_t numThreads = 0);
+
+// Call fn(index, worker) for every index in [0, count), spread across up to numThreads threads
+// (0 means hardwareThreadCount()). The calling thread takes part as worker 0.
+// Indices are handed out in increasing order, one at a time, so callers that sort their work
+// get it processed roughly in that order. worker is in [0, parallelThreadCount(count, numThreads))
+// and identifies the thread, so that callers can keep per-thread state such as file handles.
+// If fn throws, no further indices are handed out and the first exception is rethrown here
+// once all workers have stopped.
+void
+parallelFor(size_t count, uint32_t numThreads, const std::function<void(size_t index, uint32_t worker)>& fn);
@@ -0,0 +1,332 @@
+#include "pixelConversion.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <math.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define AGAVE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AGAVE_NEON 1
+#endif
+
+void
+widen8to16(const uint8_t* src, uint16_t* dst, size_t count)
+{
+  size_t i = 0;
+#if defined(AGAVE_SSE2)
+  // interleave 16 bytes with zeros to get 16 little endian uint16s
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(v, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+  }
+#elif defined(AGAVE_NEON)
+  for (; i + 16 <= count; i += 16) {
+    uint8x16_t v = vld1q_u8(src + i);
+    vst1q_u16(dst + i, vmovl_u8(vget_low_u8(v)));
+    vst1q_u16(dst + i + 8, vmovl_u8(vget_high_u8(v)));
+  }
+#endif
+  for (; i < count; ++i) {
+    dst[i] = src[i];
+  }
+}
+
+void
+byteSwap16(const uint8_t* src, uint16_t* dst, size_t count)
+{
+  size_t i = 0;
+#if defined(AGAVE_SSE2)
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+  }
+#elif defined(AGAVE_NEON)
+  for (; i + 8 <= count; i += 8) {
+    uint8x16_t v = vld1q_u8(src + i * 2);
+    vst1q_u16(dst + i, vreinterpretq_u16_u8(vrev16q_u8(v)));
+  }
+#endif
+  for (; i < count; ++i) {
+    dst[i] = (uint16_t)((src[i * 2] << 8) | src[i * 2 + 1]);
+  }
+}
+
+void
+byteSwap32(const uint8_t* src, uint32_t* dst, size_t count)
+{
+  size_t i = 0;
+#if defined(AGAVE_SSE2)
+  const __m128i mask = _mm_set1_epi32(0x00ff00ff);
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+    // swap the bytes within each 16-bit half, then the halves
+    v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 8), mask), _mm_slli_epi16(_mm_and_si128(v, mask), 8));
+    v = _mm_or_si128(_mm_srli_epi32(v, 16), _mm_slli_epi32(v, 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+  }
+#elif defined(AGAVE_NEON)
+  for (; i + 4 <= count; i += 4) {
+    uint8x16_t v = vld1q_u8(src + i * 4);
+    vst1q_u32(dst + i, vreinterpretq_u32_u8(vrev32q_u8(v)));
+  }
+#endif
+  for (; i < count; ++i) {
+    const uint8_t* p = src + i * 4;
+    dst[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+  }
+}
+
+// The 32-bit kernels below are vectorized for SSE2; elsewhere their plain loops are left to the compiler.
+
+void
+minMaxFloat32(const float* src, size_t count, float& min, float& max)
+{
+  float lo = std::numeric_limits<float>::infinity();
+  float hi = -std::numeric_limits<float>::infinity();
+  size_t i = 0;
+#if defined(AGAVE_SSE2)
+  // infinities are swapped for the running min and max, which changes nothing. minps and maxps return their second
+  // operand when either is NaN, so NaNs in the data never get in either.
+  __m128 vlo = _mm_set1_ps(lo);
+  __m128 vhi = _mm_set1_ps(hi);
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+  for (; i + 4 <= count; i += 4) {
+    __m128 v = _mm_loadu_ps(src + i);
+    __m128 infinite = _mm_cmpeq_ps(_mm_and_ps(v, absMask), inf);
+    vlo = _mm_min_ps(_mm_or_ps(_mm_andnot_ps(infinite, v), _mm_and_ps(infinite, vlo)), vlo);
+    vhi = _mm_max_ps(_mm_or_ps(_mm_andnot_ps(infinite, v), _mm_and_ps(infinite, vhi)), vhi);
+  }
+  float los[4], his[4];
+  _mm_storeu_ps(los, vlo);
+  _mm_storeu_ps(his, vhi);
+  for (int k = 0; k < 4; ++k) {
+    lo = std::min(lo, los[k]);
+    hi = std::max(hi, his[k]);
+  }
+#endif
+  for (; i < count; ++i) {
+    if (!std::isfinite(src[i])) {
+      continue;
+    }
+    if (src[i] < lo) {
+      lo = src[i];
+    }
+    if (src[i] > hi) {
+      hi = src[i];
+    }
+  }
+  min = lo;
+  max = hi;
+}
+
+void
+minMaxUint32(const uint32_t* src, size_t count, uint32_t& min, uint32_t& max)
+{
+  uint32_t lo = std::numeric_limits<uint32_t>::max();
+  uint32_t hi = 0;
+  size_t i = 0;
+#if defined(AGAVE_SSE2)
+  // SSE2 only compares signed integers: flipping the sign bit maps unsigned order onto signed order
+  const __m128i flip = _mm_set1_epi32((int)0x80000000u);
+  __m128i vlo = _mm_set1_epi32((int)(lo ^ 0x80000000u));
+  __m128i vhi = _mm_set1_epi32((int)(hi ^ 0x80000000u));
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), flip);
+    __m128i less = _mm_cmplt_epi32(v, vlo);
+    vlo = _mm_or_si128(_mm_and_si128(less, v), _mm_andnot_si128(less, vlo));
+    __m128i greater = _mm_cmpgt_epi32(v, vhi);
+    vhi = _mm_or_si128(_mm_and_si128(greater, v), _mm_andnot_si128(greater, vhi));
+  }
+  uint32_t los[4], his[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(los), _mm_xor_si128(vlo, flip));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(his), _mm_xor_si128(vhi, flip));
+  for (int k = 0; k < 4; ++k) {
+    lo = std::min(lo, los[k]);
+    hi = std::max(hi, his[k]);
+  }
+#endif
+  for (; i < count; ++i) {
+    lo = std::min(lo, src[i]);
+    hi = std::max(hi, src[i]);
+  }
+  min = lo;
+  max = hi;
+}
+
+void
+scaleFloat32To16(const float* src, uint16_t* dst, size_t count, float min, float max)
+{
+  const float scale = max > min ? 65535.0f / (max - min) : 0.0f;
+  size_t i = 0;
+#if defined(AGAVE_SSE2)
+  const __m128 vmin = _mm_set1_ps(min);
+  const __m128 vscale = _mm_set1_ps(scale);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 top = _mm_set1_ps(65535.0f);
+  // SSE2 can only pack to signed 16 bits: pack around 32768 and flip the sign bit back
+  const __m128i bias = _mm_set1_epi32(32768);
+  const __m128i flip = _mm_set1_epi16((short)0x8000);
+  const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+  for (; i + 8 <= count; i += 8) {
+    __m128 va = _mm_loadu_ps(src + i);
+    __m128 vb = _mm_loadu_ps(src + i + 4);
+    __m128 a = _mm_mul_ps(_mm_sub_ps(va, vmin), vscale);
+    __m128 b = _mm_mul_ps(_mm_sub_ps(vb, vmin), vscale);
+    // maxps with zero second turns NaN into 0
+    a = _mm_min_ps(_mm_max_ps(a, zero), top);
+    b = _mm_min_ps(_mm_max_ps(b, zero), top);
+    // +inf times a scale of 0 is NaN: set it to the top explicitly
+    __m128 infa = _mm_cmpeq_ps(va, inf);
+    __m128 infb = _mm_cmpeq_ps(vb, inf);
+    a = _mm_or_ps(_mm_andnot_ps(infa, a), _mm_and_ps(infa, top));
+    b = _mm_or_ps(_mm_andnot_ps(infb, b), _mm_and_ps(infb, top));
+    __m128i ia = _mm_sub_epi32(_mm_cvtps_epi32(a), bias);
+    __m128i ib = _mm_sub_epi32(_mm_cvtps_epi32(b), bias);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(_mm_packs_epi32(ia, ib), flip));
+  }
+#endif
+  for (; i < count; ++i) {
+    if (src[i] == std::numeric_limits<float>::infinity()) {
+      dst[i] = 65535;
+      continue;
+    }
+    float v = (src[i] - min) * scale;
+    // rounds to nearest even, as cvtps does
+    dst[i] = (uint16_t)lrintf(v > 0.0f ? std::min(v, 65535.0f) : 0.0f);
+  }
+}
+
+void
+scaleUint32To16(const uint32_t* src, uint16_t* dst, size_t count, uint32_t min, uint32_t max)
+{
+  const float scale = max > min ? 65535.0f / (float)(max - min) : 0.0f;
+  size_t i = 0;
+#if defined(AGAVE_SSE2)
+  // clamp in signed order with the sign bits flipped, as minMaxUint32 compares
+  const __m128i flip = _mm_set1_epi32((int)0x80000000u);
+  const __m128i vmin = _mm_set1_epi32((int)(min ^ 0x80000000u));
+  const __m128i vmax = _mm_set1_epi32((int)(max ^ 0x80000000u));
+  const __m128i offset = _mm_set1_epi32((int)min);
+  const __m128i low = _mm_set1_epi32(0xffff);
+  const __m128 high = _mm_set1_ps(65536.0f);
+  const __m128 vscale = _mm_set1_ps(scale);
+  const __m128 top = _mm_set1_ps(65535.0f);
+  const __m128i bias = _mm_set1_epi32(32768);
+  const __m128i flip16 = _mm_set1_epi16((short)0x8000);
+  auto scale4 = [&](const uint32_t* p) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), flip);
+    __m128i less = _mm_cmplt_epi32(v, vmin);
+    v = _mm_or_si128(_mm_and_si128(less, vmin), _mm_andnot_si128(less, v));
+    __m128i greater = _mm_cmpgt_epi32(v, vmax);
+    v = _mm_or_si128(_mm_and_si128(greater, vmax), _mm_andnot_si128(greater, v));
+    __m128i d = _mm_sub_epi32(_mm_xor_si128(v, flip), offset);
+    // cvtdq2ps only converts signed values: convert the two 16-bit halves exactly and add them
+    __m128 f = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(d, 16)), high),
+                          _mm_cvtepi32_ps(_mm_and_si128(d, low)));
+    f = _mm_min_ps(_mm_mul_ps(f, vscale), top);
+    return _mm_sub_epi32(_mm_cvtps_epi32(f), bias);
+  };
+  for (; i + 8 <= count; i += 8) {
+    __m128i packed = _mm_packs_epi32(scale4(src + i), scale4(src + i + 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(packed, flip16));
+  }
+#endif
+  for (; i < count; ++i) {
+    uint32_t d = std::min(std::max(src[i], min), max) - min;
+    // the same float arithmetic as the vector loop, so that results don't depend on where a value falls
+    float f = (float)(d >> 16) * 65536.0f + (float)(d & 0xffff);
+    dst[i] = (uint16_t)lrintf(std::min(f * scale, 65535.0f));
+  }
+}
+
+// voxels per block of the normalizing passes: enough to amortize handing out a block, small enough to spread a
+// single channel across all threads
+static const size_t NORMALIZE_BLOCK = 1 << 20;
+
+template<typename T, typename Scale>
+static void
+scaleInBlocks(const T* src, uint16_t* dst, size_t count, uint32_t numThreads, T min, T max, Scale scale)
+{
+  const size_t blocks = (count + NORMALIZE_BLOCK - 1) / NORMALIZE_BLOCK;
+  parallelFor(blocks, numThreads, [&](size_t b, uint32_t) {
+    size_t first = b * NORMALIZE_BLOCK;
+    scale(src + first, dst + first, std::min(NORMALIZE_BLOCK, count - first), min, max);
+  });
+}
+
+template<typename T, typename MinMax, typename Scale>
+static void
+normalizeTo16(const T* src,
+              uint16_t* dst,
+              size_t count,
+              uint32_t numThreads,
+              T& min,
+              T& max,
+              MinMax minMax,
+              Scale scale,
+              bool keepIfFits)
+{
+  const size_t blocks = (count + NORMALIZE_BLOCK - 1) / NORMALIZE_BLOCK;
+  std::vector<T> los(blocks), his(blocks);
+  parallelFor(blocks, numThreads, [&](size_t b, uint32_t) {
+    size_t first = b * NORMALIZE_BLOCK;
+    minMax(src + first, std::min(NORMALIZE_BLOCK, count - first), los[b], his[b]);
+  });
+  minMax(los.data(), 0, min, max);
+  for (size_t b = 0; b < blocks; ++b) {
+    // blocks of nothing but NaNs and infinities have lo > hi and change nothing
+    if (los[b] <= his[b]) {
+      min = std::min(min, los[b]);
+      max = std::max(max, his[b]);
+    }
+  }
+
+  T from = min, to = max;
+  if (keepIfFits && min <= max && max <= T(65535)) {
+    from = T(0);
+    to = T(65535);
+  }
+  scaleInBlocks(src, dst, count, numThreads, from, to, scale);
+  min = from;
+  max = to;
+}
+
+void
+normalizeFloat32To16(const float* src, uint16_t* dst, size_t count, uint32_t numThreads, float& min, float& max)
+{
+  normalizeTo16(src, dst, count, numThreads, min, max, minMaxFloat32, scaleFloat32To16, false);
+}
+
+void
+normalizeUint32To16(const uint32_t* src,
+                    uint16_t* dst,
+                    size_t count,
+                    uint32_t numThreads,
+                    uint32_t& min,
+                    uint32_t& max)
+{
+  normalizeTo16(src, dst, count, numThreads, min, max, minMaxUint32, scaleUint32To16, true);
+}
+
+void
+convertFloat32To16(const float* src, uint16_t* dst, size_t count, uint32_t numThreads, float min, float max)
+{
+  scaleInBlocks(src, dst, count, numThreads, min, max, scaleFloat32To16);
+}
+
+void
+convertUint32To16(const uint32_t* src, uint16_t* dst, size_t count, uint32_t numThreads, uint32_t min, uint32_t max)
+{
+  scaleInBlocks(src, dst, count, numThreads, min, max, scaleUint32To16);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// Zero-extend count 8-bit values into 16-bit values. src and dst must not overlap.
+void
+widen8to16(const uint8_t* src, uint16_t* dst, size_t count);
+
+// Swap the two bytes of count 16-bit values, e.g. to read big endian data on a little endian machine.
+// src does not need to be aligned. src and dst must not overlap.
+void
+byteSwap16(const uint8_t* src, uint16_t* dst, size_t count);
+
+// Swap the four bytes of count 32-bit values. src does not need to be aligned. src and dst must not overlap.
+void
+byteSwap32(const uint8_t* src, uint32_t* dst, size_t count);
+
+// The smallest and largest of count values. NaNs and infinities are ignored; min > max if there are no other values.
+void
+minMaxFloat32(const float* src, size_t count, float& min, float& max);
+void
+minMaxUint32(const uint32_t* src, size_t count, uint32_t& min, uint32_t& max);
+
+// Map count values linearly from [min, max] onto [0, 65535], rounding to nearest. Values outside the range are
+// clamped, so +inf becomes 65535 and -inf 0, and NaNs become 0; if max <= min everything else becomes 0.
+void
+scaleFloat32To16(const float* src, uint16_t* dst, size_t count, float min, float max);
+void
+scaleUint32To16(const uint32_t* src, uint16_t* dst, size_t count, uint32_t min, uint32_t max);
+
+// Convert one channel of 32-bit values to 16 bits on up to numThreads threads: one pass finds the range of the values,
+// a second scales them to fill [0, 65535]. Unsigned values that all fit in 16 bits are kept as they are.
+// The range the values were scaled from is returned in min and max, so that a 16-bit value v stands for
+// min + v * (max - min) / 65535, e.g. to show the values in their original units.
+void
+normalizeFloat32To16(const float* src, uint16_t* dst, size_t count, uint32_t numThreads, float& min, float& max);
+void
+normalizeUint32To16(const uint32_t* src,
+                    uint16_t* dst,
+                    size_t count,
+                    uint32_t numThreads,
+                    uint32_t& min,
+                    uint32_t& max);
+
+// As above, but scaling from a range given beforehand (e.g. one that holds for every timepoint of a file) instead of
+// the range of these values, so that the same value always converts the same way. Nothing is kept as it is.
+void
+convertFloat32To16(const float* src, uint16_t* dst, size_t count, uint32_t numThreads, float min, float max);
+void
+convertUint32To16(const uint32_t* src, uint16_t* dst, size_t count, uint32_t numThreads, uint32_t min, uint32_t max);
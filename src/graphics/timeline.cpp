@@ -1,7 +1,7 @@
 #include "timeline.h"
 
 int32_t
-Timeline::forceInRange(int32_t t)
+Timeline::forceInRange(int32_t t) const
 {
   if (m_wrapMode == WrapMode::TIMELINE_WRAP) {
     // if current time is below min, then advance it until it is in range or above!
@@ -32,6 +32,9 @@ Timeline::Timeline(int32_t minTime, int32_t maxTime, WrapMode wrapMode)
 int32_t
 Timeline::increment(int32_t delta)
 {
+  if (delta != 0) {
+    m_direction = delta > 0 ? 1 : -1;
+  }
   m_CurrentTime = forceInRange(m_CurrentTime + delta);
   return m_CurrentTime;
 }
@@ -52,3 +55,23 @@ Timeline::setRange(int32_t minT, int32_t maxT)
 
   m_CurrentTime = forceInRange(m_CurrentTime);
 }
+
+std::vector<int32_t>
+Timeline::upcomingTimes(uint32_t count) const
+{
+  std::vector<int32_t> times;
+  int32_t t = m_CurrentTime;
+  for (uint32_t i = 0; i < count; ++i) {
+    int32_t next = t + m_direction;
+    if (m_wrapMode == WrapMode::TIMELINE_CLAMP && (next < m_MinTime || next > m_MaxTime)) {
+      break;
+    }
+    next = forceInRange(next);
+    if (next == m_CurrentTime) {
+      break;
+    }
+    times.push_back(next);
+    t = next;
+  }
+  return times;
+}
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <inttypes.h>
+#include <vector>
 
 class Timeline
 {
@@ -25,15 +26,24 @@ public:
   void setRange(int32_t minT, int32_t maxT);
 
   void setWrap(WrapMode wrapMode) { m_wrapMode = wrapMode; }
+  WrapMode wrapMode() const { return m_wrapMode; }
+
+  // direction of the last increment: 1 forward, -1 backward
+  int32_t direction() const { return m_direction; }
+
+  // The next count times that incrementing in the current direction will reach, nearest first.
+  // Stops early at the end of the range when clamping, or before coming back around to the current time when wrapping.
+  std::vector<int32_t> upcomingTimes(uint32_t count) const;
 
 private:
   int32_t m_MinTime = 0;
   int32_t m_MaxTime = 0;
   int32_t m_RangeSize = 1;
   int32_t m_CurrentTime = 0;
+  int32_t m_direction = 1;
 
   // false means clamp, true means wrap
   WrapMode m_wrapMode = WrapMode::TIMELINE_WRAP;
 
-  int32_t forceInRange(int32_t t);
+  int32_t forceInRange(int32_t t) const;
 };
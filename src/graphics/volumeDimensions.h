@@ -16,6 +16,10 @@ struct VolumeDimensions
   uint32_t bitsPerPixel = 16;
   std::string dimensionOrder = "XYZCT";
   std::vector<std::string> channelNames;
+  // For pixels of other types (32-bit integers or floats) scaled to 16 bits when read: per channel, the value in the
+  // file of a 16-bit value v is valueOffsets[c] + v * valueScales[c]. Empty when the values are as in the file.
+  std::vector<double> valueOffsets;
+  std::vector<double> valueScales;
 
   uint32_t getPlaneIndex(uint32_t z, uint32_t c, uint32_t t) const;
   std::vector<uint32_t> getPlaneZCT(uint32_t planeIndex) const;
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <algorithm>
+#include <inttypes.h>
+#include <tuple>
+
+// A box of voxels, [minX, maxX) x [minY, maxY) x [minZ, maxZ). The default box, all zeros, stands for the whole volume.
+struct VoxelRegion
+{
+  uint32_t minX = 0;
+  uint32_t minY = 0;
+  uint32_t minZ = 0;
+  uint32_t maxX = 0;
+  uint32_t maxY = 0;
+  uint32_t maxZ = 0;
+
+  bool isEmpty() const { return maxX <= minX || maxY <= minY || maxZ <= minZ; }
+  bool isWhole() const { return *this == VoxelRegion(); }
+  // Whether the box can be read: the whole volume, or a box with voxels in it. Any other empty box, e.g. one with
+  // minZ == maxZ or minX > maxX, is a mistake rather than a request for everything.
+  bool isValid() const { return isWhole() || !isEmpty(); }
+  uint32_t sizeX() const { return maxX - minX; }
+  uint32_t sizeY() const { return maxY - minY; }
+  uint32_t sizeZ() const { return maxZ - minZ; }
+
+  // The part of this region inside a volume of the given size, or the whole volume for the default box.
+  // Empty if this region is invalid or lies entirely outside the volume.
+  VoxelRegion clampedTo(uint32_t x, uint32_t y, uint32_t z) const
+  {
+    VoxelRegion clamped;
+    if (isWhole()) {
+      clamped.maxX = x;
+      clamped.maxY = y;
+      clamped.maxZ = z;
+      return clamped;
+    }
+    clamped.minX = std::min(minX, x);
+    clamped.minY = std::min(minY, y);
+    clamped.minZ = std::min(minZ, z);
+    clamped.maxX = std::min(maxX, x);
+    clamped.maxY = std::min(maxY, y);
+    clamped.maxZ = std::min(maxZ, z);
+    return clamped;
+  }
+
+  bool operator==(const VoxelRegion& other) const
+  {
+    return std::tie(minX, minY, minZ, maxX, maxY, maxZ) ==
+           std::tie(other.minX, other.minY, other.minZ, other.maxX, other.maxY, other.maxZ);
+  }
+  bool operator<(const VoxelRegion& other) const
+  {
+    return std::tie(minX, minY, minZ, maxX, maxY, maxZ) <
+           std::tie(other.minX, other.minY, other.minZ, other.maxX, other.maxY, other.maxZ);
+  }
+};
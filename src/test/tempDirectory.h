@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+// A directory for the files a test writes. It is removed when it goes out of scope, together with everything that was
+// made through it.
+class TempDirectory
+{
+public:
+  TempDirectory(const std::string& name)
+  {
+    const char* base = std::getenv("TMPDIR");
+    if (!base) {
+      base = std::getenv("TEMP");
+    }
+#ifdef _WIN32
+    m_path = std::string(base ? base : ".") + "/" + name + "_" + std::to_string(_getpid());
+#else
+    m_path = std::string(base ? base : "/tmp") + "/" + name + "_" + std::to_string(getpid());
+#endif
+    makeDirectory(m_path);
+  }
+  ~TempDirectory()
+  {
+    for (auto it = m_made.rbegin(); it != m_made.rend(); ++it) {
+      if (it->second) {
+        removeDirectory(it->first);
+      } else {
+        std::remove(it->first.c_str());
+      }
+    }
+    removeDirectory(m_path);
+  }
+
+  const std::string& path() const { return m_path; }
+
+  // Makes a directory, and any missing parents, under this one.
+  std::string directory(const std::string& relative)
+  {
+    for (size_t pos = relative.find('/'); pos != std::string::npos; pos = relative.find('/', pos + 1)) {
+      directory(relative.substr(0, pos));
+    }
+    std::string full = m_path + "/" + relative;
+    struct stat st;
+    if (stat(full.c_str(), &st) != 0) {
+      makeDirectory(full);
+      m_made.push_back({ full, true });
+    }
+    return full;
+  }
+
+  // A path under this one for a file that the code under test writes. Its directory must exist.
+  std::string file(const std::string& relative)
+  {
+    std::string full = m_path + "/" + relative;
+    m_made.push_back({ full, false });
+    return full;
+  }
+
+  // Writes a file under this one, making its directory if needed.
+  std::string write(const std::string& relative, const void* data, size_t size)
+  {
+    size_t slash = relative.rfind('/');
+    if (slash != std::string::npos) {
+      directory(relative.substr(0, slash));
+    }
+    std::string full = file(relative);
+    std::FILE* out = std::fopen(full.c_str(), "wb");
+    if (out) {
+      std::fwrite(data, 1, size, out);
+      std::fclose(out);
+    }
+    return full;
+  }
+  std::string write(const std::string& relative, const std::string& text)
+  {
+    return write(relative, text.data(), text.size());
+  }
+
+private:
+  static void makeDirectory(const std::string& path)
+  {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+  }
+  static void removeDirectory(const std::string& path)
+  {
+#ifdef _WIN32
+    _rmdir(path.c_str());
+#else
+    rmdir(path.c_str());
+#endif
+  }
+
+  std::string m_path;
+  // what was made under the directory, in order, and whether each is a directory
+  std::vector<std::pair<std::string, bool>> m_made;
+};
@@ -0,0 +1,58 @@
+#include "catch.hpp"
+
+#include "fileformats/cziSubBlockIndex.h"
+
+#include <vector>
+
+static CziSubBlock
+makeSubBlock(int index, int m, int x, int y, uint32_t size)
+{
+  return CziSubBlock{ index, m, libCZI::IntRect{ x, y, (int)size * 2, (int)size * 2 }, libCZI::IntSize{ size, size } };
+}
+
+TEST_CASE("CZI subblocks are grouped into planes", "[czi]")
+{
+  SECTION("Pyramid tiles without M indices are all kept")
+  {
+    CziSubBlockIndex index;
+    index.add({ 0, 0, 0, 0, 1 }, makeSubBlock(4, -1, 0, 0, 256));
+    index.add({ 0, 0, 0, 0, 1 }, makeSubBlock(5, -1, 512, 0, 256));
+
+    const std::vector<CziSubBlock>* tiles = index.tiles({ 0, 0, 0, 0, 1 });
+    REQUIRE(tiles != nullptr);
+    REQUIRE(tiles->size() == 2);
+    REQUIRE((*tiles)[0].index == 4);
+    REQUIRE((*tiles)[1].index == 5);
+    REQUIRE(index.maxTilesPerPlane() == 2);
+    REQUIRE(index.layers().count(1) == 1);
+    REQUIRE(index.tiles({ 0, 0, 0, 0, 0 }) == nullptr);
+  }
+
+  SECTION("Only the first subblock of each tile is kept")
+  {
+    CziSubBlockIndex index;
+    index.add({ 0, 0, 0, 0, 1 }, makeSubBlock(4, -1, 0, 0, 256));
+    index.add({ 0, 0, 0, 0, 1 }, makeSubBlock(5, -1, 0, 0, 256));
+    index.add({ 0, 0, 0, 0, 0 }, makeSubBlock(0, 0, 0, 0, 512));
+    index.add({ 0, 0, 0, 0, 0 }, makeSubBlock(1, 0, 512, 0, 512));
+
+    REQUIRE(index.tiles({ 0, 0, 0, 0, 1 })->size() == 1);
+    REQUIRE(index.tiles({ 0, 0, 0, 0, 1 })->at(0).index == 4);
+    REQUIRE(index.tiles({ 0, 0, 0, 0, 0 })->size() == 1);
+    REQUIRE(index.tiles({ 0, 0, 0, 0, 0 })->at(0).index == 0);
+  }
+
+  SECTION("Mosaic tiles are in increasing M order")
+  {
+    CziSubBlockIndex index;
+    index.add({ 0, 1, 0, 0, 0 }, makeSubBlock(0, 2, 0, 0, 512));
+    index.add({ 0, 1, 0, 0, 0 }, makeSubBlock(1, 0, 512, 0, 512));
+    index.add({ 0, 1, 0, 0, 0 }, makeSubBlock(2, 1, 0, 512, 512));
+
+    const std::vector<CziSubBlock>* tiles = index.tiles({ 0, 1, 0, 0, 0 });
+    REQUIRE(tiles->size() == 3);
+    REQUIRE((*tiles)[0].m == 0);
+    REQUIRE((*tiles)[1].m == 1);
+    REQUIRE((*tiles)[2].m == 2);
+  }
+}
@@ -0,0 +1,297 @@
+#include "catch.hpp"
+
+#include "tempDirectory.h"
+
+#include "fileformats/fileReaderBricks.h"
+#include "graphics/imageXYZC.h"
+#include "graphics/pagedVolume.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// a 2 timepoint, 2 channel volume of 19 x 13 x 10 voxels, in bricks of 8 so that bricks overhang every far edge
+static const uint32_t SIZE_X = 19, SIZE_Y = 13, SIZE_Z = 10, SIZE_C = 2, SIZE_T = 2;
+static const uint32_t BRICK_SIZE = 8;
+
+// Channel 0 varies smoothly, so that its bricks compress; channel 1 is noise, so that its bricks are stored raw.
+static uint16_t
+voxel(uint32_t bits, uint32_t t, uint32_t c, uint32_t x, uint32_t y, uint32_t z)
+{
+  uint32_t value = t * 1000 + z * 100 + y * 5 + x;
+  if (c == 1) {
+    // the final mix of MurmurHash3, of a number unique to the voxel
+    value = ((t * SIZE_Z + z) * SIZE_Y + y) * SIZE_X + x;
+    value = (value ^ (value >> 16)) * 0x85ebca6bu;
+    value = (value ^ (value >> 13)) * 0xc2b2ae35u;
+    value ^= value >> 16;
+  }
+  return uint16_t(bits == 8 ? value & 0xff : value & 0xffff);
+}
+
+static VolumeDimensions
+volumeDimensions(uint32_t bits)
+{
+  VolumeDimensions dims;
+  dims.sizeX = SIZE_X;
+  dims.sizeY = SIZE_Y;
+  dims.sizeZ = SIZE_Z;
+  dims.sizeC = SIZE_C;
+  dims.sizeT = SIZE_T;
+  dims.bitsPerPixel = bits;
+  dims.physicalSizeX = 0.5f;
+  dims.physicalSizeY = 0.5f;
+  dims.physicalSizeZ = 2.0f;
+  dims.channelNames = { "DNA", "Membrane" };
+  return dims;
+}
+
+static std::shared_ptr<ImageXYZC>
+makeTimepoint(uint32_t bits, uint32_t t)
+{
+  const size_t bytes = bits / 8;
+  uint8_t* data = new uint8_t[size_t(SIZE_X) * SIZE_Y * SIZE_Z * SIZE_C * bytes];
+  size_t i = 0;
+  for (uint32_t c = 0; c < SIZE_C; ++c) {
+    for (uint32_t z = 0; z < SIZE_Z; ++z) {
+      for (uint32_t y = 0; y < SIZE_Y; ++y) {
+        for (uint32_t x = 0; x < SIZE_X; ++x, ++i) {
+          uint16_t value = voxel(bits, t, c, x, y, z);
+          if (bytes == 1) {
+            data[i] = uint8_t(value);
+          } else {
+            reinterpret_cast<uint16_t*>(data)[i] = value;
+          }
+        }
+      }
+    }
+  }
+  return std::make_shared<ImageXYZC>(SIZE_X, SIZE_Y, SIZE_Z, SIZE_C, bits, data, 0.5f, 0.5f, 2.0f);
+}
+
+static std::string
+writeVolume(TempDirectory& dir, uint32_t bits)
+{
+  std::string path = dir.file("volume" + std::to_string(bits) + FileReaderBricks::EXTENSION);
+  bool written = FileReaderBricks::writeBricks(
+    path, volumeDimensions(bits), [bits](int32_t t) { return makeTimepoint(bits, uint32_t(t)); }, BRICK_SIZE);
+  return written ? path : "";
+}
+
+// whether image holds the voxels of box of the given file channels at time t
+static bool
+holds(const std::shared_ptr<ImageXYZC>& image,
+      uint32_t bits,
+      uint32_t t,
+      const VoxelRegion& box,
+      const std::vector<uint32_t>& channels)
+{
+  if (!image || image->sizeX() != box.sizeX() || image->sizeY() != box.sizeY() || image->sizeZ() != box.sizeZ() ||
+      image->sizeC() != channels.size() || image->sizeOfElement() != bits / 8) {
+    return false;
+  }
+  for (uint32_t i = 0; i < channels.size(); ++i) {
+    for (uint32_t z = box.minZ; z < box.maxZ; ++z) {
+      const uint8_t* plane = image->ptr(i, z - box.minZ);
+      for (uint32_t y = box.minY; y < box.maxY; ++y) {
+        for (uint32_t x = box.minX; x < box.maxX; ++x) {
+          size_t at = size_t(y - box.minY) * box.sizeX() + (x - box.minX);
+          uint16_t value = bits == 8 ? plane[at] : reinterpret_cast<const uint16_t*>(plane)[at];
+          if (value != voxel(bits, t, channels[i], x, y, z)) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+static void
+checkRoundTrip(uint32_t bits)
+{
+  TempDirectory dir("agave_test_bricks");
+  std::string path = writeVolume(dir, bits);
+  REQUIRE(!path.empty());
+
+  VolumeDimensions fileDims = FileReaderBricks::loadDimensionsBricks(path);
+  REQUIRE(fileDims.sizeX == SIZE_X);
+  REQUIRE(fileDims.sizeZ == SIZE_Z);
+  REQUIRE(fileDims.sizeT == SIZE_T);
+  REQUIRE(fileDims.bitsPerPixel == bits);
+  REQUIRE(fileDims.channelNames == std::vector<std::string>({ "DNA", "Membrane" }));
+
+  // the whole volume, at each timepoint
+  VoxelRegion all = VoxelRegion().clampedTo(SIZE_X, SIZE_Y, SIZE_Z);
+  for (uint32_t t = 0; t < SIZE_T; ++t) {
+    LoadSpec spec(path, int32_t(t));
+    VolumeDimensions dims;
+    std::shared_ptr<ImageXYZC> image = FileReaderBricks::loadBricks(spec, &dims);
+    REQUIRE(holds(image, bits, t, all, { 0, 1 }));
+    REQUIRE(dims.sizeC == SIZE_C);
+    REQUIRE(image->physicalOffset().x == 0.0f);
+  }
+
+  // a region crossing bricks and reaching the far edges, of one channel
+  VoxelRegion region;
+  region.minX = 5;
+  region.maxX = SIZE_X;
+  region.minY = 7;
+  region.maxY = 12;
+  region.minZ = 3;
+  region.maxZ = SIZE_Z;
+  VolumeDimensions dims;
+  std::shared_ptr<ImageXYZC> part = FileReaderBricks::loadBricks(path, 1, region, { 1 }, &dims);
+  REQUIRE(holds(part, bits, 1, region, { 1 }));
+  REQUIRE(dims.channelNames == std::vector<std::string>({ "Membrane" }));
+  REQUIRE(part->physicalOffset().x == 2.5f);
+  REQUIRE(part->physicalOffset().z == 6.0f);
+
+  // channels in another order than the file's
+  part = FileReaderBricks::loadBricks(path, 0, region, { 1, 0 });
+  REQUIRE(holds(part, bits, 0, region, { 1, 0 }));
+
+  // brick by brick, where 8-bit voxels are widened
+  std::shared_ptr<BrickSource> source = FileReaderBricks::openBrickSource(path);
+  REQUIRE(source);
+  PagedVolume volume(source, 1 << 20);
+  REQUIRE(volume.bricksX() == 3);
+  REQUIRE(volume.bricksZ() == 2);
+  std::vector<uint16_t> voxels(size_t(region.sizeX()) * region.sizeY() * region.sizeZ());
+  REQUIRE(volume.readRegion(0, 1, region, voxels.data()));
+  bool same = true;
+  size_t i = 0;
+  for (uint32_t z = region.minZ; z < region.maxZ; ++z) {
+    for (uint32_t y = region.minY; y < region.maxY; ++y) {
+      for (uint32_t x = region.minX; x < region.maxX; ++x) {
+        same = same && voxels[i++] == voxel(bits, 1, 0, x, y, z);
+      }
+    }
+  }
+  REQUIRE(same);
+}
+
+TEST_CASE("Bricked volume files round trip", "[bricks]")
+{
+  SECTION("8-bit volumes") { checkRoundTrip(8); }
+  SECTION("16-bit volumes") { checkRoundTrip(16); }
+}
+
+static std::string
+readFile(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// the file's layout, as writeBricks lays it out: the index offset after the magic, version and byte order, and at the
+// index, its number of entries then an offset, size and codec for each brick
+static const size_t INDEX_OFFSET_POSITION = 16;
+static const size_t INDEX_ENTRY_SIZE = 16;
+
+static uint64_t
+indexOffset(const std::string& bytes)
+{
+  uint64_t offset;
+  memcpy(&offset, bytes.data() + INDEX_OFFSET_POSITION, sizeof(offset));
+  return offset;
+}
+
+static size_t
+indexEntryPosition(const std::string& bytes, size_t brick)
+{
+  return size_t(indexOffset(bytes)) + sizeof(uint64_t) + brick * INDEX_ENTRY_SIZE;
+}
+
+TEST_CASE("Damaged bricked volume files are rejected", "[bricks]")
+{
+  TempDirectory dir("agave_test_bricks");
+  std::string path = writeVolume(dir, 16);
+  REQUIRE(!path.empty());
+  std::string bytes = readFile(path);
+  REQUIRE(indexOffset(bytes) < bytes.size());
+  // both ways of storing a brick are covered: the first brick of channel 0 is deflated, that of channel 1 is raw
+  uint32_t codec0, codec1;
+  memcpy(&codec0, &bytes[indexEntryPosition(bytes, 0) + 12], sizeof(codec0));
+  memcpy(&codec1, &bytes[indexEntryPosition(bytes, 3 * 2 * 2) + 12], sizeof(codec1));
+  REQUIRE(codec0 == 1);
+  REQUIRE(codec1 == 0);
+  std::string damaged = dir.file("damaged.agvb");
+  auto writeDamaged = [&](const std::string& contents) {
+    std::ofstream out(damaged, std::ios::binary | std::ios::trunc);
+    out.write(contents.data(), contents.size());
+  };
+
+  SECTION("A truncated file")
+  {
+    writeDamaged(bytes.substr(0, bytes.size() - 10));
+    REQUIRE(!FileReaderBricks::loadBricks(LoadSpec(damaged)));
+    REQUIRE(!FileReaderBricks::openBrickSource(damaged));
+    // cut short of the header
+    writeDamaged(bytes.substr(0, 20));
+    REQUIRE(!FileReaderBricks::loadBricks(LoadSpec(damaged)));
+  }
+
+  SECTION("An index offset past the end of the file, or off the index")
+  {
+    std::string bad = bytes;
+    uint64_t offset = bytes.size() + 1000;
+    memcpy(&bad[INDEX_OFFSET_POSITION], &offset, sizeof(offset));
+    writeDamaged(bad);
+    REQUIRE(!FileReaderBricks::loadBricks(LoadSpec(damaged)));
+    offset = ~uint64_t(0);
+    memcpy(&bad[INDEX_OFFSET_POSITION], &offset, sizeof(offset));
+    writeDamaged(bad);
+    REQUIRE(!FileReaderBricks::loadBricks(LoadSpec(damaged)));
+    offset = indexOffset(bytes) - 16;
+    memcpy(&bad[INDEX_OFFSET_POSITION], &offset, sizeof(offset));
+    writeDamaged(bad);
+    REQUIRE(!FileReaderBricks::loadBricks(LoadSpec(damaged)));
+  }
+
+  SECTION("A brick with an unknown codec")
+  {
+    std::string bad = bytes;
+    uint32_t codec = 7;
+    // the first brick of channel 0 at time 0
+    memcpy(&bad[indexEntryPosition(bytes, 0) + 12], &codec, sizeof(codec));
+    writeDamaged(bad);
+    REQUIRE(!FileReaderBricks::loadBricks(LoadSpec(damaged)));
+    // regions that don't need the brick still read
+    VoxelRegion region;
+    region.minX = BRICK_SIZE;
+    region.maxX = SIZE_X;
+    region.maxY = SIZE_Y;
+    region.maxZ = SIZE_Z;
+    REQUIRE(holds(FileReaderBricks::loadBricks(damaged, 0, region, { 0 }), 16, 0, region, { 0 }));
+    REQUIRE(FileReaderBricks::loadBricks(LoadSpec(damaged, 1)));
+  }
+
+  SECTION("A brick that lies past the bricks, or is cut short")
+  {
+    std::string bad = bytes;
+    uint64_t offset = indexOffset(bytes);
+    memcpy(&bad[indexEntryPosition(bytes, 0)], &offset, sizeof(offset));
+    writeDamaged(bad);
+    REQUIRE(!FileReaderBricks::loadBricks(LoadSpec(damaged)));
+
+    bad = bytes;
+    uint32_t size;
+    memcpy(&size, &bad[indexEntryPosition(bytes, 0) + 8], sizeof(size));
+    size -= 1;
+    memcpy(&bad[indexEntryPosition(bytes, 0) + 8], &size, sizeof(size));
+    writeDamaged(bad);
+    REQUIRE(!FileReaderBricks::loadBricks(LoadSpec(damaged)));
+  }
+
+  SECTION("Not a bricked volume file")
+  {
+    std::string bad = bytes;
+    bad[0] = 'X';
+    writeDamaged(bad);
+    REQUIRE(!FileReaderBricks::loadBricks(LoadSpec(damaged)));
+    REQUIRE(!FileReaderBricks::loadBricks(LoadSpec(dir.path() + "/missing.agvb")));
+  }
+}
@@ -0,0 +1,187 @@
+#include "catch.hpp"
+
+#include "tempDirectory.h"
+
+#include "fileformats/fileReaderTIFF.h"
+#include "graphics/imageXYZC.h"
+
+#include <tiffio.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// a 2 channel, 3 plane ImageJ stack of 37 x 29 voxels of 0.5 units, whose strips or tiles overhang the far edges
+static const uint32_t SIZE_X = 37, SIZE_Y = 29, SIZE_Z = 3, SIZE_C = 2;
+static const float SPACING = 0.5f;
+
+static uint16_t
+voxel(uint32_t bits, uint32_t c, uint32_t x, uint32_t y, uint32_t z)
+{
+  uint32_t value = c * 1009 + z * 101 + y * 13 + x * 7;
+  return uint16_t(bits == 8 ? value & 0xff : value);
+}
+
+// Writes the stack in ImageJ's plane order (channels, then z), in strips of rowsPerStrip rows, or in tiles of
+// tileSize if that isn't 0.
+static std::string
+writeStack(TempDirectory& dir, const std::string& name, uint32_t bits, uint32_t rowsPerStrip, uint32_t tileSize)
+{
+  std::string path = dir.file(name);
+  TIFF* tiff = TIFFOpen(path.c_str(), "w");
+  if (!tiff) {
+    return "";
+  }
+  const std::string description = "ImageJ=1.52\nimages=" + std::to_string(SIZE_Z * SIZE_C) +
+                                  "\nchannels=" + std::to_string(SIZE_C) + "\nslices=" + std::to_string(SIZE_Z) +
+                                  "\nframes=1\nhyperstack=true\nspacing=0.5\n";
+  const size_t bytes = bits / 8;
+  std::vector<uint8_t> plane(size_t(SIZE_X) * SIZE_Y * bytes);
+  for (uint32_t z = 0; z < SIZE_Z; ++z) {
+    for (uint32_t c = 0; c < SIZE_C; ++c) {
+      TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, SIZE_X);
+      TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, SIZE_Y);
+      TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, uint16_t(bits));
+      TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, uint16_t(1));
+      TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, uint16_t(PHOTOMETRIC_MINISBLACK));
+      TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, uint16_t(PLANARCONFIG_CONTIG));
+      TIFFSetField(tiff, TIFFTAG_COMPRESSION, uint16_t(COMPRESSION_ADOBE_DEFLATE));
+      if (z == 0 && c == 0) {
+        TIFFSetField(tiff, TIFFTAG_IMAGEDESCRIPTION, description.c_str());
+      }
+      for (uint32_t y = 0; y < SIZE_Y; ++y) {
+        for (uint32_t x = 0; x < SIZE_X; ++x) {
+          uint16_t value = voxel(bits, c, x, y, z);
+          if (bytes == 1) {
+            plane[size_t(y) * SIZE_X + x] = uint8_t(value);
+          } else {
+            reinterpret_cast<uint16_t*>(plane.data())[size_t(y) * SIZE_X + x] = value;
+          }
+        }
+      }
+      if (tileSize > 0) {
+        TIFFSetField(tiff, TIFFTAG_TILEWIDTH, tileSize);
+        TIFFSetField(tiff, TIFFTAG_TILELENGTH, tileSize);
+        std::vector<uint8_t> tile(size_t(tileSize) * tileSize * bytes);
+        for (uint32_t ty = 0; ty < SIZE_Y; ty += tileSize) {
+          for (uint32_t tx = 0; tx < SIZE_X; tx += tileSize) {
+            std::fill(tile.begin(), tile.end(), uint8_t(0));
+            for (uint32_t y = ty; y < std::min(SIZE_Y, ty + tileSize); ++y) {
+              for (uint32_t x = tx; x < std::min(SIZE_X, tx + tileSize); ++x) {
+                memcpy(&tile[(size_t(y - ty) * tileSize + (x - tx)) * bytes],
+                       &plane[(size_t(y) * SIZE_X + x) * bytes],
+                       bytes);
+              }
+            }
+            TIFFWriteEncodedTile(tiff, TIFFComputeTile(tiff, tx, ty, 0, 0), tile.data(), tmsize_t(tile.size()));
+          }
+        }
+      } else {
+        TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
+        for (uint32_t strip = 0; strip * rowsPerStrip < SIZE_Y; ++strip) {
+          uint32_t rows = std::min(rowsPerStrip, SIZE_Y - strip * rowsPerStrip);
+          TIFFWriteEncodedStrip(tiff,
+                                strip,
+                                &plane[size_t(strip) * rowsPerStrip * SIZE_X * bytes],
+                                tmsize_t(size_t(rows) * SIZE_X * bytes));
+        }
+      }
+      TIFFWriteDirectory(tiff);
+    }
+  }
+  TIFFClose(tiff);
+  return path;
+}
+
+static VoxelRegion
+box(uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY, uint32_t minZ, uint32_t maxZ)
+{
+  VoxelRegion region;
+  region.minX = minX;
+  region.maxX = maxX;
+  region.minY = minY;
+  region.maxY = maxY;
+  region.minZ = minZ;
+  region.maxZ = maxZ;
+  return region;
+}
+
+// whether image holds the voxels of region of the given file channels, and sits at its physical offset
+static bool
+holds(const std::shared_ptr<ImageXYZC>& image,
+      uint32_t bits,
+      const VoxelRegion& region,
+      const std::vector<uint32_t>& channels)
+{
+  if (!image || image->sizeX() != region.sizeX() || image->sizeY() != region.sizeY() ||
+      image->sizeZ() != region.sizeZ() || image->sizeC() != channels.size() || image->sizeOfElement() != bits / 8) {
+    return false;
+  }
+  if (image->physicalOffset().x != region.minX * SPACING || image->physicalOffset().y != region.minY * SPACING ||
+      image->physicalOffset().z != region.minZ * SPACING) {
+    return false;
+  }
+  for (uint32_t i = 0; i < channels.size(); ++i) {
+    for (uint32_t z = region.minZ; z < region.maxZ; ++z) {
+      const uint8_t* plane = image->ptr(i, z - region.minZ);
+      for (uint32_t y = region.minY; y < region.maxY; ++y) {
+        for (uint32_t x = region.minX; x < region.maxX; ++x) {
+          size_t at = size_t(y - region.minY) * region.sizeX() + (x - region.minX);
+          uint16_t value = bits == 8 ? plane[at] : reinterpret_cast<const uint16_t*>(plane)[at];
+          if (value != voxel(bits, channels[i], x, y, z)) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+static void
+checkCroppedLoads(uint32_t bits, uint32_t rowsPerStrip, uint32_t tileSize)
+{
+  TempDirectory dir("agave_test_tiff");
+  std::string path = writeStack(dir, "stack.tif", bits, rowsPerStrip, tileSize);
+  REQUIRE(!path.empty());
+
+  LoadSpec spec(path);
+  VolumeDimensions dims;
+  REQUIRE(holds(FileReaderTIFF::loadOMETiff(spec, &dims), bits, box(0, SIZE_X, 0, SIZE_Y, 0, SIZE_Z), { 0, 1 }));
+  REQUIRE(dims.physicalSizeX == SPACING);
+
+  // a box starting and ending inside strips or tiles
+  spec.region = box(5, 30, 6, 25, 1, 3);
+  REQUIRE(holds(FileReaderTIFF::loadOMETiff(spec, &dims), bits, spec.region, { 0, 1 }));
+  REQUIRE(dims.sizeX == 25);
+  REQUIRE(dims.sizeY == 19);
+  REQUIRE(dims.sizeZ == 2);
+
+  // a box reaching past the far edges is clipped to them, here with one channel
+  spec.region = box(20, 100, 17, 100, 2, 100);
+  spec.channels = { 1 };
+  REQUIRE(holds(FileReaderTIFF::loadOMETiff(spec, &dims), bits, box(20, SIZE_X, 17, SIZE_Y, 2, SIZE_Z), { 1 }));
+  REQUIRE(dims.channelNames.size() == 1);
+
+  // a single row of a single plane, inside one strip or tile
+  spec.region = box(0, SIZE_X, 9, 10, 0, 1);
+  spec.channels = {};
+  REQUIRE(holds(FileReaderTIFF::loadOMETiff(spec, &dims), bits, spec.region, { 0, 1 }));
+
+  // boxes outside the volume, degenerate or inverted, are refused rather than read whole
+  for (const VoxelRegion& refused : { box(SIZE_X, SIZE_X + 5, 0, SIZE_Y, 0, SIZE_Z),
+                                      box(0, SIZE_X, 0, SIZE_Y, 1, 1),
+                                      box(10, 5, 0, SIZE_Y, 0, SIZE_Z) }) {
+    spec.region = refused;
+    REQUIRE(!FileReaderTIFF::loadOMETiff(spec, &dims));
+  }
+}
+
+TEST_CASE("Regions of TIFF stacks are read", "[tiff]")
+{
+  SECTION("16-bit strips") { checkCroppedLoads(16, 4, 0); }
+  SECTION("8-bit strips, one per plane") { checkCroppedLoads(8, SIZE_Y, 0); }
+  SECTION("16-bit tiles") { checkCroppedLoads(16, 0, 16); }
+  SECTION("8-bit tiles") { checkCroppedLoads(8, 0, 16); }
+}
@@ -0,0 +1,256 @@
+#include "catch.hpp"
+
+#include "tempDirectory.h"
+
+#include "fileformats/fileReaderZarr.h"
+#include "graphics/imageXYZC.h"
+#include "graphics/pagedVolume.h"
+
+#include <blosc.h>
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+// a 2 channel, 3 x 5 x 6 (z, y, x) volume in chunks of 1 x 2 x 4 x 4, so that chunks overhang every edge
+static const uint64_t SHAPE[4] = { 2, 3, 5, 6 };
+static const uint64_t CHUNKS[4] = { 1, 2, 4, 4 };
+static const uint16_t FILL = 7;
+
+static uint16_t
+voxel(uint64_t c, uint64_t z, uint64_t y, uint64_t x)
+{
+  return uint16_t(c * 1000 + z * 100 + y * 10 + x + 10);
+}
+
+static std::vector<uint8_t>
+compressChunk(const std::string& compressor, const std::vector<uint16_t>& chunk)
+{
+  const size_t size = chunk.size() * 2;
+  std::vector<uint8_t> out;
+  if (compressor == "zlib") {
+    uLongf length = compressBound(uLong(size));
+    out.resize(length);
+    compress2(out.data(), &length, reinterpret_cast<const Bytef*>(chunk.data()), uLong(size), 6);
+    out.resize(length);
+  } else if (compressor == "blosc") {
+    out.resize(size + BLOSC_MAX_OVERHEAD);
+    int length = blosc_compress_ctx(5, BLOSC_SHUFFLE, 2, size, chunk.data(), out.data(), out.size(), "blosclz", 0, 1);
+    out.resize(length > 0 ? size_t(length) : 0);
+  } else {
+    out.assign(reinterpret_cast<const uint8_t*>(chunk.data()), reinterpret_cast<const uint8_t*>(chunk.data()) + size);
+  }
+  return out;
+}
+
+// Writes an OME-Zarr image with one resolution level, leaving out the chunk at c 1, z 1, y 0, x 1.
+// compressor is "" for uncompressed chunks.
+static std::string
+writeStore(TempDirectory& dir, const std::string& compressor, char separator)
+{
+  dir.write("image.zarr/.zattrs",
+            R"({"multiscales": [{"version": "0.4",
+                "axes": [{"name": "c", "type": "channel"}, {"name": "z", "type": "space"},
+                         {"name": "y", "type": "space"}, {"name": "x", "type": "space"}],
+                "datasets": [{"path": "0",
+                              "coordinateTransformations": [{"type": "scale", "scale": [1, 2, 0.5, 0.5]}]}]}],
+                "omero": {"channels": [{"label": "DNA"}, {"label": "Membrane"}]}})");
+  std::string codec = compressor.empty() ? "null" : "{\"id\": \"" + compressor + "\"}";
+  dir.write("image.zarr/0/.zarray",
+            "{\"zarr_format\": 2, \"shape\": [2, 3, 5, 6], \"chunks\": [1, 2, 4, 4], \"dtype\": \"<u2\", "
+            "\"order\": \"C\", \"fill_value\": 7, \"filters\": null, \"compressor\": " +
+              codec + ", \"dimension_separator\": \"" + separator + "\"}");
+
+  for (uint64_t cc = 0; cc < 2; ++cc) {
+    for (uint64_t zc = 0; zc < 2; ++zc) {
+      for (uint64_t yc = 0; yc < 2; ++yc) {
+        for (uint64_t xc = 0; xc < 2; ++xc) {
+          if (cc == 1 && zc == 1 && yc == 0 && xc == 1) {
+            continue;
+          }
+          // edge chunks are stored whole, with whatever lies past the edge
+          std::vector<uint16_t> chunk;
+          for (uint64_t z = zc * CHUNKS[1]; z < (zc + 1) * CHUNKS[1]; ++z) {
+            for (uint64_t y = yc * CHUNKS[2]; y < (yc + 1) * CHUNKS[2]; ++y) {
+              for (uint64_t x = xc * CHUNKS[3]; x < (xc + 1) * CHUNKS[3]; ++x) {
+                chunk.push_back(voxel(cc, z, y, x));
+              }
+            }
+          }
+          std::vector<uint8_t> bytes = compressChunk(compressor, chunk);
+          std::string name = std::to_string(cc) + separator + std::to_string(zc) + separator + std::to_string(yc) +
+                             separator + std::to_string(xc);
+          dir.write("image.zarr/0/" + name, bytes.data(), bytes.size());
+        }
+      }
+    }
+  }
+  return dir.path() + "/image.zarr";
+}
+
+static uint16_t
+expected(uint64_t c, uint64_t z, uint64_t y, uint64_t x)
+{
+  bool missing = c == 1 && z / CHUNKS[1] == 1 && y / CHUNKS[2] == 0 && x / CHUNKS[3] == 1;
+  return missing ? FILL : voxel(c, z, y, x);
+}
+
+// reads back a store written by writeStore, whole and in part, for both kinds of chunk names
+static void
+checkStore(const std::string& compressor)
+{
+  for (char separator : { '.', '/' }) {
+    TempDirectory dir("agave_test_zarr");
+    std::string store = writeStore(dir, compressor, separator);
+    INFO("separator " << separator);
+
+    // the whole volume, with the fill value for the missing chunk
+    REQUIRE(FileReaderZarr::isZarr(store));
+    VolumeDimensions dims;
+    std::shared_ptr<ImageXYZC> image = FileReaderZarr::loadOMEZarr(LoadSpec(store), &dims);
+    REQUIRE(image);
+    REQUIRE(dims.sizeX == 6);
+    REQUIRE(dims.sizeY == 5);
+    REQUIRE(dims.sizeZ == 3);
+    REQUIRE(dims.sizeC == 2);
+    REQUIRE(dims.sizeT == 1);
+    REQUIRE(dims.physicalSizeZ == 2.0f);
+    REQUIRE(dims.physicalSizeX == 0.5f);
+    REQUIRE(dims.channelNames == std::vector<std::string>({ "DNA", "Membrane" }));
+    REQUIRE(image->sizeOfElement() == 2);
+    bool same = true;
+    for (uint64_t c = 0; c < SHAPE[0]; ++c) {
+      for (uint64_t z = 0; z < SHAPE[1]; ++z) {
+        const uint16_t* plane = reinterpret_cast<const uint16_t*>(image->ptr(uint32_t(c), uint32_t(z)));
+        for (uint64_t y = 0; y < SHAPE[2]; ++y) {
+          for (uint64_t x = 0; x < SHAPE[3]; ++x) {
+            same = same && plane[y * SHAPE[3] + x] == expected(c, z, y, x);
+          }
+        }
+      }
+    }
+    REQUIRE(same);
+
+    // a region of one channel
+    LoadSpec spec(store);
+    spec.region.minX = 3;
+    spec.region.maxX = 6;
+    spec.region.minY = 1;
+    spec.region.maxY = 3;
+    spec.region.minZ = 1;
+    spec.region.maxZ = 3;
+    spec.channels = { 1 };
+    std::shared_ptr<ImageXYZC> region = FileReaderZarr::loadOMEZarr(spec, &dims);
+    REQUIRE(region);
+    REQUIRE(region->sizeX() == 3);
+    REQUIRE(region->sizeY() == 2);
+    REQUIRE(region->sizeZ() == 2);
+    REQUIRE(region->sizeC() == 1);
+    REQUIRE(dims.channelNames == std::vector<std::string>({ "Membrane" }));
+    REQUIRE(region->physicalOffset().x == 1.5f);
+    REQUIRE(region->physicalOffset().z == 2.0f);
+    const uint16_t* data = reinterpret_cast<const uint16_t*>(region->ptr(0, 0));
+    REQUIRE(data[0] == expected(1, 1, 1, 3));
+    REQUIRE(data[1] == expected(1, 1, 1, 4));
+    REQUIRE(data[3 * 2 + 2] == expected(1, 2, 1, 5));
+
+    // a chunk overwritten in place, later on
+    int64_t before = FileReaderZarr::modificationTime(store);
+    REQUIRE(before > 0);
+    std::string chunk = store + "/0/1" + separator + "0" + separator + "1" + separator + "1";
+    struct utimbuf later;
+    later.actime = later.modtime = time_t(before + 100);
+    REQUIRE(utime(chunk.c_str(), &later) == 0);
+    REQUIRE(FileReaderZarr::modificationTime(store) == before + 100);
+  }
+}
+
+TEST_CASE("OME-Zarr stores are read", "[zarr]")
+{
+  SECTION("Uncompressed chunks") { checkStore(""); }
+  SECTION("zlib chunks") { checkStore("zlib"); }
+  SECTION("blosc chunks") { checkStore("blosc"); }
+}
+
+TEST_CASE("Damaged OME-Zarr stores are rejected", "[zarr]")
+{
+  TempDirectory dir("agave_test_zarr");
+  std::string store = writeStore(dir, "zlib", '.');
+
+  SECTION("A truncated chunk fails the load")
+  {
+    dir.write("image.zarr/0/0.0.0.0", "x");
+    REQUIRE(!FileReaderZarr::loadOMEZarr(LoadSpec(store)));
+  }
+
+  SECTION("Unsupported compressors are refused")
+  {
+    dir.write("image.zarr/0/.zarray",
+              "{\"zarr_format\": 2, \"shape\": [2, 3, 5, 6], \"chunks\": [1, 2, 4, 4], \"dtype\": \"<u2\", "
+              "\"order\": \"C\", \"fill_value\": 7, \"filters\": null, \"compressor\": {\"id\": \"lzma\"}}");
+    REQUIRE(!FileReaderZarr::loadOMEZarr(LoadSpec(store)));
+  }
+}
+
+// the brick size a PagedVolume gets for an array of the given shape and chunks, in (c, z, y, x) order
+static std::vector<uint32_t>
+brickSizeFor(const std::string& shape, const std::string& chunks)
+{
+  TempDirectory dir("agave_test_zarr_bricks");
+  dir.write("image.zarr/.zattrs",
+            R"({"multiscales": [{"version": "0.4",
+                "axes": [{"name": "c", "type": "channel"}, {"name": "z", "type": "space"},
+                         {"name": "y", "type": "space"}, {"name": "x", "type": "space"}],
+                "datasets": [{"path": "0"}]}]})");
+  dir.write("image.zarr/0/.zarray",
+            "{\"zarr_format\": 2, \"shape\": " + shape + ", \"chunks\": " + chunks +
+              ", \"dtype\": \"<u2\", \"order\": \"C\", \"fill_value\": 0, \"filters\": null, \"compressor\": null}");
+  std::shared_ptr<BrickSource> source = FileReaderZarr::openBrickSource(LoadSpec(dir.path() + "/image.zarr"));
+  if (!source) {
+    return {};
+  }
+  uint32_t x, y, z;
+  source->brickSize(x, y, z);
+  return { z, y, x };
+}
+
+TEST_CASE("OME-Zarr stores are read brick by brick", "[zarr]")
+{
+  SECTION("Bricks are made of whole chunks")
+  {
+    // planes chunked one at a time are stacked, rather than each read for many bricks
+    REQUIRE(brickSizeFor("[1, 600, 2048, 2048]", "[1, 1, 1024, 1024]") == std::vector<uint32_t>({ 2, 1024, 1024 }));
+    // small chunks are put together, shortest side first
+    REQUIRE(brickSizeFor("[2, 500, 500, 500]", "[1, 64, 64, 32]") == std::vector<uint32_t>({ 128, 128, 128 }));
+    // but never past the volume
+    REQUIRE(brickSizeFor("[1, 3, 100, 100]", "[1, 1, 64, 64]") == std::vector<uint32_t>({ 3, 100, 100 }));
+    // and chunks too big for a brick are cut
+    REQUIRE(brickSizeFor("[1, 1, 8192, 8192]", "[1, 1, 8192, 8192]") == std::vector<uint32_t>({ 1, 4096, 4096 }));
+  }
+
+  SECTION("A PagedVolume reads the same voxels as a load")
+  {
+    TempDirectory dir("agave_test_zarr");
+    std::string store = writeStore(dir, "zlib", '/');
+    std::shared_ptr<BrickSource> source = FileReaderZarr::openBrickSource(LoadSpec(store));
+    REQUIRE(source);
+    PagedVolume volume(source, 1 << 20);
+    bool same = true;
+    for (uint32_t c = 0; c < SHAPE[0]; ++c) {
+      for (uint32_t z = 0; z < SHAPE[1]; ++z) {
+        for (uint32_t y = 0; y < SHAPE[2]; ++y) {
+          for (uint32_t x = 0; x < SHAPE[3]; ++x) {
+            same = same && volume.voxel(c, 0, x, y, z) == expected(c, z, y, x);
+          }
+        }
+      }
+    }
+    REQUIRE(same);
+  }
+}
@@ -1,6 +1,10 @@
 #include "catch.hpp"
 
 #include "graphics/histogram.h"
+#include "graphics/histogramAccumulator.h"
+#include "graphics/parallel.h"
+
+#include <vector>
 
 TEST_CASE("Histogram edge cases are stable", "[histogram]")
 {
@@ -41,6 +45,28 @@ TEST_CASE("Histogram edge cases are stable", "[histogram]")
     REQUIRE(h._ccounts[0] == 2);
   }
 
+  SECTION("Histogram rebuilt from its bins matches the original")
+  {
+    uint16_t data[] = { 0, 0, 1, 1, 2, 2, 510, 510, 511, 511, 512, 512, 300 };
+    int COUNT = sizeof(data) / sizeof(data[0]);
+    Histogram h(data, COUNT);
+    Histogram rebuilt(h._bins, h._dataMin, h._dataMax, h._pixelCount);
+
+    REQUIRE(rebuilt._pixelCount == h._pixelCount);
+    REQUIRE(rebuilt._dataMin == h._dataMin);
+    REQUIRE(rebuilt._dataMax == h._dataMax);
+    REQUIRE(rebuilt._maxBin == h._maxBin);
+    REQUIRE(rebuilt._ccounts == h._ccounts);
+
+    float* lut = h.generate_percentiles();
+    float* rebuiltLut = rebuilt.generate_percentiles();
+    for (size_t i = 0; i < 256; ++i) {
+      REQUIRE(rebuiltLut[i] == lut[i]);
+    }
+    delete[] lut;
+    delete[] rebuiltLut;
+  }
+
   SECTION("Histogram binning accuracy is good")
   {
     uint16_t data[] = { 0, 0, 1, 1, 2, 2, 510, 510, 511, 511, 512, 512 };
@@ -62,6 +88,96 @@ TEST_CASE("Histogram edge cases are stable", "[histogram]")
     REQUIRE(h._ccounts[1] == 6);
     REQUIRE(h._ccounts[0] == 4);
   }
+
+  SECTION("Histogram of 8-bit data matches the same values widened")
+  {
+    uint8_t data[] = { 3, 3, 4, 90, 91, 200, 254, 255, 255 };
+    uint16_t wide[] = { 3, 3, 4, 90, 91, 200, 254, 255, 255 };
+    int COUNT = sizeof(data) / sizeof(data[0]);
+    Histogram h(data, COUNT, 8);
+    Histogram hw(wide, COUNT);
+
+    REQUIRE(h._dataMin == 3);
+    REQUIRE(h._dataMax == 255);
+    REQUIRE(h._bins == hw._bins);
+    REQUIRE(h._maxBin == hw._maxBin);
+  }
+
+  SECTION("Histogram split across threads matches the single threaded one")
+  {
+    // a few blocks' worth, with a short last block
+    std::vector<uint16_t> data(3 * 1024 * 1024 + 77);
+    for (size_t i = 0; i < data.size(); ++i) {
+      data[i] = (uint16_t)(200 + (i * 7919) % 50021);
+    }
+    data[2 * 1024 * 1024 + 5] = 3;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+    Histogram single(bytes, data.size(), 16);
+    Histogram split(bytes, data.size(), 16, 256, 4);
+
+    REQUIRE(split._dataMin == 3);
+    REQUIRE(split._dataMax == single._dataMax);
+    REQUIRE(split._pixelCount == single._pixelCount);
+    REQUIRE(split._bins == single._bins);
+    REQUIRE(split._ccounts == single._ccounts);
+    REQUIRE(split._maxBin == single._maxBin);
+  }
+}
+
+TEST_CASE("Histograms accumulated while loading match those computed afterwards", "[histogram]")
+{
+  SECTION("16-bit voxels counted in pieces and on several threads")
+  {
+    // big enough to take both the direct and the count-then-merge paths
+    const size_t rowLength = 600, rows = 1000;
+    std::vector<uint16_t> data(rowLength * rows);
+    for (size_t i = 0; i < data.size(); ++i) {
+      data[i] = (uint16_t)(1000 + (i * 7919) % 30011);
+    }
+    HistogramAccumulator acc(2, 16);
+    // channel 0 one row at a time across threads, channel 1 in two big blocks of rows
+    parallelFor(rows, 4, [&](size_t row, uint32_t) {
+      acc.add(0, reinterpret_cast<const uint8_t*>(data.data() + row * rowLength), rowLength);
+    });
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+    acc.addRows(1, bytes, rowLength, rows / 2, rowLength * 2);
+    acc.addRows(1, bytes + (rows / 2) * rowLength * 2, rowLength, rows / 2, rowLength * 2);
+
+    Histogram h(data.data(), data.size());
+    for (uint32_t c = 0; c < 2; ++c) {
+      Histogram ha = acc.histogram(c);
+      REQUIRE(acc.count(c) == data.size());
+      REQUIRE(ha._dataMin == h._dataMin);
+      REQUIRE(ha._dataMax == h._dataMax);
+      REQUIRE(ha._bins == h._bins);
+      REQUIRE(ha._ccounts == h._ccounts);
+    }
+  }
+
+  SECTION("8-bit voxels, part of each row, and blank voxels")
+  {
+    uint8_t data[] = { 9, 9, 100, 1, 7, 250, 9, 33, 1, 0, 0, 0 };
+    HistogramAccumulator acc(1, 8);
+    // the first three voxels of each of the first three rows of four
+    acc.addRows(0, data, 3, 3, 4);
+    acc.addZeros(0, 3);
+    uint8_t counted[] = { 9, 9, 100, 7, 250, 9, 1, 0, 0, 0, 0, 0 };
+    Histogram h(counted, 12, 8);
+    Histogram ha = acc.histogram(0);
+    REQUIRE(ha._pixelCount == 12);
+    REQUIRE(ha._dataMin == 0);
+    REQUIRE(ha._dataMax == 250);
+    REQUIRE(ha._bins == h._bins);
+  }
+
+  SECTION("Nothing counted")
+  {
+    HistogramAccumulator acc(1, 16);
+    Histogram ha = acc.histogram(0);
+    REQUIRE(ha._pixelCount == 0);
+    REQUIRE(ha._dataMin == 0);
+    REQUIRE(ha._dataMax == 0);
+  }
 }
 
 TEST_CASE("Histogram LUT generation is working", "[histogram]")
@@ -0,0 +1,278 @@
+#include "catch.hpp"
+
+#include "fileformats/imageCache.h"
+#include "fileformats/loadControl.h"
+#include "graphics/imageXYZC.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static std::shared_ptr<ImageXYZC>
+makeImage(uint32_t x, uint32_t y, uint32_t z)
+{
+  return std::make_shared<ImageXYZC>(x, y, z, 1, 16, new uint8_t[x * y * z * 2]());
+}
+
+static ImageCache::Key
+makeKey(const std::string& filepath)
+{
+  ImageCache::Key key;
+  key.filepath = filepath;
+  return key;
+}
+
+// waits, up to a few seconds, until a condition holds
+template<typename Condition>
+static bool
+waitFor(Condition condition)
+{
+  for (int i = 0; i < 5000 && !condition(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return condition();
+}
+
+TEST_CASE("ImageCache shares concurrent loads of a volume", "[imageCache]")
+{
+  const ImageCache::Key key = makeKey("volume");
+
+  SECTION("Concurrent requests load once and all get the same image")
+  {
+    ImageCache cache(1 << 20);
+    const uint32_t N = 8;
+    std::atomic<uint32_t> loads(0);
+    ImageCache::Loader load = [&](VolumeDimensions* dims) {
+      loads++;
+      // hold the load until every other request waits for it
+      waitFor([&] { return cache.stats().sharedLoads == N - 1; });
+      dims->sizeX = 4;
+      return makeImage(4, 4, 4);
+    };
+    std::vector<std::shared_ptr<ImageXYZC>> images(N);
+    std::vector<VolumeDimensions> dims(N);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < N; ++i) {
+      threads.emplace_back([&, i] { images[i] = cache.findOrLoad(key, &dims[i], load, true); });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+
+    REQUIRE(loads == 1);
+    REQUIRE(cache.stats().sharedLoads == N - 1);
+    REQUIRE(cache.stats().misses == 1);
+    for (uint32_t i = 0; i < N; ++i) {
+      REQUIRE(images[i]);
+      REQUIRE(images[i] == images[0]);
+      REQUIRE(dims[i].sizeX == 4);
+    }
+    REQUIRE(cache.find(key) == images[0]);
+  }
+
+  SECTION("A load cancelled by its requester is retried by a waiter")
+  {
+    ImageCache cache(1 << 20);
+    LoadControl control;
+    std::atomic<uint32_t> loads(0);
+    std::shared_ptr<ImageXYZC> first, second;
+    std::thread requester([&] {
+      first = cache.findOrLoad(
+        key,
+        nullptr,
+        [&](VolumeDimensions*) {
+          loads++;
+          waitFor([&] { return cache.stats().sharedLoads == 1; });
+          control.cancel();
+          return std::shared_ptr<ImageXYZC>();
+        },
+        true,
+        &control);
+    });
+    REQUIRE(waitFor([&] { return loads == 1; }));
+    second = cache.findOrLoad(
+      key,
+      nullptr,
+      [&](VolumeDimensions*) {
+        loads++;
+        return makeImage(4, 4, 4);
+      },
+      true);
+    requester.join();
+
+    REQUIRE(!first);
+    REQUIRE(second);
+    REQUIRE(loads == 2);
+  }
+
+  SECTION("A failed load fails every waiter without loading again")
+  {
+    ImageCache cache(1 << 20);
+    const uint32_t N = 6;
+    std::atomic<uint32_t> loads(0);
+    ImageCache::Loader load = [&](VolumeDimensions*) {
+      loads++;
+      waitFor([&] { return cache.stats().sharedLoads == N - 1; });
+      return std::shared_ptr<ImageXYZC>();
+    };
+    std::atomic<uint32_t> loaded(0);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < N; ++i) {
+      threads.emplace_back([&] {
+        if (cache.findOrLoad(key, nullptr, load, true)) {
+          loaded++;
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+
+    REQUIRE(loads == 1);
+    REQUIRE(loaded == 0);
+    REQUIRE(cache.stats().sharedLoads == N - 1);
+    REQUIRE(cache.stats().entries == 0);
+  }
+}
+
+TEST_CASE("ImageCache keeps recently used volumes within its budget", "[imageCache]")
+{
+  // 4 x 4 x 4 16-bit voxels
+  static const size_t IMAGE_BYTES = 128;
+  VolumeDimensions dims;
+
+  SECTION("The least recently used volumes are evicted first")
+  {
+    ImageCache cache(3 * IMAGE_BYTES);
+    cache.insert(makeKey("a"), makeImage(4, 4, 4), dims);
+    cache.insert(makeKey("b"), makeImage(4, 4, 4), dims);
+    cache.insert(makeKey("c"), makeImage(4, 4, 4), dims);
+    // using a makes b the oldest
+    REQUIRE(cache.find(makeKey("a")));
+    cache.insert(makeKey("d"), makeImage(4, 4, 4), dims);
+    REQUIRE(!cache.find(makeKey("b")));
+    REQUIRE(cache.find(makeKey("a")));
+    REQUIRE(cache.find(makeKey("c")));
+    REQUIRE(cache.find(makeKey("d")));
+    REQUIRE(cache.stats().evictions == 1);
+    REQUIRE(cache.stats().bytes == 3 * IMAGE_BYTES);
+
+    // shrinking the budget evicts the oldest right away: a, then c, were used longest ago
+    cache.setBudget(IMAGE_BYTES);
+    REQUIRE(cache.stats().entries == 1);
+    REQUIRE(cache.find(makeKey("d")));
+    REQUIRE(cache.stats().evictions == 3);
+  }
+
+  SECTION("A volume bigger than the budget is not kept, and evicts nothing")
+  {
+    ImageCache cache(3 * IMAGE_BYTES);
+    cache.insert(makeKey("a"), makeImage(4, 4, 4), dims);
+    cache.insert(makeKey("big"), makeImage(8, 8, 8), dims);
+    REQUIRE(!cache.find(makeKey("big")));
+    REQUIRE(cache.find(makeKey("a")));
+    REQUIRE(cache.stats().entries == 1);
+    REQUIRE(cache.stats().bytes == IMAGE_BYTES);
+    REQUIRE(cache.stats().evictions == 0);
+
+    // replacing an entry with one that is too big drops the old one rather than keep it stale
+    cache.insert(makeKey("a"), makeImage(8, 8, 8), dims);
+    REQUIRE(!cache.find(makeKey("a")));
+    REQUIRE(cache.stats().bytes == 0);
+
+    // nor is a loaded volume that is too big, though the requester still gets it
+    std::shared_ptr<ImageXYZC> loaded =
+      cache.findOrLoad(makeKey("big"), nullptr, [](VolumeDimensions*) { return makeImage(8, 8, 8); }, true);
+    REQUIRE(loaded);
+    REQUIRE(cache.stats().entries == 0);
+  }
+
+  SECTION("Keys that differ in any part are different volumes")
+  {
+    ImageCache cache(1 << 20);
+    std::vector<ImageCache::Key> keys(1, makeKey("volume"));
+    keys.push_back(keys[0]);
+    keys.back().filepath = "other";
+    keys.push_back(keys[0]);
+    keys.back().modified = 100;
+    keys.push_back(keys[0]);
+    keys.back().time = 1;
+    keys.push_back(keys[0]);
+    keys.back().scene = 1;
+    keys.push_back(keys[0]);
+    keys.back().level = 1;
+    keys.push_back(keys[0]);
+    keys.back().maxDimension = 512;
+    keys.push_back(keys[0]);
+    keys.back().region.maxX = 2;
+    keys.push_back(keys[0]);
+    keys.back().region.minZ = 1;
+    keys.push_back(keys[0]);
+    keys.back().channels = { 0 };
+    keys.push_back(keys[0]);
+    keys.back().channels = { 0, 1 };
+    keys.push_back(keys[0]);
+    keys.back().channels = { 1, 0 };
+    keys.push_back(keys[0]);
+    keys.back().valueMax = 1.0;
+
+    std::vector<std::shared_ptr<ImageXYZC>> images;
+    for (const ImageCache::Key& key : keys) {
+      images.push_back(makeImage(4, 4, 4));
+      cache.insert(key, images.back(), dims);
+    }
+    REQUIRE(cache.stats().entries == keys.size());
+    bool distinct = true;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      distinct = distinct && cache.find(keys[i]) == images[i];
+    }
+    REQUIRE(distinct);
+
+    // while equal keys are the same volume
+    ImageCache::Key same = makeKey("volume");
+    REQUIRE(!(same < keys[0]));
+    REQUIRE(!(keys[0] < same));
+    cache.insert(same, makeImage(4, 4, 4), dims);
+    REQUIRE(cache.stats().entries == keys.size());
+    REQUIRE(cache.find(keys[0]) != images[0]);
+  }
+
+  SECTION("Stats count hits, misses and what is held")
+  {
+    ImageCache cache(2 * IMAGE_BYTES);
+    dims.sizeX = 4;
+    cache.insert(makeKey("a"), makeImage(4, 4, 4), dims);
+    VolumeDimensions found;
+    REQUIRE(cache.find(makeKey("a"), &found));
+    REQUIRE(found.sizeX == 4);
+    REQUIRE(!cache.find(makeKey("b")));
+    ImageCache::Loader load = [](VolumeDimensions*) { return makeImage(4, 4, 4); };
+    cache.findOrLoad(makeKey("b"), nullptr, load, true);
+    cache.findOrLoad(makeKey("b"), nullptr, load, true);
+    // a volume loaded without keeping it is not held
+    cache.findOrLoad(makeKey("c"), nullptr, load, false);
+
+    ImageCache::Stats stats = cache.stats();
+    REQUIRE(stats.hits == 2);
+    REQUIRE(stats.misses == 3);
+    REQUIRE(stats.sharedLoads == 0);
+    REQUIRE(stats.evictions == 0);
+    REQUIRE(stats.entries == 2);
+    REQUIRE(stats.bytes == 2 * IMAGE_BYTES);
+    REQUIRE(stats.budget == 2 * IMAGE_BYTES);
+
+    // resetting the counters keeps the entries
+    cache.resetStats();
+    stats = cache.stats();
+    REQUIRE(stats.hits == 0);
+    REQUIRE(stats.misses == 0);
+    REQUIRE(stats.entries == 2);
+
+    cache.erase(makeKey("a"));
+    REQUIRE(cache.stats().bytes == IMAGE_BYTES);
+    cache.clear();
+    REQUIRE(cache.stats().entries == 0);
+    REQUIRE(cache.stats().bytes == 0);
+  }
+}
@@ -0,0 +1,102 @@
+#include "catch.hpp"
+
+#include "graphics/imageXYZC.h"
+
+#include <vector>
+
+static uint8_t*
+makeChannels(uint32_t x, uint32_t y, uint32_t z, uint32_t c, uint16_t base)
+{
+  uint16_t* data = new uint16_t[x * y * z * c];
+  for (uint32_t i = 0; i < x * y * z * c; ++i) {
+    data[i] = (uint16_t)(base + (i % (x * y * z)) % 97 + (i / (x * y * z)) * 1000);
+  }
+  return reinterpret_cast<uint8_t*>(data);
+}
+
+TEST_CASE("ImageXYZC", "[imageXYZC]")
+{
+  SECTION("Channels can be added later")
+  {
+    ImageXYZC image(8, 6, 4, 2, 16, makeChannels(8, 6, 4, 2, 0), 0.5f, 0.5f, 2.0f);
+    std::vector<std::string> names = { "a", "b" };
+    image.setChannelNames(names);
+    image.channel(1)->generate_windowLevel(0.5f, 0.5f);
+    std::vector<float> lut1(image.channel(1)->m_lut, image.channel(1)->m_lut + 256);
+
+    ImageXYZC more(8, 6, 4, 1, 16, makeChannels(8, 6, 4, 1, 5000));
+    std::vector<std::string> moreNames = { "c" };
+    more.setChannelNames(moreNames);
+    more.setValueMappings({ -1.5 }, { 0.25 });
+    uint8_t* original = image.ptr(0);
+    std::shared_ptr<ImageXYZC> combined = image.addChannels(more);
+    REQUIRE(combined);
+
+    REQUIRE(combined->sizeC() == 3);
+    REQUIRE(combined->channel(0)->m_name == "a");
+    REQUIRE(combined->channel(2)->m_name == "c");
+    REQUIRE(combined->channel(2)->m_min == more.channel(0)->m_min);
+    REQUIRE(combined->channel(2)->m_max == more.channel(0)->m_max);
+    REQUIRE(combined->physicalSizeZ() == 2.0f);
+    REQUIRE(combined->channel(0)->m_valueOffset == 0.0);
+    REQUIRE(combined->channel(0)->m_valueScale == 1.0);
+    REQUIRE(combined->channel(2)->m_valueOffset == -1.5);
+    REQUIRE(combined->channel(2)->m_valueScale == 0.25);
+    for (uint32_t c = 0; c < 3; ++c) {
+      REQUIRE(combined->channel(c)->m_ptr == combined->ptr(c));
+    }
+    // existing channels keep their data and luts
+    REQUIRE(reinterpret_cast<uint16_t*>(combined->ptr(1))[5] == 1005);
+    REQUIRE(std::vector<float>(combined->channel(1)->m_lut, combined->channel(1)->m_lut + 256) == lut1);
+    REQUIRE(reinterpret_cast<uint16_t*>(combined->ptr(2))[5] == 5005);
+
+    // the original image is untouched, for anyone else holding it
+    REQUIRE(image.sizeC() == 2);
+    REQUIRE(image.ptr(0) == original);
+    REQUIRE(image.channel(1)->m_ptr == image.ptr(1));
+    REQUIRE(reinterpret_cast<uint16_t*>(image.ptr(1))[5] == 1005);
+  }
+
+  SECTION("Channels of another size are refused")
+  {
+    ImageXYZC image(8, 6, 4, 1, 16, makeChannels(8, 6, 4, 1, 0));
+    ImageXYZC other(8, 6, 3, 1, 16, makeChannels(8, 6, 3, 1, 0));
+    REQUIRE(!image.addChannels(other));
+    REQUIRE(image.sizeC() == 1);
+
+    ImageXYZC narrow(8, 6, 4, 1, 8, new uint8_t[8 * 6 * 4]());
+    REQUIRE(!image.addChannels(narrow));
+    REQUIRE(image.sizeC() == 1);
+  }
+
+  SECTION("8-bit data stays 8-bit")
+  {
+    const uint32_t x = 8, y = 6, z = 4;
+    uint8_t* data = new uint8_t[x * y * z * 2];
+    for (uint32_t i = 0; i < x * y * z * 2; ++i) {
+      data[i] = (uint8_t)(i < x * y * z ? 10 + i % 50 : 255 - i % 7);
+    }
+    ImageXYZC image(x, y, z, 2, 8, data);
+
+    REQUIRE(image.sizeOfElement() == 1);
+    REQUIRE(image.size() == x * y * z * 2);
+    REQUIRE(image.channel(1)->m_ptr == data + x * y * z);
+    REQUIRE(image.channel(0)->sizeOfElement() == 1);
+    REQUIRE(image.channel(0)->m_min == 10);
+    REQUIRE(image.channel(0)->m_max == 59);
+    REQUIRE(image.channel(1)->m_min == 249);
+    REQUIRE(image.channel(1)->m_max == 255);
+
+    // gradients are 8-bit as well, and clamped: a step from 0 to 255 is steeper than 255
+    Channel* channel = image.channel(0);
+    for (uint32_t i = 0; i < x * y * z; ++i) {
+      channel->m_ptr[i] = (i % x) < x / 2 ? 0 : 255;
+    }
+    const uint8_t* gradient = channel->generateGradientMagnitudeVolume(1.0f, 1.0f, 1.0f);
+    REQUIRE(gradient == channel->m_gradientMagnitudePtr);
+    REQUIRE(gradient[0] == 0);
+    REQUIRE(gradient[x / 2 - 1] == 255);
+    REQUIRE(gradient[x / 2] == 255);
+    REQUIRE(gradient[x - 1] == 0);
+  }
+}
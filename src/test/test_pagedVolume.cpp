@@ -0,0 +1,209 @@
+#include "catch.hpp"
+
+#include "graphics/histogram.h"
+#include "graphics/pagedVolume.h"
+
+#include <atomic>
+#include <vector>
+
+// an in-memory volume whose voxel values encode their coordinates
+class TestBrickSource : public BrickSource
+{
+public:
+  TestBrickSource(uint32_t x, uint32_t y, uint32_t z, uint32_t c)
+  {
+    m_dims.sizeX = x;
+    m_dims.sizeY = y;
+    m_dims.sizeZ = z;
+    m_dims.sizeC = c;
+    m_dims.sizeT = 1;
+  }
+
+  static uint16_t value(uint32_t c, uint32_t x, uint32_t y, uint32_t z)
+  {
+    return (uint16_t)(c * 1000 + x * 7 + y * 3 + z * 11 + 5);
+  }
+
+  VolumeDimensions dimensions() const override { return m_dims; }
+  void brickSize(uint32_t& x, uint32_t& y, uint32_t& z) const override
+  {
+    x = m_brickX;
+    y = m_brickY;
+    z = m_brickZ;
+  }
+  bool readRegion(uint32_t c, uint32_t t, const VoxelRegion& region, uint16_t* dst) override
+  {
+    m_reads++;
+    if (m_fail) {
+      return false;
+    }
+    for (uint32_t z = region.minZ; z < region.maxZ; ++z) {
+      for (uint32_t y = region.minY; y < region.maxY; ++y) {
+        for (uint32_t x = region.minX; x < region.maxX; ++x) {
+          *dst++ = value(c, x, y, z);
+        }
+      }
+    }
+    return true;
+  }
+
+  std::atomic<uint32_t> m_reads{ 0 };
+  // makes every read fail, as a source would on an unreadable file
+  std::atomic<bool> m_fail{ false };
+  uint32_t m_brickX = 8, m_brickY = 8, m_brickZ = 8;
+
+private:
+  VolumeDimensions m_dims;
+};
+
+TEST_CASE("PagedVolume", "[pagedVolume]")
+{
+  auto source = std::make_shared<TestBrickSource>(20, 17, 9, 2);
+  static const size_t BRICK_BYTES = 8 * 8 * 8 * sizeof(uint16_t);
+
+  SECTION("Bricks cover the volume, with smaller bricks at the far edges")
+  {
+    PagedVolume volume(source, 64 * BRICK_BYTES);
+    REQUIRE(volume.brickSizeX() == 8);
+    REQUIRE(volume.brickSizeZ() == 8);
+    REQUIRE(volume.bricksX() == 3);
+    REQUIRE(volume.bricksY() == 3);
+    REQUIRE(volume.bricksZ() == 2);
+    auto corner = volume.brick(1, 0, 2, 2, 1);
+    REQUIRE(corner);
+    REQUIRE(corner->region.sizeX() == 4);
+    REQUIRE(corner->region.sizeY() == 1);
+    REQUIRE(corner->region.sizeZ() == 1);
+    REQUIRE(corner->voxels[0] == TestBrickSource::value(1, 16, 16, 8));
+    REQUIRE(!volume.brick(2, 0, 0, 0, 0));
+    REQUIRE(!volume.brick(0, 0, 3, 0, 0));
+  }
+
+  SECTION("Bricks follow the source's shape, which need not be a cube")
+  {
+    source->m_brickX = 16;
+    source->m_brickY = 4;
+    source->m_brickZ = 2;
+    PagedVolume volume(source, 64 * BRICK_BYTES);
+    REQUIRE(volume.bricksX() == 2);
+    REQUIRE(volume.bricksY() == 5);
+    REQUIRE(volume.bricksZ() == 5);
+    auto b = volume.brick(0, 0, 1, 2, 3);
+    REQUIRE(b);
+    REQUIRE(b->region.minX == 16);
+    REQUIRE(b->region.sizeX() == 4);
+    REQUIRE(b->region.minY == 8);
+    REQUIRE(b->region.sizeY() == 4);
+    REQUIRE(b->region.minZ == 6);
+    REQUIRE(b->region.sizeZ() == 2);
+    REQUIRE(volume.voxel(0, 0, 17, 11, 8) == TestBrickSource::value(0, 17, 11, 8));
+
+    // a size given to the volume makes cubes anyway
+    PagedVolume cubes(source, 64 * BRICK_BYTES, 5);
+    REQUIRE(cubes.brickSizeX() == 5);
+    REQUIRE(cubes.brickSizeY() == 5);
+    REQUIRE(cubes.bricksZ() == 2);
+  }
+
+  SECTION("Resident bricks are not read again")
+  {
+    PagedVolume volume(source, 64 * BRICK_BYTES);
+    volume.brick(0, 0, 1, 1, 0);
+    volume.brick(0, 0, 1, 1, 0);
+    REQUIRE(source->m_reads == 1);
+    PagedVolume::Stats stats = volume.stats();
+    REQUIRE(stats.hits == 1);
+    REQUIRE(stats.misses == 1);
+    REQUIRE(stats.bricks == 1);
+    REQUIRE(stats.bytes == BRICK_BYTES);
+  }
+
+  SECTION("The least recently used bricks are evicted to stay within budget")
+  {
+    PagedVolume volume(source, 2 * BRICK_BYTES);
+    auto held = volume.brick(0, 0, 0, 0, 0);
+    volume.brick(0, 0, 1, 0, 0);
+    volume.brick(0, 0, 0, 1, 0);
+    PagedVolume::Stats stats = volume.stats();
+    REQUIRE(stats.bricks == 2);
+    REQUIRE(stats.evictions == 1);
+    REQUIRE(stats.bytes <= stats.budget);
+    // an evicted brick stays valid for whoever holds it
+    REQUIRE(held->voxels[0] == TestBrickSource::value(0, 0, 0, 0));
+    // and is read again when asked for
+    volume.brick(0, 0, 0, 0, 0);
+    REQUIRE(source->m_reads == 4);
+
+    volume.setBudget(0);
+    REQUIRE(volume.stats().bricks == 1);
+  }
+
+  SECTION("Regions that span bricks are read correctly, even over budget")
+  {
+    PagedVolume volume(source, BRICK_BYTES);
+    VoxelRegion region;
+    region.minX = 3;
+    region.maxX = 19;
+    region.minY = 5;
+    region.maxY = 17;
+    region.minZ = 6;
+    region.maxZ = 9;
+    std::vector<uint16_t> voxels(region.sizeX() * region.sizeY() * region.sizeZ());
+    REQUIRE(volume.readRegion(1, 0, region, voxels.data()));
+    bool same = true;
+    size_t i = 0;
+    for (uint32_t z = region.minZ; z < region.maxZ; ++z) {
+      for (uint32_t y = region.minY; y < region.maxY; ++y) {
+        for (uint32_t x = region.minX; x < region.maxX; ++x) {
+          same = same && voxels[i++] == TestBrickSource::value(1, x, y, z);
+        }
+      }
+    }
+    REQUIRE(same);
+    REQUIRE(volume.voxel(1, 0, 19, 16, 8) == TestBrickSource::value(1, 19, 16, 8));
+
+    region.maxX = 21;
+    REQUIRE(!volume.readRegion(1, 0, region, voxels.data()));
+  }
+
+  SECTION("Prefetch reads every brick of a region once")
+  {
+    PagedVolume volume(source, 64 * BRICK_BYTES);
+    VoxelRegion region;
+    region.minX = 7;
+    region.maxX = 9;
+    region.maxY = 17;
+    region.maxZ = 1;
+    volume.prefetch(0, 0, region);
+    REQUIRE(source->m_reads == 6);
+    volume.prefetch(0, 0, region);
+    REQUIRE(source->m_reads == 6);
+    REQUIRE(volume.stats().bricks == 6);
+  }
+
+  SECTION("Histograms match those of the whole channel in memory")
+  {
+    PagedVolume volume(source, 2 * BRICK_BYTES);
+    VolumeDimensions dims = source->dimensions();
+    std::vector<uint16_t> voxels(dims.sizeX * dims.sizeY * dims.sizeZ);
+    VoxelRegion all = VoxelRegion().clampedTo(dims.sizeX, dims.sizeY, dims.sizeZ);
+    source->readRegion(1, 0, all, voxels.data());
+    Histogram expected(voxels.data(), voxels.size());
+    Histogram paged = volume.histogram(1, 0);
+    REQUIRE(paged._dataMin == expected._dataMin);
+    REQUIRE(paged._dataMax == expected._dataMax);
+    REQUIRE(paged._pixelCount == expected._pixelCount);
+    REQUIRE(paged._bins == expected._bins);
+  }
+
+  SECTION("Histograms of channels with unreadable bricks are empty")
+  {
+    PagedVolume volume(source, 64 * BRICK_BYTES);
+    volume.brick(0, 0, 0, 0, 0);
+    source->m_fail = true;
+    Histogram paged = volume.histogram(0, 0);
+    source->m_fail = false;
+    REQUIRE(paged._pixelCount == 0);
+    REQUIRE(paged._bins == std::vector<uint32_t>(256, 0));
+  }
+}
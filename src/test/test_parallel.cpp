@@ -0,0 +1,51 @@
+#include "catch.hpp"
+
+#include "graphics/parallel.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+TEST_CASE("parallelFor", "[parallel]")
+{
+  SECTION("Every index is visited exactly once")
+  {
+    static const size_t COUNT = 1000;
+    std::vector<std::atomic<int>> visits(COUNT);
+    for (auto& v : visits) {
+      v = 0;
+    }
+    // catch assertions are not thread safe, so just record what the workers saw
+    std::atomic<uint32_t> maxWorker(0);
+    parallelFor(COUNT, 4, [&](size_t i, uint32_t worker) {
+      visits[i]++;
+      uint32_t seen = maxWorker;
+      while (worker > seen && !maxWorker.compare_exchange_weak(seen, worker)) {
+      }
+    });
+    REQUIRE(maxWorker < 4);
+    for (size_t i = 0; i < COUNT; ++i) {
+      REQUIRE(visits[i] == 1);
+    }
+  }
+
+  SECTION("Thread count is limited by the amount of work")
+  {
+    REQUIRE(parallelThreadCount(0, 8) == 1);
+    REQUIRE(parallelThreadCount(3, 8) == 3);
+    REQUIRE(parallelThreadCount(100, 8) == 8);
+    REQUIRE(parallelThreadCount(100, 0) == std::min<uint32_t>(100, hardwareThreadCount()));
+  }
+
+  SECTION("Exceptions reach the caller")
+  {
+    REQUIRE_THROWS_AS(parallelFor(100,
+                                  4,
+                                  [](size_t i, uint32_t) {
+                                    if (i == 17) {
+                                      throw std::runtime_error("bad index");
+                                    }
+                                  }),
+                      std::runtime_error);
+  }
+}
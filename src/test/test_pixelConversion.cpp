@@ -0,0 +1,230 @@
+#include "catch.hpp"
+
+#include "graphics/pixelConversion.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+TEST_CASE("Pixel conversion", "[pixelConversion]")
+{
+  SECTION("8 to 16 bit widening keeps values for all lengths")
+  {
+    // odd lengths exercise both the vector loop and the scalar tail
+    for (size_t count : { 0, 1, 15, 16, 17, 255, 256, 1000 }) {
+      std::vector<uint8_t> src(count);
+      for (size_t i = 0; i < count; ++i) {
+        src[i] = (uint8_t)(i * 37 + 11);
+      }
+      std::vector<uint16_t> dst(count + 1, 0xffff);
+      widen8to16(src.data(), dst.data(), count);
+      for (size_t i = 0; i < count; ++i) {
+        REQUIRE(dst[i] == src[i]);
+      }
+      // no writes past the end
+      REQUIRE(dst[count] == 0xffff);
+    }
+  }
+
+  SECTION("16 bit byte swapping works for all lengths")
+  {
+    for (size_t count : { 0, 1, 7, 8, 9, 100 }) {
+      // offset by one byte to check unaligned sources
+      std::vector<uint8_t> src(count * 2 + 1);
+      for (size_t i = 0; i < src.size(); ++i) {
+        src[i] = (uint8_t)(i * 29 + 3);
+      }
+      std::vector<uint16_t> dst(count + 1, 0xffff);
+      byteSwap16(src.data() + 1, dst.data(), count);
+      for (size_t i = 0; i < count; ++i) {
+        REQUIRE(dst[i] == (uint16_t)((src[1 + i * 2] << 8) | src[1 + i * 2 + 1]));
+      }
+      REQUIRE(dst[count] == 0xffff);
+    }
+  }
+
+  SECTION("32 bit byte swapping works for all lengths")
+  {
+    for (size_t count : { 0, 1, 3, 4, 5, 100 }) {
+      std::vector<uint8_t> src(count * 4 + 1);
+      for (size_t i = 0; i < src.size(); ++i) {
+        src[i] = (uint8_t)(i * 29 + 3);
+      }
+      std::vector<uint32_t> dst(count + 1, 0xffffffff);
+      byteSwap32(src.data() + 1, dst.data(), count);
+      for (size_t i = 0; i < count; ++i) {
+        const uint8_t* p = src.data() + 1 + i * 4;
+        REQUIRE(dst[i] == (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]));
+      }
+      REQUIRE(dst[count] == 0xffffffff);
+    }
+  }
+
+  SECTION("float min and max ignore NaNs")
+  {
+    for (size_t count : { 1, 3, 4, 5, 17 }) {
+      std::vector<float> src(count);
+      for (size_t i = 0; i < count; ++i) {
+        src[i] = (float)i - 2.5f;
+      }
+      src[count / 2] = std::numeric_limits<float>::quiet_NaN();
+      float lo, hi;
+      minMaxFloat32(src.data(), count, lo, hi);
+      if (count == 1) {
+        REQUIRE(lo > hi);
+      } else {
+        // the NaN is never at either end
+        REQUIRE(lo == -2.5f);
+        REQUIRE(hi == (float)count - 3.5f);
+      }
+    }
+  }
+
+  SECTION("float min and max ignore infinities, which scale to the ends of the range")
+  {
+    const float inf = std::numeric_limits<float>::infinity();
+    for (size_t count : { 2, 3, 4, 5, 9, 17 }) {
+      std::vector<float> src(count);
+      for (size_t i = 0; i < count; ++i) {
+        src[i] = (float)i * 10.0f;
+      }
+      src[0] = -inf;
+      src[count - 1] = inf;
+      float lo, hi;
+      minMaxFloat32(src.data(), count, lo, hi);
+      if (count == 2) {
+        REQUIRE(lo > hi);
+      } else {
+        REQUIRE(lo == 10.0f);
+        REQUIRE(hi == (float)(count - 2) * 10.0f);
+      }
+
+      std::vector<uint16_t> dst(count);
+      scaleFloat32To16(src.data(), dst.data(), count, lo, hi);
+      REQUIRE(dst[0] == 0);
+      REQUIRE(dst[count - 1] == 65535);
+      if (count > 3) {
+        REQUIRE(dst[1] == 0);
+        REQUIRE(dst[count - 2] == 65535);
+      }
+    }
+  }
+
+  SECTION("uint32 min and max cover the full range")
+  {
+    std::vector<uint32_t> src = { 7, 0x80000000u, 3, 0xfffffffeu, 12, 9, 0x7fffffffu };
+    uint32_t lo, hi;
+    minMaxUint32(src.data(), src.size(), lo, hi);
+    REQUIRE(lo == 3);
+    REQUIRE(hi == 0xfffffffeu);
+  }
+
+  SECTION("float scaling fills 16 bits and clamps")
+  {
+    for (size_t count : { 0, 1, 7, 8, 9, 100 }) {
+      std::vector<float> src(count);
+      for (size_t i = 0; i < count; ++i) {
+        src[i] = -1.0f + 2.0f * (float)(i % 11) / 10.0f;
+      }
+      std::vector<uint16_t> dst(count + 1, 0x1234);
+      scaleFloat32To16(src.data(), dst.data(), count, -1.0f, 1.0f);
+      for (size_t i = 0; i < count; ++i) {
+        long expected = std::lround((src[i] + 1.0f) * 65535.0f / 2.0f);
+        REQUIRE(std::abs((long)dst[i] - expected) <= 1);
+      }
+      REQUIRE(dst[count] == 0x1234);
+    }
+    std::vector<float> edges = { -5.0f, 5.0f, std::numeric_limits<float>::quiet_NaN(), 0.0f, 1.0f, 0.5f, 2.0f, -1.0f };
+    std::vector<uint16_t> out(edges.size());
+    scaleFloat32To16(edges.data(), out.data(), edges.size(), 0.0f, 1.0f);
+    REQUIRE(out == std::vector<uint16_t>({ 0, 65535, 0, 0, 65535, 32768, 65535, 0 }));
+    scaleFloat32To16(edges.data(), out.data(), edges.size(), 1.0f, 1.0f);
+    REQUIRE(out == std::vector<uint16_t>(edges.size(), 0));
+  }
+
+  SECTION("uint32 scaling fills 16 bits and clamps")
+  {
+    for (size_t count : { 0, 1, 7, 8, 9, 100 }) {
+      std::vector<uint32_t> src(count);
+      for (size_t i = 0; i < count; ++i) {
+        src[i] = (uint32_t)(i % 11) * 0x19999999u;
+      }
+      std::vector<uint16_t> dst(count + 1, 0x1234);
+      scaleUint32To16(src.data(), dst.data(), count, 0, 0xffffffffu);
+      for (size_t i = 0; i < count; ++i) {
+        long expected = std::lround((double)src[i] * 65535.0 / 4294967295.0);
+        REQUIRE(std::abs((long)dst[i] - expected) <= 1);
+      }
+      REQUIRE(dst[count] == 0x1234);
+    }
+    std::vector<uint32_t> edges = { 0, 5, 10, 20, 0xffffffffu, 15, 0x80000000u, 11 };
+    std::vector<uint16_t> out(edges.size());
+    scaleUint32To16(edges.data(), out.data(), edges.size(), 10, 20);
+    REQUIRE(out == std::vector<uint16_t>({ 0, 0, 0, 65535, 65535, 32768, 65535, 6554 }));
+    scaleUint32To16(edges.data(), out.data(), edges.size(), 7, 7);
+    REQUIRE(out == std::vector<uint16_t>(edges.size(), 0));
+  }
+
+  SECTION("normalizing spans blocks and threads")
+  {
+    // more than one block of the parallel passes
+    size_t count = (1 << 20) * 2 + 5;
+    std::vector<float> src(count);
+    for (size_t i = 0; i < count; ++i) {
+      src[i] = 100.0f + (float)(i % 1000);
+    }
+    src[count - 1] = 1200.0f;
+    src[3] = std::numeric_limits<float>::quiet_NaN();
+    std::vector<uint16_t> dst(count);
+    float lo, hi;
+    normalizeFloat32To16(src.data(), dst.data(), count, 4, lo, hi);
+    REQUIRE(lo == 100.0f);
+    REQUIRE(hi == 1200.0f);
+    REQUIRE(dst[0] == 0);
+    REQUIRE(dst[3] == 0);
+    REQUIRE(dst[count - 1] == 65535);
+
+    std::vector<uint32_t> narrow = { 5, 1000, 65535, 0 };
+    std::vector<uint16_t> narrowOut(narrow.size());
+    uint32_t ulo, uhi;
+    normalizeUint32To16(narrow.data(), narrowOut.data(), narrow.size(), 2, ulo, uhi);
+    REQUIRE(ulo == 0);
+    REQUIRE(uhi == 65535);
+    // values that fit in 16 bits are kept
+    REQUIRE(narrowOut == std::vector<uint16_t>({ 5, 1000, 65535, 0 }));
+
+    std::vector<uint32_t> wide = { 100000, 200000, 150000 };
+    std::vector<uint16_t> wideOut(wide.size());
+    normalizeUint32To16(wide.data(), wideOut.data(), wide.size(), 2, ulo, uhi);
+    REQUIRE(ulo == 100000);
+    REQUIRE(uhi == 200000);
+    REQUIRE(wideOut == std::vector<uint16_t>({ 0, 65535, 32768 }));
+
+    // the range returned is the one scaled from, even when the values kept as they are don't span it
+    std::vector<uint32_t> kept = { 5, 1000 };
+    std::vector<uint16_t> keptOut(kept.size());
+    normalizeUint32To16(kept.data(), keptOut.data(), kept.size(), 2, ulo, uhi);
+    REQUIRE(ulo == 0);
+    REQUIRE(uhi == 65535);
+    REQUIRE(keptOut == std::vector<uint16_t>({ 5, 1000 }));
+  }
+
+  SECTION("converting from a given range ignores the range of the values")
+  {
+    size_t count = (1 << 20) + 3;
+    std::vector<float> src(count, 0.5f);
+    src[0] = -2.0f;
+    src[count - 1] = 0.75f;
+    std::vector<uint16_t> dst(count);
+    convertFloat32To16(src.data(), dst.data(), count, 3, 0.0f, 1.0f);
+    REQUIRE(dst[0] == 0);
+    REQUIRE(dst[1] == 32768);
+    REQUIRE(dst[count - 2] == 32768);
+    REQUIRE(dst[count - 1] == 49151);
+
+    std::vector<uint32_t> usrc = { 5, 1000, 300000 };
+    std::vector<uint16_t> udst(usrc.size());
+    convertUint32To16(usrc.data(), udst.data(), usrc.size(), 2, 0, 200000);
+    REQUIRE(udst == std::vector<uint16_t>({ 2, 328, 65535 }));
+  }
+}
@@ -73,4 +73,27 @@ TEST_CASE("Timeline", "[timeLine]")
     t.setRange(0, 3);
     REQUIRE(t.currentTime() == 3);
   }
+  SECTION("Timeline upcoming times follow direction and wrap mode")
+  {
+    Timeline t(0, 5);
+    t.setCurrentTime(4);
+    REQUIRE(t.direction() == 1);
+    REQUIRE(t.upcomingTimes(3) == std::vector<int32_t>({ 5, 0, 1 }));
+    // never comes back around to the current time
+    REQUIRE(t.upcomingTimes(10) == std::vector<int32_t>({ 5, 0, 1, 2, 3 }));
+    t.increment(-1);
+    REQUIRE(t.direction() == -1);
+    REQUIRE(t.upcomingTimes(4) == std::vector<int32_t>({ 2, 1, 0, 5 }));
+    REQUIRE(t.upcomingTimes(0).empty());
+
+    t.setWrap(Timeline::WrapMode::TIMELINE_CLAMP);
+    REQUIRE(t.upcomingTimes(4) == std::vector<int32_t>({ 2, 1, 0 }));
+    t.increment(1);
+    REQUIRE(t.upcomingTimes(4) == std::vector<int32_t>({ 5 }));
+    t.increment(1);
+    REQUIRE(t.upcomingTimes(4).empty());
+
+    Timeline single;
+    REQUIRE(single.upcomingTimes(2).empty());
+  }
 }
@@ -0,0 +1,61 @@
+#include "catch.hpp"
+
+#include "graphics/voxelRegion.h"
+
+static VoxelRegion
+box(uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY, uint32_t minZ, uint32_t maxZ)
+{
+  VoxelRegion region;
+  region.minX = minX;
+  region.maxX = maxX;
+  region.minY = minY;
+  region.maxY = maxY;
+  region.minZ = minZ;
+  region.maxZ = maxZ;
+  return region;
+}
+
+TEST_CASE("VoxelRegion", "[voxelRegion]")
+{
+  SECTION("The default box is the whole volume")
+  {
+    VoxelRegion whole;
+    REQUIRE(whole.isWhole());
+    REQUIRE(whole.isValid());
+    REQUIRE(whole.clampedTo(30, 20, 10) == box(0, 30, 0, 20, 0, 10));
+  }
+
+  SECTION("Boxes inside the volume are kept as they are")
+  {
+    VoxelRegion inside = box(3, 7, 0, 20, 9, 10);
+    REQUIRE(!inside.isWhole());
+    REQUIRE(inside.isValid());
+    REQUIRE(inside.clampedTo(30, 20, 10) == inside);
+    REQUIRE(inside.sizeX() == 4);
+    REQUIRE(inside.sizeY() == 20);
+    REQUIRE(inside.sizeZ() == 1);
+  }
+
+  SECTION("Boxes are clipped at the far edges of the volume")
+  {
+    REQUIRE(box(25, 40, 5, 100, 0, 11).clampedTo(30, 20, 10) == box(25, 30, 5, 20, 0, 10));
+  }
+
+  SECTION("Boxes outside the volume clamp to nothing")
+  {
+    VoxelRegion outside = box(30, 40, 0, 20, 0, 10).clampedTo(30, 20, 10);
+    REQUIRE(outside.isEmpty());
+    REQUIRE(!outside.isWhole());
+    REQUIRE(box(0, 30, 0, 20, 12, 15).clampedTo(30, 20, 10).isEmpty());
+  }
+
+  SECTION("Degenerate and inverted boxes are invalid, not the whole volume")
+  {
+    for (const VoxelRegion& invalid :
+         { box(0, 30, 0, 20, 4, 4), box(0, 0, 0, 0, 0, 1), box(8, 3, 0, 20, 0, 10), box(0, 30, 15, 5, 0, 10) }) {
+      REQUIRE(!invalid.isWhole());
+      REQUIRE(!invalid.isValid());
+      REQUIRE(invalid.clampedTo(30, 20, 10).isEmpty());
+    }
+  }
+}